@@ -30,6 +30,9 @@ parser = OptionParser(usage='Usage: %prog <options> project_directory', descript
 parser.add_option("-k", dest="kmersize", default=23, type="int" , help="kmer size.  Default = 23")
 parser.add_option("-f", dest="hashfact", default=17, type="int" , help="Hashing factor.  Default = 17")
 parser.add_option("-H", dest="hashsize", default=10000000, type="int" , help="Hash size.  Default = 10000000")
+parser.add_option("-t", dest="threads", default=1, type="int" , help="Counting threads per GenomeBVcount job.  Default = 1")
+parser.add_option("-1","--onepass", dest="onepass", action="store_true" , help="Run one GenomeBVcount job that reads the input once and writes all hashfact slices.  Needs hashfact times the memory of a one-slice job.")
+parser.add_option("-R","--mixslice", dest="mixslice", action="store_true" , help="Slice kmers by a mixed hash (GenomeBVcount -R) for evener slices.  Later tools on these slices need -R too.")
 parser.add_option("-C", dest="cmdfile", default=False , help="Instead of running, write commands to file FILE")
 parser.add_option("-a", dest="analysis_dir", default="JAM-"+date.today().strftime("%Y.%m.%d"), type="string" , help="Output directory.  Default = JAM-%s"%(date.today().strftime("%Y.%m.%d")))
 parser.add_option("-w","--wait", dest="wait", action="store_true" , help="Wait for the submitted pbs jobs to be done.")
@@ -135,8 +138,16 @@ if options.cmdfile:
 #hashfact=17
 #analysis_dir="JAM"
 job_ids=[]
-for i in range(options.hashfact):
-    cmd = "GenomeBVcount -H %d -S %d:%d -d + -o %d %s > %s/GenomeBVcount.%d-%d.out 2> %s/GenomeBVcount.%d-%d.err"  % (options.hashsize, options.hashfact,i,options.kmersize,filelist,outdir,options.hashfact,i,outdir,options.hashfact,i ) #,analysis_dir,options.hashfact,i,analysis_dir,options.hashfact,i)
+mixslice = " -R" if options.mixslice else ""
+if options.onepass:
+    slices = ["all"]
+else:
+    slices = range(options.hashfact)
+for i in slices:
+    if i == "all":
+        cmd = "GenomeBVcount%s -t %d -H %d -S %d -A %s/GenomeBVcount -d + -o %d %s > /dev/null 2> %s/GenomeBVcount.%d.err"  % (mixslice, options.threads, options.hashsize, options.hashfact,outdir,options.kmersize,filelist,outdir,options.hashfact)
+    else:
+        cmd = "GenomeBVcount%s -t %d -H %d -S %d:%d -d + -o %d %s > %s/GenomeBVcount.%d-%d.out 2> %s/GenomeBVcount.%d-%d.err"  % (mixslice, options.threads, options.hashsize, options.hashfact,i,options.kmersize,filelist,outdir,options.hashfact,i,outdir,options.hashfact,i ) #,analysis_dir,options.hashfact,i,analysis_dir,options.hashfact,i)
 # ; cat ../../../%s/kmers/GenomeBVcount.%d-%d.out |  perl -ane 'print hex($F[1]); print \"\\n\"'  | perl ~/scripts/histogram2.pl - 1 1 > ../../../%s/kmers/GenomeBVcount.%d-%d.histogram.txt ; " 
 #    cmd = "/home/havlak/bin/src/newGenomeMerHist/GenomeBVcount -H %d -S %d:%d -d + -o %d %s > ../../../%s/kmers/GenomeBVcount.%d-%d.out 2> ../../../%s/kmers/GenomeBVcount.%d-%d.err ; cat ../../../%s/kmers/GenomeBVcount.%d-%d.out |  perl -ane 'print hex($F[1]); print \"\\n\"'  | perl ~/scripts/histogram2.pl - 1 1 > ../../../%s/kmers/GenomeBVcount.%d-%d.histogram.txt ; " % (options.hashsize, options.hashfact,i,options.kmersize,filelist,analysis_dir,options.hashfact,i,analysis_dir,options.hashfact,i,analysis_dir,options.hashfact,i,analysis_dir,options.hashfact,i)
 #    cmd = "cat ../../../%s/kmers/GenomeBVcount.%d-%d.out |  perl -ane 'print hex($F[1]); print \"\\n\"'  | perl ~/scripts/histogram2.pl - 1 1 > ../../../%s/kmers/GenomeBVcount.%d-%d.histogram.txt ; " % (analysis_dir,options.hashfact,i,analysis_dir,options.hashfact,i)
@@ -1,17 +1,34 @@
 #include "OligoSeq.hh"
 #include "OligoHashSide.hh"
+#include "OligoQuotient.hh"
+#include "OligoSketch.hh"
+#include "OligoPatterns.hh"
+#include "OligoDirect.hh"
 #include "getprime.hh"
 #include <string>
-#include "gzstream.h"
+#include "OligoInput.hh"
 #include <iomanip>
 #include <cctype>
 #include <cstdio>
+#include <vector>
+#include <sstream>
+#include <pthread.h>
 
 Oligos::Index OptOligoLen;
 Oligos::Index OptHashSize;
 Oligos::Index OptHashSlicing;
 Oligos::Index OptHashSlice;
+Oligos::Index OptThreads;
+double OptMaxLoad;
+double OptPurgeLoad;
+Oligos::Index OptBloomBits;
 bool OptSoftMasking;
+bool OptQuotient;
+bool OptDictionary;
+Oligos::Index OptDirectLen;
+Oligos::Index OptPlanSampling;
+double OptMemBudget;
+string OptAllSlices;
 string OptDebug;
 
 bool debugging(const char which[]) {
@@ -25,10 +42,50 @@ bool debugging(const char which[]) {
 
 void PrintOptions() {
   cerr << "Option values are:\n"<<
-    "   -o {OligoLen}    ["<< OptOligoLen << "] Length of oligos (odd, usually >= 21, must be in 9..31).\n" <<
+    "   -o {OligoLen}    ["<< OptOligoLen << "] Length of oligos (odd, usually >= 21, must be in 9..63;\n" <<
+    "                                       over 31 runs GenomeBVcountWide, with 128-bit kmers).\n" <<
     "   -H {HashSize}    ["<< OptHashSize    <<"] Number of cells in hash table (can choose based on InputTable).\n" <<
+    "   -N {MemPolicy}   ["<< tablePolicy().spec <<"] Allocate big tables as this comma-separated list says: huge\n" <<
+    "                                       (transparent huge pages), huge2m or huge1g (reserved huge pages),\n" <<
+    "                                       interleave (across NUMA nodes) or bind (to node Slice % nodes), and\n" <<
+    "                                       touch=N (zero them with N threads); see OligoMemory.hh.\n" <<
+    "   -q {FastqMask}   ["<< fastqMasking().spec <<"] Mask FASTQ input (read directly) as scripts/fastq2fam.pl would: a\n" <<
+    "                                       comma-separated list of m=, soft=, zq=, pre=, suf=, bnum=, bs= and r=\n" <<
+    "                                       settings, named for its options; see OligoFastq.hh.\n" <<
+    "   -L {MaxLoad}     ["<< OptMaxLoad <<"] Grow (rehash into a table twice as big) whenever a table's distinct kmers\n" <<
+    "                                       reach this fraction of its cells, e.g. 0.8; 0 means never grow.\n" <<
+    "   -P {PurgeLoad}   ["<< OptPurgeLoad <<"] Purge the kmers seen only once so far whenever a table's distinct kmers\n" <<
+    "                                       reach this fraction of its cells (below MaxLoad, if growing), e.g. 0.7;\n" <<
+    "                                       0 means never purge.  Kmers seen once before a purge and again after\n" <<
+    "                                       are undercounted by one, and lose their earlier seqset bits.\n" <<
+    "   -B {BloomBits}   ["<< OptBloomBits <<"] With -P, remember purged kmers in a Bloom filter of this many bits per\n" <<
+    "                                       table cell (e.g. 8, for about 2% false positives), so that a purged kmer\n" <<
+    "                                       seen again is counted as 2; 0 means no filter.\n" <<
     "   -S {Slicing[:Slice]} [" << OptHashSlicing << ":" << OptHashSlice << "] Slicing factor and slice for unpartnered kmers.\n" <<
+    "   -R               ["<< mixedSlicing() <<"] Slice by a mixed hash of each kmer, not kmer % Slicing: evener slices, but\n" <<
+    "                                       every tool run on the same tables must be given -R too (see OligoSlice.hh).\n" <<
     "   -x {SoftMasking} ["<< OptSoftMasking <<"] Treat lowercase as masked?\n" <<
+    "   -t {Threads}     ["<< OptThreads <<"] Number of counting threads, sharing input files and batches of reads.\n" <<
+    "   -Q               ["<< OptQuotient <<"] Use compact (quotient) tables, with each kmer's seqset bits in its cell\n" <<
+    "                                       rather than in a side array: half the memory per cell.  Excludes -L and -P.\n" <<
+    "   -D               ["<< OptDictionary <<"] Keep each kmer's seqset bits as a 16-bit id in a shared dictionary of the\n" <<
+    "                                       bit patterns seen (at most 65536 of them): 10 rather than 16 bytes per\n" <<
+    "                                       cell.  Excludes -Q.\n" <<
+    "   -K {DirectLen}   ["<< OptDirectLen <<"] Count kmers of OligoLen up to DirectLen (at most 15) in a direct-addressed\n" <<
+    "                                       table, with a count for every possible kmer: no hashing, and -H, -L, -P,\n" <<
+    "                                       -B, -Q and -M don't apply.  0 to hash kmers of any length.\n" <<
+    "   -A {OutPrefix}   ["<< OptAllSlices <<"] Count all slices in one pass over the input, writing each slice's kmers\n" <<
+    "                                       to OutPrefix.{Slicing}-{Slice}.out and its histogram to OutPrefix.{Slicing}-{Slice}.err\n" <<
+    "                                       (-H is then the size of each slice's table).\n" <<
+    "   -p {Sampling}    ["<< OptPlanSampling <<"] Plan slicing instead of counting: from 1 in Sampling (e.g. 64) of the input's\n" <<
+    "                                       distinct kmers, estimate each slice's distinct kmers with plain and with\n" <<
+    "                                       mixed (-R) slicing, and plan -S and -H as for -M; print them to STDOUT\n" <<
+    "                                       and exit.  0 means count.\n" <<
+    "   -M {MemBudget}   ["<< OptMemBudget <<"] Memory for this run's tables, in bytes or with K, M, G or T: pre-scan\n" <<
+    "                                       the input to estimate its distinct kmers, then set -H to hold this\n" <<
+    "                                       slice's at the -L load (with -P, its repeated kmers at half the purge\n" <<
+    "                                       load), warning if that takes more, and which slicing would fit;\n" <<
+    "                                       0 means no pre-scan.\n" <<
     "   -h               Print help information.\n" <<
     "   -d {DebugString} ["<< OptDebug <<"] Each character indicates a debugging option to turn on;\n" <<
     "                                       '+' indicates turn on all debugging.\n" <<
@@ -100,6 +157,16 @@ int SetupOptions(int argc, char**argv)
   OptHashSlicing = 11;        // -S <small_prime>[:<hashslice in 0..small_prime-1>]
   OptHashSlice   = 0;         // override with :# on OptHashSlicing
   OptSoftMasking = false;     // -x
+  OptThreads     = 1;         // -t
+  OptMaxLoad     = 0;         // -L
+  OptPurgeLoad   = 0;         // -P
+  OptBloomBits   = 0;         // -B
+  OptAllSlices   = "";        // -A
+  OptPlanSampling = 0;        // -p
+  OptMemBudget   = 0;         // -M
+  OptQuotient    = false;     // -Q
+  OptDictionary  = false;     // -D
+  OptDirectLen   = OligoDirectTable<Oligos::Index64>::MAXLENGTH; // -K
   OptDebug = "";              // 'd'
 
   // Handle the options...
@@ -113,6 +180,20 @@ int SetupOptions(int argc, char**argv)
       case 'o':
         OptOligoLen = strtol(argv[++i], NULL, 0);
         break;
+      case 'N':
+        if (! tablePolicy().parse(argv[++i])) {
+          PrintOptions();
+          cerr << "Argument error: -N " << argv[i] << "; MemPolicy words are huge, huge2m, huge1g, interleave, bind and touch=N.\n";
+          exit(-1);
+        }
+        break;
+      case 'q':
+        if (! fastqMasking().parse(argv[++i])) {
+          PrintOptions();
+          cerr << "Argument error: -q " << argv[i] << "; FastqMask settings are m=, soft=, zq=, pre=, suf=, bnum=, bs= and r= (a regular expression).\n";
+          exit(-1);
+        }
+        break;
       case 'H': {
         OptHashSize = strtoll(argv[++i], NULL, 0); 
         prime = get_prime(OptHashSize);
@@ -123,11 +204,48 @@ int SetupOptions(int argc, char**argv)
         }
       }
         break;
+      case 'L':
+        OptMaxLoad = strtod(argv[++i], NULL);
+        break;
+      case 'P':
+        OptPurgeLoad = strtod(argv[++i], NULL);
+        break;
+      case 'B':
+        OptBloomBits = strtol(argv[++i], NULL, 0);
+        break;
+      case 'R':
+        mixedSlicing() = true;
+        break;
       case 'S':
         parseSlicing(argv[++i]); // sets OptHashSlicing and OptHashSlice
         break;
       case 'x':
         OptSoftMasking = true; break;
+      case 't':
+        OptThreads = strtol(argv[++i], NULL, 0);
+        break;
+      case 'A':
+        OptAllSlices = argv[++i]; break;
+      case 'Q':
+        OptQuotient = true; break;
+      case 'D':
+        OptDictionary = true; break;
+      case 'K':
+        OptDirectLen = strtol(argv[++i], NULL, 0); break;
+      case 'p':
+        OptPlanSampling = strtol(argv[++i], NULL, 0); break;
+      case 'M': {
+        // bytes, or K, M, G or T of them
+        char *unit;
+        OptMemBudget = strtod(argv[++i], &unit);
+        const char units[] = "KMGT";
+        for (int u = 0; units[u]; u++) {
+          if (toupper(*unit) == units[u]) {
+            OptMemBudget *= pow(1024.0, u + 1);
+          }
+        }
+      }
+        break;
       case 'd':
         OptDebug = argv[++i]; break;
       case 'h':
@@ -145,9 +263,47 @@ int SetupOptions(int argc, char**argv)
     }
   }
  EndOptions:
-  if (!(OptOligoLen % 2) || (OptOligoLen < 9) || (OptOligoLen > 31)) {
+  runWide(argv, OptOligoLen);
+  if (!(OptOligoLen % 2) || (OptOligoLen < 9) || (OptOligoLen > Oligos::WIDEMAXLENGTH)) {
+    PrintOptions();
+    cerr << "Argument error: -o " << OptOligoLen << "; OligoLen must be odd, in [9.."
+         << Oligos::WIDEMAXLENGTH << "].\n";
+    exit(-1);
+  }
+  if (OptQuotient && OptOligoLen > 31) {
+    PrintOptions();
+    cerr << "Argument error: -Q tables only hold kmers of up to 31 bases.\n";
+    exit(-1);
+  }
+  if (OptThreads < 1) {
+    PrintOptions();
+    cerr << "Argument error: -t " << OptThreads << "; need at least one thread.\n";
+    exit(-1);
+  }
+  if (OptMaxLoad < 0 || OptMaxLoad >= 1) {
+    PrintOptions();
+    cerr << "Argument error: -L " << OptMaxLoad << "; MaxLoad must be in [0..1).\n";
+    exit(-1);
+  }
+  if (OptPurgeLoad < 0 || OptPurgeLoad >= 1) {
     PrintOptions();
-    cerr << "Argument error: -o " << OptOligoLen << "; OligoLen must be odd, in [9..31].\n";
+    cerr << "Argument error: -P " << OptPurgeLoad << "; PurgeLoad must be in [0..1).\n";
+    exit(-1);
+  }
+  if (OptQuotient && (OptMaxLoad > 0 || OptPurgeLoad > 0)) {
+    PrintOptions();
+    cerr << "Argument error: -Q tables can't grow (-L) or purge (-P).\n";
+    exit(-1);
+  }
+  if (OptDirectLen > OligoDirectTable<Oligos::Index64>::MAXLENGTH) {
+    PrintOptions();
+    cerr << "Argument error: -K " << OptDirectLen << "; DirectLen must be at most "
+         << OligoDirectTable<Oligos::Index64>::MAXLENGTH << ".\n";
+    exit(-1);
+  }
+  if (OptQuotient && OptDictionary) {
+    PrintOptions();
+    cerr << "Argument error: -Q and -D are two ways to keep seqset bits; choose one.\n";
     exit(-1);
   }
   if (debugging("o")) PrintOptions();
@@ -161,87 +317,347 @@ inline Oligos::Index kidbit(Oligos::Index kid)
 
 // An OligoHash table with an extra side array of 64-bit integers that will be used as bit vectors.
 typedef OligoHash<Oligos::Index64> OligoHashX;
+// With -Q, a compact table keeping the bit vectors in its cells (Info2) instead.
+typedef OligoQuotientHash OligoHashQ;
+// With -D, one with a side array of 16-bit ids of the bit vectors in SeqsetPatterns.
+typedef OligoHash<PatternDictionary::Id> OligoHashD;
+PatternDictionary SeqsetPatterns;
+// For OligoLen up to -K, tables with a cell for every kmer (and the same side arrays).
+typedef OligoDirectTable<Oligos::Index64> OligoDirectX;
+typedef OligoDirectTable<PatternDictionary::Id> OligoDirectD;
 
-int main(int argc, char *argv[]) {
-  int firstNonOption = SetupOptions(argc, argv);
+// Either one table for one slice, or (with -A) one table for each slice,
+// indexed by slice number.
+template<class OH> class SliceTables: public vector<OH *> { };
 
-  if (debugging("b")) {
-    cerr << dec << "Sizeof Oligos::Index   = " << sizeof(Oligos::Index) << endl;
-    cerr << dec << "Sizeof Oligos::Index64 = " << sizeof(Oligos::Index64) << endl;
-    Oligos::Index64 test = 0;
-    for (int i = 1; i <= 64; i += 3) {
-      test |= kidbit(i);
-      cerr << "Setting bit #i: " << dec << i 
-           << ", bitvector now = " << hex << test 
-           << dec << endl;
-    }
+// Make a table for one slice, with room for nseqsets bits per kmer.
+template<class T2>
+void newTable(OligoHash<T2> *&oh, Oligos::Index slice, int nseqsets) {
+  oh = new OligoHash<T2>(OptHashSize, OptHashSlicing, slice, OptOligoLen);
+  oh->setGrowth(OptMaxLoad, OptThreads);
+  if (OptPurgeLoad > 0) {
+    oh->setPurge(OptPurgeLoad,
+                 (OptBloomBits
+                  ? new OligoBloom(OptBloomBits * oh->Size)
+                  : 0));
+  }
+}
+void newTable(OligoHashQ *&oh, Oligos::Index slice, int nseqsets) {
+  oh = new OligoHashQ(OptHashSize, OptHashSlicing, slice, OptOligoLen, nseqsets);
+}
+// Direct tables for all slices (-A) share the first one's arrays.
+template<class T2>
+void newTable(OligoDirectTable<T2> *&oh, Oligos::Index slice, int nseqsets) {
+  static OligoDirectTable<T2> *whole = 0;
+  if (! whole) {
+    whole = new OligoDirectTable<T2>(OptHashSlicing, slice, OptOligoLen);
+  }
+  oh = new OligoDirectTable<T2>(*whole, slice);
+}
+
+// Mark the kmer in cell wi as present in a sequence set, and get back all
+// the sequence sets it is in.
+template<bool Atomic, class Sides>
+inline void markBits(Sides &side, Oligos::Index wi, Oligos::Index64 bit) {
+  if (Atomic) {
+    __sync_fetch_and_or(&(side[wi]), bit);
+  }
+  else {
+    side[wi] |= bit;
   }
+}
+template<bool Atomic>
+inline void markSeqset(OligoHashX &oh, Oligos::Index wi, Oligos::Index64 bit) {
+  markBits<Atomic>(oh.side, wi, bit);
+}
+template<bool Atomic>
+inline void markSeqset(OligoDirectX &oh, Oligos::Index wi, Oligos::Index64 bit) {
+  markBits<Atomic>(oh.side, wi, bit);
+}
+template<bool Atomic>
+inline void markSeqset(OligoHashQ &oh, Oligos::Index wi, Oligos::Index64 bit) {
+  if (Atomic) {
+    oh.orInfo2Atomic(wi, bit);
+  }
+  else {
+    oh.orInfo2(wi, bit);
+  }
+}
+template<bool Atomic, class Sides>
+inline void markPattern(Sides &side, Oligos::Index wi, Oligos::Index64 bit) {
+  unsigned seqset = __builtin_ctzll(bit);
+  PatternDictionary::Id id, to;
+  do {
+    id = side[wi];
+    to = SeqsetPatterns.with(id, seqset);
+    if (to == id) return;
+  } while (Atomic
+           ? ! __sync_bool_compare_and_swap(&(side[wi]), id, to)
+           : ((side[wi] = to), false));
+}
+template<bool Atomic>
+inline void markSeqset(OligoHashD &oh, Oligos::Index wi, Oligos::Index64 bit) {
+  markPattern<Atomic>(oh.side, wi, bit);
+}
+template<bool Atomic>
+inline void markSeqset(OligoDirectD &oh, Oligos::Index wi, Oligos::Index64 bit) {
+  markPattern<Atomic>(oh.side, wi, bit);
+}
+inline Oligos::Index64 seqsets(OligoHashX &oh, Oligos::Index wi) {
+  return oh.side[wi];
+}
+inline Oligos::Index64 seqsets(OligoDirectX &oh, Oligos::Index wi) {
+  return oh.side[wi];
+}
+inline Oligos::Index64 seqsets(OligoHashD &oh, Oligos::Index wi) {
+  return SeqsetPatterns.pattern(oh.side[wi]);
+}
+inline Oligos::Index64 seqsets(OligoDirectD &oh, Oligos::Index wi) {
+  return SeqsetPatterns.pattern(oh.side[wi]);
+}
+inline Oligos::Index64 seqsets(OligoHashQ &oh, Oligos::Index wi) {
+  return oh.getInfo2(oh.hash[wi]);
+}
 
-  OligoHashX oh(OptHashSize,
-                OptHashSlicing, OptHashSlice, 
-                OptOligoLen);
+// Running totals for the kmers counted from one input file
+class Tally {
+public:
+  long nseqs;
+  long bases;
+  long unambiguous;
+  long oligos;
+  Tally() : nseqs(0), bases(0), unambiguous(0), oligos(0) { }
+  void add(OligoSeq &kmers) {
+    bases       += kmers.base_count();
+    unambiguous += kmers.unambiguous_count();
+    oligos      += kmers.oligo_count();
+  }
+  void add(Tally &t) {
+    nseqs       += t.nseqs;
+    bases       += t.bases;
+    unambiguous += t.unambiguous;
+    oligos      += t.oligos;
+  }
+};
 
-  int nseqs  = 0;
-  int seqset = 1;
-  int filearg = 0;
-  long bases = 0;
-  long unambiguous = 0;
-  long oligos = 0;
+// Number of sequences seen so far, over all files and threads (for progress messages).
+long SeqCount = 0;
 
-  for (filearg = firstNonOption; filearg < argc; filearg++) {
-    if (!strcmp("/", argv[filearg])) {
-      seqset++;
-      cerr << "Advancing to sequence set " << seqset << endl;
+// With -t and -L or -P, counting threads hold GrowLock for reading while
+// they insert, and a thread that finds a table overloaded (or full) trades
+// up to the write lock to purge or grow it, so that no inserts overlap.
+pthread_rwlock_t GrowLock;
+
+template<class T2>
+void growShared(OligoHash<T2> &oh, Oligos::Index seenSize, bool full) {
+  pthread_rwlock_unlock(&GrowLock);
+  pthread_rwlock_wrlock(&GrowLock);
+  if (oh.Size == seenSize) { // not already grown by another thread meanwhile
+    if (oh.overloaded()) {   // (nor purged)
+      oh.relieve(OptThreads);
     }
-    else {
-      cerr << "Opening sequence file " << argv[filearg] << endl;
-      igzstream inputf(argv[filearg]);
+    else if (full) {
+      oh.grow(OptThreads);
+    }
+  }
+  pthread_rwlock_unlock(&GrowLock);
+  pthread_rwlock_rdlock(&GrowLock);
+}
+// -Q and direct tables never grow or purge (nor are they ever overloaded).
+void growShared(OligoHashQ &oh, Oligos::Index seenSize, bool full) { }
+template<class T2>
+void growShared(OligoDirectTable<T2> &oh, Oligos::Index seenSize, bool full) { }
 
-      OligoSeq kmers(OptOligoLen, inputf, OptSoftMasking);
-      int np;
-      while ((np = kmers.nextPos()) >= 0) {
-        if (np > 0) {
-          OligoSeq::Oligo w = kmers.current();
-          OligoSeq::Index wi;
-          OligoHashX::HashFlag hf = oh.lookuploc(w, wi);
-
-          if (hf == OligoHashX::FOUND) {
-            oh.side[wi] |= kidbit(seqset);
-            oh.increment(oh.hash[wi]);
-            oh.insertions++;
-          }
-          else if (hf == OligoHashX::MISSING) {
-            oh.hash[wi] = 0;
-            oh.side[wi] = kidbit(seqset);
-            oh.putOligo(oh.hash[wi], w);
-            oh.increment(oh.hash[wi]);
-            oh.insertions++;
-            oh.distinct++;
+// Whether a table has a kmer in cell index
+template<class OH>
+inline bool occupied(OH &oh, Oligos::Index index) {
+  return oh.hash[index];
+}
+template<class T2>
+inline bool occupied(OligoDirectTable<T2> &oh, Oligos::Index index) {
+  return oh.occupied(index);
+}
+
+// Count all kmers from a stream of sequences into the table for their slice,
+// marking each kmer as present in sequence set seqset. With Atomic, many
+// threads may be counting into the same tables at once.
+// Kmers come a batch at a time, so that each kmer's home cell can be
+// prefetched while earlier kmers are being counted.
+template<bool Atomic, class OH>
+void countKmers(SliceTables<OH> &tables, OligoSeq &kmers, int seqset, Tally &tally) {
+  const Oligos::Index64 bit = kidbit(seqset);
+  const Oligos::Index ntables = tables.size();
+  const Oligos::Index ahead = OH::PREFETCHAHEAD;
+  OligoBatch batch;
+  OligoSeq::Index locs[OligoBatch::MAXKMERS];
+  typename OH::HashFlag flags[OligoBatch::MAXKMERS];
+  int nb, b;
+  while ((nb = kmers.nextBatch(batch)) >= 0) {
+    if (nb > 0 && ! Atomic && ntables == 1) {
+      // The common case: one table, one thread
+      OH &oh = *(tables[0]);
+      int done;
+      for (int from = 0; from < nb; from += done) {
+        done = oh.insertlocBatch(batch.norm + from, nb - from, locs, flags);
+        for (b = 0; b < done; b++) {
+          if (flags[b] == OH::FOUND || flags[b] == OH::MISSING) {
+            markSeqset<false>(oh, locs[b], bit);
           }
         }
-        else { // ! np, end of a sequence fragment (read or contig)
-          if (! (++nseqs % 100000)) {
-            cerr << "@ " << nseqs << " sequences: " << kmers.get_descrip() << endl;
-          }
+      }
+    }
+    else if (nb > 0) {
+      for (b = 0; b < nb && b < ahead; b++) {
+        tables[(ntables > 1)? sliceOf(batch.norm[b], ntables) : 0]->prefetch(batch.norm[b]);
+      }
+      for (b = 0; b < nb; b++) {
+        if (b + ahead < nb) {
+          OligoSeq::Oligo wa = batch.norm[b + ahead];
+          tables[(ntables > 1)? sliceOf(wa, ntables) : 0]->prefetch(wa);
+        }
+        OligoSeq::Oligo w = batch.norm[b];
+        OligoSeq::Index wi;
+        // Route to the kmer's own slice table when counting all slices at once;
+        // otherwise the single table rejects kmers outside its slice.
+        OH &oh = *(tables[(ntables > 1)? sliceOf(w, ntables) : 0]);
+        typename OH::HashFlag hf;
+        while (1) {
+          // (Without Atomic, insertloc grows the table itself as needed.)
+          Oligos::Index seenSize = oh.Size;
+          hf = (Atomic
+                ? oh.insertlocAtomic(w, wi)
+                : oh.insertloc(w, wi));
+          if (! (Atomic && hf == OH::FULL && OptMaxLoad > 0)) break;
+          growShared(oh, seenSize, true);
+        }
+
+        if (hf == OH::FOUND || hf == OH::MISSING) {
+          markSeqset<Atomic>(oh, wi, bit);
+        }
+        if (Atomic && hf == OH::MISSING && oh.overloaded()) {
+          growShared(oh, oh.Size, false);
         }
       }
-      // now np < 0
-      cerr << "done with " << argv[filearg] << " (np= " << np << " )" << endl;
-      if (debugging("s")) {
-        cerr << "#" << seqset << "\tbase_count:\t"  << kmers.base_count()        << endl 
-             << "#" << seqset << "\tunambiguous:\t" << kmers.unambiguous_count() << endl
-             << "#" << seqset << "\toligo_count:\t" << kmers.oligo_count()       << endl
-          ;
+    }
+    else { // ! nb, end of a sequence fragment (read or contig)
+      tally.nseqs++;
+      long nseqs = (Atomic ? __sync_add_and_fetch(&SeqCount, 1) : ++SeqCount);
+      if (! (nseqs % 100000)) {
+        cerr << "@ " << nseqs << " sequences: " << kmers.get_descrip() << endl;
       }
-      bases += kmers.base_count();
-      unambiguous += kmers.unambiguous_count();
-      oligos += kmers.oligo_count();
-      inputf.close();
     }
   }
+  tally.add(kmers);
+}
+
+// Multithreaded counting: threads take turns reading batches of whole
+// sequences from each input file, then count their batches in parallel.
+const long BATCHSEQS = 10000;
+
+class MemBuf: public streambuf {
+public:
+  MemBuf(char *p, size_t n) { setg(p, p, p + n); }
+};
 
+class InputFile {
+public:
+  const char *name;
+  int seqset;
+  OligoInput *in;
+  bool done;
+  bool fastq;      // four lines to a read, and any may start with '>'
+  string pending;  // description line that begins the next batch
+  Tally tally;
+  pthread_mutex_t lock;
+
+  InputFile(const char *Name, int Seqset) :
+    name(Name), seqset(Seqset), in(0), done(false), fastq(false)
+  {
+    pthread_mutex_init(&lock, NULL);
+  }
+  // Collect up to BATCHSEQS sequences into batch; false if the file is used up.
+  bool nextBatch(string &batch) {
+    long nseqs = 0;
+    string line;
+    batch.clear();
+    pthread_mutex_lock(&lock);
+    if (! done && ! in) {
+      cerr << "Opening sequence file " << name << endl;
+      in = new OligoInput(name);
+      fastq = ('@' == in->peek());
+    }
+    if (! done) {
+      batch = pending;
+      if (fastq && pending.length()) {
+        nseqs = 1;  // lines, for FASTQ
+      }
+      pending.clear();
+      bool more = false;
+      while (getline(*in, line)) {
+        if (fastq ? (nseqs++ == 4 * BATCHSEQS)
+            : ('>' == line[0] && ++nseqs > BATCHSEQS)) {
+          pending = line + '\n';
+          more = true;
+          break;
+        }
+        batch += line;
+        batch += '\n';
+      }
+      if (! more) {
+        in->close();
+        delete in;
+        in = 0;
+        done = true;
+      }
+    }
+    pthread_mutex_unlock(&lock);
+    return batch.length() > 0;
+  }
+  void add(Tally &t) {
+    pthread_mutex_lock(&lock);
+    tally.add(t);
+    pthread_mutex_unlock(&lock);
+  }
+};
+
+template<class OH> class CountWorker {
+public:
+  SliceTables<OH> *tables;
+  vector<InputFile *> *files;
+  unsigned id;
+  pthread_t thread;
+};
+
+template<class OH> void *countWorker(void *arg) {
+  CountWorker<OH> *cw = (CountWorker<OH> *) arg;
+  vector<InputFile *> &files = *(cw->files);
+  string batch;
+  unsigned nfiles = files.size();
+
+  // Start threads spread across the files, then move on to whatever
+  // files still have sequence left.
+  for (unsigned f = 0; f < nfiles; f++) {
+    InputFile *file = files[(cw->id + f) % nfiles];
+    while (file->nextBatch(batch)) {
+      MemBuf mb((char *) batch.data(), batch.length());
+      istream batchin(&mb);
+      OligoSeq kmers(OptOligoLen, batchin, OptSoftMasking);
+      Tally t;
+      pthread_rwlock_rdlock(&GrowLock);
+      countKmers<true>(*(cw->tables), kmers, file->seqset, t);
+      pthread_rwlock_unlock(&GrowLock);
+      file->add(t);
+    }
+  }
+  return NULL;
+}
+
+// Print the kmers seen more than once, with their counts and bitvectors, to out;
+// and a histogram of kmer frequencies, with totals for all the input, to log.
+template<class OH> void printTable(OH &oh, Tally &total, ostream &out, ostream &log) {
   // Histogram is count for # of kmers with each frequency.
-  // Frequency of each kmer is stored in spare bits of each Oligo object in the hash table (info1).
+  // Frequency of each kmer is stored in spare bits of each Oligo object in the hash table (info1),
+  // or in the table's overflow once too big for those (oh.count() knows which).
   // (In fact, nonzero info1 doubles as a sign of non-empty Oligo cell.)
   // Let's max out the histogram at kmer frequency 0x3FFF (16383_10),
   // because we're unlikely to be interested in precise counts higher than that --
@@ -249,14 +665,14 @@ int main(int argc, char *argv[]) {
   // (Higher-frequency kmers will be counted as having frequence 0x3FFF.)
   const Oligos::Index FREQLIMIT = 0x4000UL;
   long histogram[FREQLIMIT] = { 0 };
-  const Oligos::Index MAXFREQ = min(FREQLIMIT, 1UL << oh.Info1Len) - 1;
-  cerr << "# Histogram infinity value:\t0x" << hex << MAXFREQ << dec << "\t" << MAXFREQ << endl;
-  Oligos::Oligo* op;
-
-  cout << hex;
-  for (op = oh.first(); op; op = oh.next(op)) {
-    Oligos::Index index = op - oh.hash;
-    Oligos::Index freq = oh.getInfo1(*op);
+  const Oligos::Index MAXFREQ = FREQLIMIT - 1;
+  log << "# Histogram infinity value:\t0x" << hex << MAXFREQ << dec << "\t" << MAXFREQ << endl;
+  out << hex;
+  // By index, not by cell address: cells needn't be contiguous (OligoLayout.hh)
+  for (Oligos::Index index = 0; index < oh.Size; index++) {
+    if (! occupied(oh, index))
+      continue;
+    Oligos::Index freq = oh.count(index);
     if (freq <= MAXFREQ) {
       histogram[freq]++;
     }
@@ -265,20 +681,253 @@ int main(int argc, char *argv[]) {
     }
     if (freq < 2)
       continue;
-    cout << setw((oh.Length + 1) / 2) << setfill('0') << oh.getOligo(*op) 
-         << setw(0) 
-         << "\t" << freq
-         << "\t" << oh.side[index]
-         << endl;
-  }
-  cout << dec << setw(1) << setfill(' ');
-  cerr << "# Histogram:" << dec << endl;
-  cerr << "# total_bases:\t"   << bases << endl;
-  cerr << "# total_unambig:\t" << unambiguous << endl;
-  cerr << "# total_oligos:\t"  << oligos << endl;
+    out << setw((oh.Length + 1) / 2) << setfill('0') << oh.oligoAt(index)
+        << setw(0) 
+        << "\t" << freq
+        << "\t" << seqsets(oh, index)
+        << "\n";  // not endl: a flush per kmer costs more than counting it
+  }
+  out << dec << setw(1) << setfill(' ');
+  log << "# Histogram:" << dec << endl;
+  log << "# total_bases:\t"   << total.bases << endl;
+  log << "# total_unambig:\t" << total.unambiguous << endl;
+  log << "# total_oligos:\t"  << total.oligos << endl;
+  if (OptPurgeLoad > 0) {
+    log << "# purged_singletons:\t" << oh.purged << endl;
+  }
   for (long hi = 1; hi <= MAXFREQ; hi++) {
     if (histogram[hi])
-      cerr << "# " << hi << "\t" << histogram[hi] << endl;
+      log << "# " << hi << "\t" << histogram[hi] << endl;
+  }
+}
+
+// Count the kmers of all the files into tables of type OH, then print them.
+template<class OH> void countAndPrint(vector<InputFile *> &files, int nseqsets) {
+  SliceTables<OH> tables;
+  if (OptAllSlices.length()) {
+    for (Oligos::Index slice = 0; slice < OptHashSlicing; slice++) {
+      OH *oh;
+      newTable(oh, slice, nseqsets);
+      tables.push_back(oh);
+    }
+  }
+  else {
+    OH *oh;
+    newTable(oh, OptHashSlice, nseqsets);
+    tables.push_back(oh);
+  }
+  Tally total;
+
+  if (OptThreads > 1) {
+    // Prefer the writer, so that a thread waiting to grow a table isn't
+    // starved by the others starting new batches.
+    pthread_rwlockattr_t growattr;
+    pthread_rwlockattr_init(&growattr);
+    pthread_rwlockattr_setkind_np(&growattr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+    pthread_rwlock_init(&GrowLock, &growattr);
+
+    vector<CountWorker<OH> > workers(OptThreads);
+    for (unsigned t = 0; t < OptThreads; t++) {
+      workers[t].tables = &tables;
+      workers[t].files = &files;
+      workers[t].id = t;
+      pthread_create(&(workers[t].thread), NULL, countWorker<OH>, &(workers[t]));
+    }
+    for (unsigned t = 0; t < OptThreads; t++) {
+      pthread_join(workers[t].thread, NULL);
+    }
+  }
+  for (unsigned f = 0; f < files.size(); f++) {
+    InputFile *file = files[f];
+    if (OptThreads == 1) {
+      cerr << "Opening sequence file " << file->name << endl;
+      OligoInput inputf(file->name);
+
+      OligoSeq kmers(OptOligoLen, inputf, OptSoftMasking);
+      countKmers<false>(tables, kmers, file->seqset, file->tally);
+      inputf.close();
+    }
+    cerr << "done with " << file->name << " (" << file->tally.nseqs << " sequences)" << endl;
+    if (debugging("s")) {
+      cerr << "#" << file->seqset << "\tbase_count:\t"  << file->tally.bases       << endl 
+           << "#" << file->seqset << "\tunambiguous:\t" << file->tally.unambiguous << endl
+           << "#" << file->seqset << "\toligo_count:\t" << file->tally.oligos      << endl
+        ;
+    }
+    total.add(file->tally);
+  }
+
+  if (OptAllSlices.length()) {
+    for (Oligos::Index slice = 0; slice < OptHashSlicing; slice++) {
+      ostringstream name;
+      name << OptAllSlices << "." << OptHashSlicing << "-" << slice;
+      cerr << "Writing slice " << slice << " to " << name.str() << ".out" << endl;
+      ofstream out((name.str() + ".out").c_str());
+      ofstream log((name.str() + ".err").c_str());
+      printTable(*(tables[slice]), total, out, log);
+    }
+  }
+  else {
+    printTable(*(tables[0]), total, cout, cerr);
+  }
+}
+
+// Slicing factors a plan may choose (3 doesn't work; see setupPrimes)
+const Oligos::Index PLANSLICINGS[] = { 1, 2, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41, 43, 47,
+                                       53, 59, 61, 67, 71, 73, 79, 83, 89, 97 };
+// Sampling for -M without -p
+const Oligos::Index PLANSAMPLING = 64;
+
+// Sizes, from a pre-scan of the input, for one run's tables
+class SlicePlan {
+public:
+  SlicePlanner planner;
+  bool repeats;       // size for just the repeated kmers (when purging)
+  double load;        // fraction of cells to fill
+  double cellBytes;   // cell plus side entry
+  double threadBytes; // each counting thread's batch of sequences, and a copy
+  SlicePlan(Oligos::Index sampling) : planner(OptHashSlicing, sampling) { }
+
+  // Cells for the largest slice's table, with slicing slices
+  Oligos::Index cells(Oligos::Index slicing) {
+    vector<double> est;
+    planner.slices(slicing, mixedSlicing(), repeats, est);
+    return get_prime((Oligos::Index) (SlicePlanner::largest(est) / load) + 1000);
+  }
+  // Bytes for a run's tables (all of them, with -A) and threads
+  double bytes(Oligos::Index slicing) {
+    return (OptAllSlices.length() ? slicing : 1) * cells(slicing) * cellBytes
+      + OptThreads * threadBytes;
+  }
+  // Smallest slicing whose runs fit in budget, or 0 if none does
+  Oligos::Index fitting(double budget) {
+    for (unsigned c = 0; c < sizeof(PLANSLICINGS) / sizeof(Oligos::Index); c++) {
+      if (bytes(PLANSLICINGS[c]) <= budget) return PLANSLICINGS[c];
+    }
+    return 0;
+  }
+};
+
+// Pre-scan the input, estimating its distinct kmers (with a HyperLogLog
+// sketch) and how they divide among slices (from a sample), and plan -H
+// for this run's slice at the -L load (or, with -P, for its repeated
+// kmers to fill half the purge load).  Given a memory budget (-M), also
+// find the smallest slicing whose tables fit in it.  With -p, print the
+// estimates and the plan to STDOUT; otherwise set -H, warning if this
+// run's tables overrun the budget.
+void planSlices(vector<InputFile *> &files, bool print) {
+  SlicePlan plan(OptPlanSampling ? OptPlanSampling : PLANSAMPLING);
+  OligoBatch batch;
+  Tally tally;
+  int nb;
+  for (unsigned f = 0; f < files.size(); f++) {
+    cerr << "Sampling sequence file " << files[f]->name << endl;
+    OligoInput inputf(files[f]->name);
+    OligoSeq kmers(OptOligoLen, inputf, OptSoftMasking);
+    while ((nb = kmers.nextBatch(batch)) >= 0) {
+      for (int b = 0; b < nb; b++) {
+        plan.planner.add(batch.norm[b]);
+      }
+      tally.nseqs += (nb == 0);
+    }
+    tally.add(kmers);
+    inputf.close();
+  }
+  plan.repeats = (OptPurgeLoad > 0);
+  plan.load = plan.repeats ? OptPurgeLoad / 2 : (OptMaxLoad > 0 ? OptMaxLoad : 0.8);
+  plan.cellBytes = sizeof(Oligos::Oligo) + (OptQuotient ? 0 :
+                                             OptDictionary ? sizeof(PatternDictionary::Id) :
+                                             sizeof(Oligos::Index64));
+  plan.threadBytes = (OptThreads > 1)
+    ? 2.0 * BATCHSEQS * tally.bases / (tally.nseqs ? tally.nseqs : 1) : 0;
+
+  Oligos::Index slicing = OptHashSlicing;
+  Oligos::Index fitting = (OptMemBudget > 0) ? plan.fitting(OptMemBudget) : OptHashSlicing;
+  if (print) {
+    slicing = fitting ? fitting : PLANSLICINGS[sizeof(PLANSLICINGS) / sizeof(Oligos::Index) - 1];
+    plan.planner.report(cout, plan.load);
+    cout << "# plan:\tSlicing\t" << slicing << "\tHashSize\t" << plan.cells(slicing)
+         << "\tbytes\t" << (Oligos::Index64) plan.bytes(slicing)
+         << "\tbudget\t" << (Oligos::Index64) OptMemBudget
+         << (fitting ? "" : "\t(no slicing fits)") << endl;
+    // GenomeMmTable holds the repeated kmers of all slices
+    cout << "# GenomeMmTable:\tHashSize\t"
+         << get_prime((Oligos::Index) (plan.planner.repeated() / 0.8) + 1000) << endl;
+    return;
+  }
+  if (plan.bytes(slicing) > OptMemBudget) {
+    cerr << "Warning: tables for -S " << slicing << " need about "
+         << (Oligos::Index64) plan.bytes(slicing) << " bytes, more than -M "
+         << (Oligos::Index64) OptMemBudget << "; ";
+    if (fitting) {
+      cerr << "-S " << fitting << " would fit." << endl;
+    }
+    else {
+      cerr << "no slicing up to " << PLANSLICINGS[sizeof(PLANSLICINGS) / sizeof(Oligos::Index) - 1]
+           << " would." << endl;
+    }
+  }
+  OptHashSize = plan.cells(slicing);
+  cerr << "Planned HashSize " << OptHashSize << " for " << (Oligos::Index64) plan.planner.distinct()
+       << " distinct kmers (" << (Oligos::Index64) plan.planner.repeated() << " repeated)." << endl;
+}
+
+int main(int argc, char *argv[]) {
+  int firstNonOption = SetupOptions(argc, argv);
+
+  if (debugging("b")) {
+    cerr << dec << "Sizeof Oligos::Index   = " << sizeof(Oligos::Index) << endl;
+    cerr << dec << "Sizeof Oligos::Index64 = " << sizeof(Oligos::Index64) << endl;
+    Oligos::Index64 test = 0;
+    for (int i = 1; i <= 64; i += 3) {
+      test |= kidbit(i);
+      cerr << "Setting bit #i: " << dec << i 
+           << ", bitvector now = " << hex << test 
+           << dec << endl;
+    }
+  }
+
+  int seqset = 1;
+  int filearg = 0;
+  vector<InputFile *> files;
+
+  for (filearg = firstNonOption; filearg < argc; filearg++) {
+    if (!strcmp("/", argv[filearg])) {
+      seqset++;
+      cerr << "Advancing to sequence set " << seqset << endl;
+    }
+    else {
+      files.push_back(new InputFile(argv[filearg], seqset));
+    }
+  }
+
+  if (OptPlanSampling) {
+    planSlices(files, true);
+    exit(0);
+  }
+  bool direct = (OptOligoLen <= OptDirectLen);
+  if (OptMemBudget > 0 && ! direct) {
+    planSlices(files, false);
+  }
+  if (direct) {
+    cerr << "Counting " << OptOligoLen << "-mers in a direct-addressed table." << endl;
+    if (OptDictionary) {
+      countAndPrint<OligoDirectD>(files, seqset);
+      cerr << "# seqset_patterns:\t" << SeqsetPatterns.size() << endl;
+    }
+    else {
+      countAndPrint<OligoDirectX>(files, seqset);
+    }
+  }
+  else if (OptQuotient) {
+    countAndPrint<OligoHashQ>(files, seqset);
+  }
+  else if (OptDictionary) {
+    countAndPrint<OligoHashD>(files, seqset);
+    cerr << "# seqset_patterns:\t" << SeqsetPatterns.size() << endl;
+  }
+  else {
+    countAndPrint<OligoHashX>(files, seqset);
   }
   exit(0);
 }
@@ -1,13 +1,17 @@
 #include "OligoSeq.hh"
 #include "OligoHash.hh"
+#include "OligoPerfect.hh"
+#include "OligoTableSnapshot.hh"
 #include "OligoGraphFlex.hh"
 #include "getprime.hh"
 #include <string>
 #include "debugging.hh"
-#include "gzstream.h"
+#include "OligoInput.hh"
+#include "OligoOutput.hh"
 #include <iomanip>
 #include <cctype>
 #include <cstdio>
+#include <sstream>
 
 const unsigned NKIDS = 10;
 
@@ -18,6 +22,8 @@ Oligos::Index OptHashSlice;
 unsigned OptMin;
 unsigned OptMax;
 string OptInTable;
+string OptSnapshot;
+bool OptPerfect;
 string OptEdgesIn;
 string OptEdgesOut;
 string OptWalkFile;
@@ -33,12 +39,27 @@ Debugging debug;
 void PrintOptions() {
   cerr << "Option values are:\n"<<
     "   -i {InputTable}  ["<< OptInTable     <<"] Input table: type kmer count bitvector [SNPpos SNPxormask SNPflip kmer count bitvector]\n" <<
+    "   -T {Snapshot}    ["<< OptSnapshot    <<"] Binary snapshot of the table loaded from InputTable: mapped instead of reading\n" <<
+    "                                       InputTable if it exists (and was made from the same, unchanged InputTable\n" <<
+    "                                       with the same options), else written.  InputTable must be a regular file.\n" <<
+    "   -F               ["<< OptPerfect     <<"] Freeze the loaded table into a minimal perfect hash before reading edges:\n" <<
+    "                                       no empty cells or probing, and side and node arrays of just the kmers.\n" <<
     "   -E {EdgesIn}     ["<< OptEdgesIn     <<"] Edge input file\n" <<
     "   -e {EdgesOut}    ["<< OptEdgesOut    <<"] Edge output file\n" <<
 		"   -w {WalkFile}    ["<< OptWalkFile    <<"] Walk the graph somehow and produce chains of kmers\n" <<
-    "   -o {OligoLen}    ["<< OptOligoLen    <<"] Number of nucleotide bases per oligo (in otherwords, value of k for k-mer).\n" <<
+    "   -o {OligoLen}    ["<< OptOligoLen    <<"] Number of nucleotide bases per oligo (in otherwords, value of k for k-mer);\n" <<
+    "                                       over 31 runs GenomeMmContigsWide, with 128-bit kmers.\n" <<
     "   -H {HashSize}    ["<< OptHashSize    <<"] Number of cells in hash table (can choose based on InputTable).\n" <<
+		"   -N {MemPolicy}   ["<< tablePolicy().spec <<"] Allocate big tables as this comma-separated list says: huge\n" <<
+		"                                       (transparent huge pages), huge2m or huge1g (reserved huge pages),\n" <<
+		"                                       interleave (across NUMA nodes) or bind (to node Slice % nodes), and\n" <<
+		"                                       touch=N (zero them with N threads); see OligoMemory.hh.\n" <<
+		"   -q {FastqMask}   ["<< fastqMasking().spec <<"] Mask FASTQ input (read directly) as scripts/fastq2fam.pl would: a\n" <<
+		"                                       comma-separated list of m=, soft=, zq=, pre=, suf=, bnum=, bs= and r=\n" <<
+		"                                       settings, named for its options; see OligoFastq.hh.\n" <<
 		"   -S {Slicing[:Slice]} [" << OptHashSlicing << ":" << OptHashSlice << "] Slicing factor and slice for unpartnered kmers.\n" <<
+		"   -R               ["<< mixedSlicing() <<"] Slice by a mixed hash of each kmer, not kmer % Slicing: evener slices, but\n" <<
+		"                                       every tool run on the same tables must be given -R too (see OligoSlice.hh).\n" <<
 		// "   -p {pattern[,pattern]*} [" << OptPatterns << "] Patterns for kmers to be loaded: with '-' for major-minor partners, just one of AA/AP/PA/PP for unpartnered.\n"
 		"   -P {position[,position]*} [" << OptPositions << "] SNP positions for major-minor kmers to be loaded (the base position in which the partners differ) relative to first/minor kmer of the pair\n" <<
 		"   -a               ["<< OptAmbiguous << "] Turn on loading of kmers with ambiguous SNP partners\n" <<
@@ -79,7 +100,7 @@ public:
 	unsigned unambiguous:  1; // Fields below are meaningful only if this bit is set
 	unsigned partnered:    1; // 1 means found, 0 means searched and not found (not unambiguous, as above,
 	                          //      can mean too many or too common partners.
-	unsigned pos:          5; // offset of SNP base within kmer, 0..31
+	unsigned pos:          6; // offset of SNP base within kmer, 0..63
 	unsigned xormask:      2; // mask for SNP base (see Transverse/Transit/Complement above);
 	                          //      0=NoMate => no partner kmer found => nonpolymorphic k-locus
 	unsigned flip:         1; // set if allelic partner kmer is in table RC relative to this kmer
@@ -192,6 +213,8 @@ int SetupOptions(int argc, char**argv)
 	OptHashSlicing = 11;        // -S <small_prime>[:<hashslice in 0..small_prime-1>]
 	OptHashSlice   = 0;         // override with :# on OptHashSlicing
   OptInTable     = "";        // -i <filename>
+  OptSnapshot    = "";        // -T <filename>
+  OptPerfect     = false;     // -F
   OptEdgesIn     = "";        // -E <filename>
   OptEdgesOut    = "";        // -e <filename>
 	OptWalkFile    = "";        // -w <filename>
@@ -216,6 +239,20 @@ int SetupOptions(int argc, char**argv)
       case 'o':
 				OptOligoLen = strtol(argv[++i], NULL, 0);
 				break;
+      case 'N':
+				if (! tablePolicy().parse(argv[++i])) {
+					PrintOptions();
+					cerr << "Argument error: -N " << argv[i] << "; MemPolicy words are huge, huge2m, huge1g, interleave, bind and touch=N.\n";
+					exit(-1);
+				}
+				break;
+      case 'q':
+				if (! fastqMasking().parse(argv[++i])) {
+					PrintOptions();
+					cerr << "Argument error: -q " << argv[i] << "; FastqMask settings are m=, soft=, zq=, pre=, suf=, bnum=, bs= and r= (a regular expression).\n";
+					exit(-1);
+				}
+				break;
       case 'H': {
 				OptHashSize = strtoll(argv[++i], NULL, 0); 
 				prime = get_prime(OptHashSize);
@@ -228,6 +265,10 @@ int SetupOptions(int argc, char**argv)
 				break;
       case 'i':
 				OptInTable = argv[++i]; break;
+      case 'T':
+				OptSnapshot = argv[++i]; break;
+      case 'F':
+				OptPerfect = true; break;
       case 'E':
 				OptEdgesIn = argv[++i]; break;
       case 'e':
@@ -253,6 +294,9 @@ int SetupOptions(int argc, char**argv)
 			case 'M':
 				OptMax = strtol(argv[++i], NULL, 0);
 				break;
+			case 'R':
+				mixedSlicing() = true;
+				break;
 			case 'S':
 				parseSlicing(argv[++i]); // sets OptHashSlicing and OptHashSlice
 				break;
@@ -275,6 +319,13 @@ int SetupOptions(int argc, char**argv)
 		}
   }
  EndOptions:
+	runWide(argv, OptOligoLen);
+	if (OptOligoLen < 1 || OptOligoLen > Oligos::MAXLENGTH) {
+		PrintOptions();
+		cerr << "Argument error: -o " << OptOligoLen << "; OligoLen must be in [1.."
+				 << Oligos::WIDEMAXLENGTH << "].\n";
+		exit(-1);
+	}
 	// patternAddList(OptPatterns);
 	positionAddList(OptPositions);
   if (debug.check('o')) PrintOptions();
@@ -315,7 +366,7 @@ KRecordType readKmerRecord(istream &in,
 			// Partnered kmers: read two kmers with their SNP relationship between
 			// Should be minor allele first, major second (check that parent bits are consistent with that)
 			// AND if filtering, enforce that the SNP position is middle or INSET bases from kmer end
-			parsed = sscanf(buf+1, "%lx %lx %lx %u %u %u %lx %lx %lx", &kmer1, &count1, &bits1, &pos, &xormask, &flip, &kmer2, &count2, &bits2);
+			parsed = scanOligos(buf+1, "%K %lx %lx %u %u %u %K %lx %lx", &kmer1, &count1, &bits1, &pos, &xormask, &flip, &kmer2, &count2, &bits2);
 			if (parsed != 9) {
 				cerr << "readKmerRecord failure on line:\n" << buf;
 				exit(-1);
@@ -329,13 +380,13 @@ KRecordType readKmerRecord(istream &in,
 		else if (type == '0') {
 			// confirmed unpartnered kmer: save only if parent bits are consistent with requested (default none)
 			// AND if filtering, enforce that the kmer is congruent to Slice module SlicingFactor
-			parsed = sscanf(buf+1, "%lx %lx %lx", &kmer1, &count1, &bits1);
+			parsed = scanOligos(buf+1, "%K %lx %lx", &kmer1, &count1, &bits1);
 			if (parsed != 3) {
 				cerr << "readKmerRecord failure on line:\n" << buf;
 				exit(-1);
 			}
 			// Only stuff in table if in current slice
-			if (OptHashSlicing && (kmer1 % OptHashSlicing != OptHashSlice)) continue;
+			if (OptHashSlicing && (sliceOf(kmer1, OptHashSlicing) != OptHashSlice)) continue;
 			// kmer isn't present in right parent or parents
 			// if (! patternCheckByBV(bits1)) continue;
 			if ((count1 < OptMin) ||
@@ -354,13 +405,13 @@ KRecordType readKmerRecord(istream &in,
 			// ambiguously partnered kmer; save only if specifically asked to and parent bits match
 			// patterns requested for "confirmed unpartnered" (case '0' above)
 			// AND if filtering, enforce that the kmer is congruent to Slice module SlicingFactor
-			parsed = sscanf(buf+1, "%lx %lx %lx", &kmer1, &count1, &bits1);
+			parsed = scanOligos(buf+1, "%K %lx %lx", &kmer1, &count1, &bits1);
 			if (parsed != 3) {
 				cerr << "readKmerRecord failure on line:\n" << buf;
 				exit(-1);
 			}
 			// Only stuff in table if in current slice
-			if (OptHashSlicing && (kmer1 % OptHashSlicing != OptHashSlice)) continue;
+			if (OptHashSlicing && (sliceOf(kmer1, OptHashSlicing) != OptHashSlice)) continue;
 			// kmer isn't present in right parent or parents
 			// if (! patternCheckByBV(bits1)) continue;
 			if ((count1 < OptMin) ||
@@ -378,16 +429,17 @@ KRecordType readKmerRecord(istream &in,
 	return ENDOFKMERS; // NUL character
 }
 
+template<class OH>
 void inline printFields(ostream &out,
-												OligoHash &oh,
+												OH &oh,
 												Allelic side[],
-												OligoHash::Oligo* op) {
-	OligoHash::Index oi = op - oh.hash;
+												Oligos::Oligo* op) {
+	Oligos::Index oi = op - oh.hash;
 	out 
 		<< hex << setw(12) << setfill('0') 
 		<< oh.getOligo(*op) 
 		<< setw(0) << "\t" 
-		<< oh.getInfo1(*op) << "\t" 
+		<< oh.count(oi) << "\t" 
 		<< side[oi].inLibs << "\t"
 		;
 }
@@ -417,16 +469,18 @@ inline OligoSeq::Oligo mutate(OligoSeq::Oligo w,
 // and had better not be 0 (which is valid)
 const Oligos::Index NULLINDEX = ~(0UL);
 
-inline Oligos::Index repIndex(OligoHash &oh, Allelic side[], 
+template<class OH>
+inline Oligos::Index repIndex(OH &oh, Allelic side[], 
 																			Oligos::Oligo w_norm,
+																			typename OH::HashFlag wflag,  // from oh.lookuploc(w_norm, wi)
+																			OligoSeq::Index wi,         // original kmer's index
 																			unsigned &oppstrand) { // can be updated if w_rep kmer not the same as w_norm
-	OligoSeq::Index wi;      // to get original kmer's index
-	if (oh.lookuploc(w_norm, wi) == OligoHash::FOUND) {
+	if (wflag == OH::FOUND) {
 		if (side[wi].partnered) {
 			OligoSeq::Index pi;               // kmer partner's index
 			OligoSeq::Oligo perturb = mutate(w_norm, side[wi].xormask, oh.Length - side[wi].pos);
 			OligoSeq::Oligo partner = oh.Normalize(perturb);
-			if (oh.lookuploc(partner, pi) != OligoHash::FOUND) {
+			if (oh.lookuploc(partner, pi) != OH::FOUND) {
 				cerr << "Failed to find partner " << hex << partner << " of " << w_norm << endl;
 				exit(-1);
 			}
@@ -465,7 +519,7 @@ bool readEdgeRecord(istream &in,
 
 	while (in.getline(buf, BUFSIZE)) {
 		// successfully got a line
-		int parsed = sscanf(buf, "%lx %lx %u %u %u", &kmer1, &kmer2, &orient, &distance, &nreads);
+		int parsed = scanOligos(buf, "%K %K %u %u %u", &kmer1, &kmer2, &orient, &distance, &nreads);
 		if (debug.check('e')) {
 			cerr << "Got " << hex << kmer1 << " " << kmer2 << dec << " " << orient << " " << distance << " " << nreads << 
 				" from line: " << buf;
@@ -477,7 +531,8 @@ bool readEdgeRecord(istream &in,
 	return false; // when done
 }
 
-inline void printEdge(OligoHash &oh, Oligos::Index i, OligoEdge &edge, ostream &out) {
+template<class OH>
+inline void printEdge(OH &oh, Oligos::Index i, OligoEdge &edge, ostream &out) {
 	if (edge.nreads)
 		out << hex
 				<< oh.getOligo(oh.hash[i]) << "\t"
@@ -559,8 +614,9 @@ inline OligoEdge *mutualEdge(OligoNode nodes[], unsigned source, Strands strand)
 		return NULL;
 }
 
+template<class OH>
 inline void emit(ostream &out,
-								 OligoHash &oh, Allelic side[], 
+								 OH &oh, Allelic side[], 
 								 unsigned wi,
 								 unsigned offset,
 								 Strands strand) {
@@ -575,7 +631,7 @@ inline void emit(ostream &out,
 		OligoSeq::Oligo perturb = mutate(w_norm, side[wi].xormask, oh.Length - side[wi].pos);
 		OligoSeq::Oligo partner = oh.Normalize(perturb);
 
-		if (oh.lookuploc(partner, pi) != OligoHash::FOUND) {
+		if (oh.lookuploc(partner, pi) != OH::FOUND) {
 			cerr << "Failed to find partner " << hex << partner << " of " << w_norm << endl;
 			exit(-1);
 		}
@@ -604,8 +660,9 @@ inline void emit(ostream &out,
 	side[wi].visited = 1;
 }
 
+template<class OH>
 void walk(ostream &out, 
-					OligoHash &oh, Allelic side[], OligoNode nodes[], 
+					OH &oh, Allelic side[], OligoNode nodes[], 
 					OligoEdge *edge,
 					unsigned offset,
 					Strands strand) {
@@ -646,45 +703,15 @@ void walk(ostream &out,
 	}
 }
 
-int main(int argc, char *argv[]) {
-	const OligoSeq::Index p6bit = 2;
-	const OligoSeq::Index p7bit = 1;
-
-  int firstNonOption = SetupOptions(argc, argv);
-
-	if (debug.check('s')) {
-		cerr << "sizes: Oligo(" << sizeof(Oligos::Oligo) 
-				 << "), Index(" << sizeof(Oligos::Index)
-				 << "), Allelic(" << sizeof(Allelic) 
-				 << "), OligoNode(" << sizeof(OligoNode)
-				 << ")" << endl;
-	}
-
-	// Configure hash table based on input table (on standard input)
-	// OptionsFromComments(cin);
-
-	// OptHashSize *= (OptHashSlicing*3)/2;  // Because size was read from one slice, and we plan
-	                                      // to read all slices, have to scale up.
-	// Note that we create the hash table WITHOUT slicing. The hash table needs to store
-	// SNPmers from all slices, so we apply slicing outside of the table to 
-	// the other kmers as needed.
-	if (debug.check('a')) cerr << "Allocating big structures...";
-  OligoHash oh(OptHashSize, 1, 0, // OptHashSlicing = 1, OptHashSlice = 0 ==> no slicing
-							 OptOligoLen);      // Using extra bits only for the count (six bits);
-	                                // Also means this code works up to OligoLen=29 without change.
-	if (debug.check('a')) cerr << " hash,";
-	Allelic *side = (Allelic *) calloc(sizeof(Allelic), OptHashSize);
-	if (debug.check('a')) cerr << " allelic,";
-	OligoNode nodes[OptHashSize];
-	if (debug.check('a')) cerr << " nodes." << endl;
-
+// Fill the table and side array from the InputTable
+void loadInputTable(OligoHash &oh, Allelic side[]) {
 	// Read in kmers from input table
 	OligoSeq::Oligo kmer1, kmer2;
 	Oligos::Index total1, bits1, total2, bits2, index1, index2;
 	unsigned pos, xormask, flip;
 	KRecordType type;
 	// const OligoSeq::Oligo KIDBITMASK = ((~0ULL) >> (8*sizeof(Oligos::Index) - NKIDS));
-	igzstream inTable(OptInTable.c_str());
+	OligoInput inTable(OptInTable.c_str());
 	for (type = readKmerRecord(inTable, kmer1, total1, bits1, pos, xormask, flip, kmer2, total2, bits2);
 			 (type != ENDOFKMERS);
 			 type = readKmerRecord(inTable, kmer1, total1, bits1, pos, xormask, flip, kmer2, total2, bits2)) {
@@ -743,6 +770,7 @@ int main(int argc, char *argv[]) {
 				exit(-1);
 		}
 	}
+}
 
 	// Format of a kmer-report line:
 	// type	pos	norm	kmer1	count1	bitvector1	SNPpos	mask	flip	kmer2	count2	bitvector2
@@ -765,6 +793,17 @@ int main(int argc, char *argv[]) {
 	//        the major allelic kmer of the pair (or if arbitrary, the second in the table line); 
 	//        and SNPpos counts from the right end of normalized kmer2 if flip was set
 
+// Load or find the edges between table kmers, then walk them into contigs.
+// OH is OligoHash, or OligoPerfectHash with -F, for which order gives the
+// kmers' ranks in the order of the loaded table's cells, so the walks
+// start from the same kmers, and the contigs are the same, either way.
+template<class OH>
+void buildContigs(OH &oh, Allelic side[], const vector<Oligos::Index> *order,
+                  int firstNonOption, int argc, char *argv[]) {
+	if (debug.check('a')) cerr << "Allocating nodes...";
+	OligoNode nodes[oh.Size];
+	if (debug.check('a')) cerr << " done." << endl;
+
 	int nseqs  = 0;
   int seqset = 1;
   int filearg = 0;
@@ -773,7 +812,7 @@ int main(int argc, char *argv[]) {
 	if (OptEdgesIn.length()) {
 		Oligos::Oligo oligo1, oligo2;
 		unsigned orient, dist, nreads;
-		igzstream edgesIn(OptEdgesIn.c_str());
+		OligoInput edgesIn(OptEdgesIn.c_str());
 		cerr << "Loading edges from " << OptEdgesIn << " ...";
 		while (readEdgeRecord(edgesIn, oligo1, oligo2, orient, dist, nreads)) {
 			if (debug.check('e'))
@@ -781,12 +820,12 @@ int main(int argc, char *argv[]) {
 						 << dec << "\t" << orient << "\t" << dist << "\t" << nreads << endl;
 
 			Oligos::Index id1, id2;
-			if (oh.lookuploc(oligo1, id1) != OligoHash::FOUND) {
+			if (oh.lookuploc(oligo1, id1) != OH::FOUND) {
 				cerr << "Failed to find entry for oligo1 in edge " << hex << oligo1 << "\t"
 						 << oligo2 << dec << "\t" << orient << "\t" << dist << "\t" << nreads << endl;
 				exit(-1);
 			}
-			if (oh.lookuploc(oligo2, id2) != OligoHash::FOUND) {
+			if (oh.lookuploc(oligo2, id2) != OH::FOUND) {
 				cerr << "Failed to find entry for oligo2 in edge " << hex << oligo1 << "\t"
 						 << oligo2 << dec << "\t" << orient << "\t" << dist << "\t" << nreads << endl;
 				exit(-1);
@@ -804,41 +843,49 @@ int main(int argc, char *argv[]) {
 			}
 			else {
 				cerr << "Opening sequence file " << argv[filearg] << endl;
-				igzstream inputf(argv[filearg]);
+				OligoInput inputf(argv[filearg]);
 				
 				OligoSeq kmers(OptOligoLen, inputf, OptSoftMasking);
 				int np;
 				Oligos::Index prev = NULLINDEX;
 				unsigned p_strand; // 0 top/normalized in the read; 1 bottom
 				int p_offset;      // offset of prev in the read
-				while ((np = kmers.nextPos()) >= 0) {
-					if (np > 0) {
-						OligoSeq::Oligo w_norm = kmers.current();
-						Oligos::Index w_rep;
-						unsigned w_strand = (w_norm != kmers.fwd()); // 0=top or 1=bottom, will be updated to reflect w_rep
-						int w_offset;  // offset in the read
-						// if (debug.check('e')) cerr << "w_norm: " << oh.Bases(w_norm) << endl;
-						w_rep = repIndex(oh, side, w_norm, w_strand);
-
-						if (w_rep == NULLINDEX) continue; // not in the table of interesting kmers
-						if (prev != NULLINDEX) {
-							if (debug.check('e')) {
-								cerr << "adding edge between " << oh.getOligo(oh.hash[prev]);
-								cerr << " and " << oh.getOligo(oh.hash[w_rep]) << endl;
+				OligoBatch batch;
+				OligoSeq::Index locs[OligoBatch::MAXKMERS];
+				typename OH::HashFlag flags[OligoBatch::MAXKMERS];
+				int nb;
+				while ((nb = kmers.nextBatch(batch)) >= 0) {
+					if (nb > 0) {
+						oh.lookupBatch(batch.norm, nb, locs, flags);
+						for (int b = 0; b < nb; b++) {
+							np = batch.pos[b];
+							OligoSeq::Oligo w_norm = batch.norm[b];
+							Oligos::Index w_rep;
+							unsigned w_strand = batch.strand[b]; // 0=top or 1=bottom, will be updated to reflect w_rep
+							int w_offset;  // offset in the read
+							// if (debug.check('e')) cerr << "w_norm: " << oh.Bases(w_norm) << endl;
+							w_rep = repIndex(oh, side, w_norm, flags[b], locs[b], w_strand);
+
+							if (w_rep == NULLINDEX) continue; // not in the table of interesting kmers
+							if (prev != NULLINDEX) {
+								if (debug.check('e')) {
+									cerr << "adding edge between " << oh.getOligo(oh.hash[prev]);
+									cerr << " and " << oh.getOligo(oh.hash[w_rep]) << endl;
+								}
+								edgeInserts++;
+								nodes[prev].add_edge(w_rep, make_orient(p_strand, w_strand),   0, np - p_offset);
+								nodes[w_rep].add_edge(prev, make_orient(!w_strand, !p_strand), 0, np - p_offset);
 							}
-							edgeInserts++;
-							nodes[prev].add_edge(w_rep, make_orient(p_strand, w_strand),   0, np - p_offset);
-							nodes[w_rep].add_edge(prev, make_orient(!w_strand, !p_strand), 0, np - p_offset);
+							prev = w_rep;
+							p_strand = w_strand;
+							p_offset = np;
 						}
-						prev = w_rep;
-						p_strand = w_strand;
-						p_offset = np;
 					}
-					else { // ! np, beginning of a sequence fragment (read or contig, have description line)
+					else { // ! nb, beginning of a sequence fragment (read or contig, have description line)
 						prev = NULLINDEX;
 					}
 				}
-				// now np < 0
+				// now nb < 0
 				cerr << "done with " << argv[filearg] << ", #edgeInserts: " << dec << edgeInserts << endl;
 				inputf.close();
 			}
@@ -846,8 +893,8 @@ int main(int argc, char *argv[]) {
 	}
 
 	if (OptWalkFile.length()) {
-		ofstream walkFile(OptWalkFile.c_str());
-		Oligos::Index i;
+		OligoOutput walkFile(OptWalkFile.c_str());
+		Oligos::Index i, n = (order ? order->size() : oh.Size);
 		Oligos::Index ncontigs = 0;
 
 		// Determine if node can be start of walk (only go in one direction)
@@ -862,7 +909,8 @@ int main(int argc, char *argv[]) {
 		//          OR when there are inconsistent choices
 
 		cerr << "Starting linear walks" << endl;
-		for (i = 0; i < oh.Size; i++) {
+		for (Oligos::Index k = 0; k < n; k++) {
+			i = (order ? (*order)[k] : k);
 			if ((! oh.hash[i]) || side[i].visited) 
 				continue;
 			bool walked = false;
@@ -897,7 +945,8 @@ int main(int argc, char *argv[]) {
 				side[i].visited = 0;
 		}
 		cerr << "Starting cycle-breaking walks" << endl;
-		for (i = 0; i < oh.Size; i++) {
+		for (Oligos::Index k = 0; k < n; k++) {
+			i = (order ? (*order)[k] : k);
 			if ((! oh.hash[i]) || side[i].visited) 
 				continue;
 			side[i].visited = 1; // to keep from walking to self
@@ -929,5 +978,64 @@ int main(int argc, char *argv[]) {
 		walkFile << "# Completed!" << endl;
 	}
 
+}
+
+int main(int argc, char *argv[]) {
+	const OligoSeq::Index p6bit = 2;
+	const OligoSeq::Index p7bit = 1;
+
+  int firstNonOption = SetupOptions(argc, argv);
+
+	if (debug.check('s')) {
+		cerr << "sizes: Oligo(" << sizeof(Oligos::Oligo) 
+				 << "), Index(" << sizeof(Oligos::Index)
+				 << "), Allelic(" << sizeof(Allelic) 
+				 << "), OligoNode(" << sizeof(OligoNode)
+				 << ")" << endl;
+	}
+
+	// Configure hash table based on input table (on standard input)
+	// OptionsFromComments(cin);
+
+	// OptHashSize *= (OptHashSlicing*3)/2;  // Because size was read from one slice, and we plan
+	                                      // to read all slices, have to scale up.
+	// Note that we create the hash table WITHOUT slicing. The hash table needs to store
+	// SNPmers from all slices, so we apply slicing outside of the table to 
+	// the other kmers as needed.
+	if (debug.check('a')) cerr << "Allocating big structures...";
+  ostringstream loading;  // the options that decide which records are loaded
+  loading << " -P " << OptPositions << " -a " << OptAmbiguous << " -m " << OptMin << " -M " << OptMax;
+  OligoTableSnapshot snapshot(OptSnapshot, "GenomeMmContigs", sizeof(Allelic), OptInTable,
+                              OptOligoLen, OptHashSlicing, OptHashSlice, loading.str());
+  bool fromSnapshot = snapshot.map(OptHashSize);
+  OligoHash oh = (fromSnapshot
+                  ? OligoHash(snapshot.snap)
+                  : OligoHash(OptHashSize, 1, 0, // OptHashSlicing = 1, OptHashSlice = 0 ==> no slicing
+                              OptOligoLen));    // Using extra bits only for the count (Info1, overflowing to oh.overflow);
+                                                // Also means this code works up to OligoLen=29 without change.
+	if (debug.check('a')) cerr << " hash,";
+	Allelic *side = (fromSnapshot ? (Allelic *) snapshot.snap.side :
+	                 (Allelic *) allocTable(sizeof(Allelic) * OptHashSize, 16, OptHashSlice));
+	if (debug.check('a')) cerr << " allelic." << endl;
+
+	if (! fromSnapshot) {
+		loadInputTable(oh, side);
+		snapshot.save(oh, side);
+	}
+
+	if (OptPerfect) {
+		OligoPerfectHash ph(oh);
+		Allelic *ranked = ph.arrange(oh, side);
+		vector<Oligos::Index> order = ph.sourceOrder(oh);
+		if (! fromSnapshot) {
+			freeTable(side);
+		}
+		oh.release();
+		buildContigs(ph, ranked, &order, firstNonOption, argc, argv);
+	}
+	else {
+		buildContigs(oh, side, NULL, firstNonOption, argc, argv);
+	}
+
 	exit(0);
 }
@@ -1,13 +1,17 @@
 #include "OligoSeq.hh"
 #include "OligoHash.hh"
+#include "OligoPerfect.hh"
+#include "OligoTableSnapshot.hh"
 #include "OligoGraphFlex.hh"
 #include "getprime.hh"
 #include <string>
 #include "debugging.hh"
-#include "gzstream.h"
+#include "OligoInput.hh"
+#include "OligoOutput.hh"
 #include <iomanip>
 #include <cctype>
 #include <cstdio>
+#include <sstream>
 
 const unsigned NKIDS = 10;
 
@@ -18,6 +22,8 @@ Oligos::Index OptHashSlice;
 unsigned OptMin;
 unsigned OptMax;
 string OptInTable;
+string OptSnapshot;
+bool OptPerfect;
 string OptEdgeFile;
 string OptWalkFile;
 bool OptSoftMasking;
@@ -31,11 +37,26 @@ Debugging debug;
 void PrintOptions() {
   cerr << "Option values are:\n"<<
     "   -i {InputTable}  ["<< OptInTable     <<"] Input table: type kmer count bitvector [SNPpos SNPxormask SNPflip kmer count bitvector]\n" <<
+    "   -T {Snapshot}    ["<< OptSnapshot    <<"] Binary snapshot of the table loaded from InputTable: mapped instead of reading\n" <<
+    "                                       InputTable if it exists (and was made from the same, unchanged InputTable\n" <<
+    "                                       with the same options), else written.  InputTable must be a regular file.\n" <<
+    "   -F               ["<< OptPerfect     <<"] Freeze the loaded table into a minimal perfect hash before scanning:\n" <<
+    "                                       no empty cells or probing, and side and node arrays of just the kmers.\n" <<
     "   -e {EdgeFile}    ["<< OptEdgeFile    <<"] Edge output file\n" <<
     // "   -w {WalkFile}    ["<< OptWalkFile    <<"] Walk the graph somehow and produce chains of kmers\n" <<
-    "   -o {OligoLen}    ["<< OptOligoLen    <<"] Number of nucleotide bases per oligo (in otherwords, value of k for k-mer).\n" <<
+    "   -o {OligoLen}    ["<< OptOligoLen    <<"] Number of nucleotide bases per oligo (in otherwords, value of k for k-mer);\n" <<
+    "                                       over 31 runs GenomeMmEdgesWide, with 128-bit kmers.\n" <<
     "   -H {HashSize}    ["<< OptHashSize    <<"] Number of cells in hash table (can choose based on InputTable).\n" <<
+    "   -N {MemPolicy}   ["<< tablePolicy().spec <<"] Allocate big tables as this comma-separated list says: huge\n" <<
+    "                                       (transparent huge pages), huge2m or huge1g (reserved huge pages),\n" <<
+    "                                       interleave (across NUMA nodes) or bind (to node Slice % nodes), and\n" <<
+    "                                       touch=N (zero them with N threads); see OligoMemory.hh.\n" <<
+    "   -q {FastqMask}   ["<< fastqMasking().spec <<"] Mask FASTQ input (read directly) as scripts/fastq2fam.pl would: a\n" <<
+    "                                       comma-separated list of m=, soft=, zq=, pre=, suf=, bnum=, bs= and r=\n" <<
+    "                                       settings, named for its options; see OligoFastq.hh.\n" <<
     "   -S {Slicing[:Slice]} [" << OptHashSlicing << ":" << OptHashSlice << "] Slicing factor and slice for unpartnered kmers (1:0 to use all on input).\n" <<
+    "   -R               ["<< mixedSlicing() <<"] Slice by a mixed hash of each kmer, not kmer % Slicing: evener slices, but\n" <<
+    "                                       every tool run on the same tables must be given -R too (see OligoSlice.hh).\n" <<
     "   -P {position[,position]|*} [" << OptPositions << "] SNP positions for kmers to be loaded (the base position at which major/minor alleles differ)... '*' for all present on input. Must be symmetric pattern.\n" <<
     "   -a               ["<< OptAmbiguous << "] Turn on loading of kmers with ambiguous SNP partners\n" <<
     "   -s               ["<< OptSummary << "] Turn on printing of summary line - one character per kmer position\n" <<
@@ -73,7 +94,7 @@ public:
   unsigned short unambiguous:  1; // Fields below are meaningful only if this bit is set
   unsigned short partnered:    1; // 1 means found, 0 means searched and not found (not unambiguous, as above,
                             //      can mean too many or too common partners.
-  unsigned short pos:          5; // offset of SNP base within kmer, 0..31
+  unsigned short pos:          6; // offset of SNP base within kmer, 0..63
   unsigned short xormask:      2; // mask for SNP base (see Transverse/Transit/Complement above);
                             //      0=NoMate => no partner kmer found => nonpolymorphic k-locus
   unsigned short flip:         1; // set if allelic partner kmer is in table RC relative to this kmer
@@ -176,6 +197,8 @@ int SetupOptions(int argc, char**argv)
   OptHashSlicing = 1;         // -S <small_prime>[:<hashslice in 0..small_prime-1>]
   OptHashSlice   = 0;         // override with :# on OptHashSlicing
   OptInTable     = "";        // -i <filename>
+  OptSnapshot    = "";        // -T <filename>
+  OptPerfect     = false;     // -F
   OptEdgeFile    = "";        // -e <filename>
   OptWalkFile    = "";        // -w <filename> NOT ACTIVE IN THIS TOOL
   // Ideally, we've already selected the paired kmers and this can be just "*"
@@ -199,6 +222,20 @@ int SetupOptions(int argc, char**argv)
       case 'o':
         OptOligoLen = strtol(argv[++i], NULL, 0);
         break;
+      case 'N':
+        if (! tablePolicy().parse(argv[++i])) {
+          PrintOptions();
+          cerr << "Argument error: -N " << argv[i] << "; MemPolicy words are huge, huge2m, huge1g, interleave, bind and touch=N.\n";
+          exit(-1);
+        }
+        break;
+      case 'q':
+        if (! fastqMasking().parse(argv[++i])) {
+          PrintOptions();
+          cerr << "Argument error: -q " << argv[i] << "; FastqMask settings are m=, soft=, zq=, pre=, suf=, bnum=, bs= and r= (a regular expression).\n";
+          exit(-1);
+        }
+        break;
       case 'H': {
         OptHashSize = strtoll(argv[++i], NULL, 0); 
         prime = get_prime(OptHashSize);
@@ -211,6 +248,10 @@ int SetupOptions(int argc, char**argv)
         break;
       case 'i':
         OptInTable = argv[++i]; break;
+      case 'T':
+        OptSnapshot = argv[++i]; break;
+      case 'F':
+        OptPerfect = true; break;
       case 'e':
         OptEdgeFile = argv[++i]; break;
       // case 'w':
@@ -230,6 +271,9 @@ int SetupOptions(int argc, char**argv)
       case 'M':
         OptMax = strtol(argv[++i], NULL, 0);
         break;
+      case 'R':
+        mixedSlicing() = true;
+        break;
       case 'S':
         parseSlicing(argv[++i]); // sets OptHashSlicing and OptHashSlice
         break;
@@ -252,6 +296,13 @@ int SetupOptions(int argc, char**argv)
     }
   }
  EndOptions:
+  runWide(argv, OptOligoLen);
+  if (OptOligoLen < 1 || OptOligoLen > Oligos::MAXLENGTH) {
+    PrintOptions();
+    cerr << "Argument error: -o " << OptOligoLen << "; OligoLen must be in [1.."
+         << Oligos::WIDEMAXLENGTH << "].\n";
+    exit(-1);
+  }
   positionAddList(OptPositions);
   if (debug.check('o')) PrintOptions();
   return i;
@@ -291,7 +342,7 @@ KRecordType readKmerRecord(istream &in,
       // Partnered kmers: read two kmers with their SNP relationship between
       // Should be minor allele first, major second (check that parent bits are consistent with that)
       // AND if filtering, enforce that the SNP position is middle or INSET bases from kmer end
-      parsed = sscanf(buf+1, "%lx %lx %lx %u %u %u %lx %lx %lx", &kmer1, &count1, &bits1, &pos, &xormask, &flip, &kmer2, &count2, &bits2);
+      parsed = scanOligos(buf+1, "%K %lx %lx %u %u %u %K %lx %lx", &kmer1, &count1, &bits1, &pos, &xormask, &flip, &kmer2, &count2, &bits2);
       if (parsed != 9) {
         cerr << "readKmerRecord failure on line:\n" << buf;
         exit(-1);
@@ -304,13 +355,13 @@ KRecordType readKmerRecord(istream &in,
     else if (type == '0') {
       // confirmed unpartnered kmer: save only if parent bits are consistent with requested (default none)
       // AND if filtering, enforce that the kmer is congruent to Slice module SlicingFactor
-      parsed = sscanf(buf+1, "%lx %lx", &kmer1, &count1);
+      parsed = scanOligos(buf+1, "%K %lx", &kmer1, &count1);
       if (parsed != 2) {
         cerr << "readKmerRecord failure on line:\n" << buf;
         exit(-1);
       }
       // Only stuff in table if in current slice
-      if (OptHashSlicing && (kmer1 % OptHashSlicing != OptHashSlice)) continue;
+      if (OptHashSlicing && (sliceOf(kmer1, OptHashSlicing) != OptHashSlice)) continue;
       // kmer isn't present in right parent or parents
       if ((count1 < OptMin) ||
           (count1 > OptMax))
@@ -328,13 +379,13 @@ KRecordType readKmerRecord(istream &in,
       // ambiguously partnered kmer; save only if specifically asked to and parent bits match
       // patterns requested for "confirmed unpartnered" (case '0' above)
       // AND if filtering, enforce that the kmer is congruent to Slice module SlicingFactor
-      parsed = sscanf(buf+1, "%lx %lx %lx", &kmer1, &count1, &bits1);
+      parsed = scanOligos(buf+1, "%K %lx %lx", &kmer1, &count1, &bits1);
       if (parsed != 3) {
         cerr << "readKmerRecord failure on line:\n" << buf;
         exit(-1);
       }
       // Only stuff in table if in current slice
-      if (OptHashSlicing && (kmer1 % OptHashSlicing != OptHashSlice)) continue;
+      if (OptHashSlicing && (sliceOf(kmer1, OptHashSlicing) != OptHashSlice)) continue;
       // kmer isn't present in right frequency
       if ((count1 < OptMin) ||
           (count1 > OptMax))
@@ -364,7 +415,7 @@ KRecordType readKmerRecord(istream &in,
 //     ;
 // }
 
-OligoHash::Index insertOrDie(OligoHash oh,
+OligoHash::Index insertOrDie(OligoHash &oh,
                              OligoHash::Oligo inmer,
                              OligoHash::Index num) {
   OligoHash::Index index;
@@ -389,16 +440,18 @@ inline OligoSeq::Oligo mutate(OligoSeq::Oligo w,
 // and had better not be 0 (which is valid)
 const Oligos::Index NULLINDEX = ~(0UL);
 
-inline Oligos::Index repIndex(OligoHash &oh, Allelic side[], 
+template<class OH>
+inline Oligos::Index repIndex(OH &oh, Allelic side[], 
                               Oligos::Oligo w_norm,
+                              typename OH::HashFlag wflag,  // from oh.lookuploc(w_norm, wi)
+                              OligoSeq::Index wi,         // original kmer's index
                               unsigned &oppstrand) { // can be updated if w_rep kmer not the same as w_norm
-  OligoSeq::Index wi;      // to get original kmer's index
-  if (oh.lookuploc(w_norm, wi) == OligoHash::FOUND) {
+  if (wflag == OH::FOUND) {
     if (side[wi].partnered) {
       OligoSeq::Index pi;               // kmer partner's index
       OligoSeq::Oligo perturb = mutate(w_norm, side[wi].xormask, oh.Length - side[wi].pos);
       OligoSeq::Oligo partner = oh.Normalize(perturb);
-      if (oh.lookuploc(partner, pi) != OligoHash::FOUND) {
+      if (oh.lookuploc(partner, pi) != OH::FOUND) {
         cerr << "Failed to find partner " << hex << partner << " of " << w_norm << endl;
         exit(-1);
       }
@@ -423,7 +476,8 @@ inline Oligos::Index repIndex(OligoHash &oh, Allelic side[],
     return NULLINDEX; // not in the table of interesting kmers
 }
 
-inline void printEdge(OligoHash &oh, Oligos::Index i, OligoEdge &edge, ostream &out) {
+template<class OH>
+inline void printEdge(OH &oh, Oligos::Index i, OligoEdge &edge, ostream &out) {
   if (edge.nreads)
     out << hex
         << oh.getOligo(oh.hash[i]) << "\t"
@@ -434,45 +488,15 @@ inline void printEdge(OligoHash &oh, Oligos::Index i, OligoEdge &edge, ostream &
         << edge.nreads << endl;
 }
 
-int main(int argc, char *argv[]) {
-  // const OligoSeq::Index p6bit = 2;
-  // const OligoSeq::Index p7bit = 1;
-
-  int firstNonOption = SetupOptions(argc, argv);
-
-  if (debug.check('s')) {
-    cerr << "sizes: Oligo(" << sizeof(Oligos::Oligo) 
-         << "), Index(" << sizeof(Oligos::Index)
-         << "), Allelic(" << sizeof(Allelic) 
-         << "), OligoNode(" << sizeof(OligoNode)
-         << ")" << endl;
-  }
-
-  // Configure hash table based on input table (on standard input)
-  // OptionsFromComments(cin);
-
-  // OptHashSize *= (OptHashSlicing*3)/2;  // Because size was read from one slice, and we plan
-                                          // to read all slices, have to scale up.
-  // Note that we create the hash table WITHOUT slicing. The hash table needs to store
-  // SNPmers from all slices, so we apply slicing outside of the table to 
-  // the other kmers as needed.
-  if (debug.check('a')) cerr << "Allocating big structures...";
-  OligoHash oh(OptHashSize, 1, 0, // OptHashSlicing = 1, OptHashSlice = 0 ==> no slicing
-               OptOligoLen);      // Using extra bits only for the count (six bits);
-                                  // Also means this code works up to OligoLen=29 without change.
-  if (debug.check('a')) cerr << " hash,";
-  Allelic *side = (Allelic *) calloc(sizeof(Allelic), OptHashSize);
-  if (debug.check('a')) cerr << " allelic,";
-  OligoNode nodes[OptHashSize];
-  if (debug.check('a')) cerr << " nodes." << endl;
-
+// Fill the table and side array from the InputTable
+void loadInputTable(OligoHash &oh, Allelic side[]) {
   // Read in kmers from input table
   OligoSeq::Oligo kmer1, kmer2;
   Oligos::Index total1, bits1, total2, bits2, index1, index2;
   unsigned pos, xormask, flip;
   KRecordType type;
   const OligoSeq::Oligo KIDBITMASK = ((~0ULL) >> (8*sizeof(Oligos::Index) - NKIDS));
-  igzstream inTable(OptInTable.c_str());
+  OligoInput inTable(OptInTable.c_str());
   for (type = readKmerRecord(inTable, kmer1, total1, bits1, pos, xormask, flip, kmer2, total2, bits2);
        (type != ENDOFKMERS);
        type = readKmerRecord(inTable, kmer1, total1, bits1, pos, xormask, flip, kmer2, total2, bits2)) {
@@ -531,6 +555,7 @@ int main(int argc, char *argv[]) {
         exit(-1);
     }
   }
+}
 
   // Format of a kmer-report line:
   // type pos norm  kmer1 count1  bitvector1  SNPpos  mask  flip  kmer2 count2  bitvector2
@@ -553,6 +578,17 @@ int main(int argc, char *argv[]) {
   //        the major allelic kmer of the pair (or if arbitrary, the second in the table line); 
   //        and SNPpos counts from the right end of normalized kmer2 if flip was set
 
+// Find the edges between consecutive table kmers in each read of the
+// sequence files.  OH is OligoHash, or OligoPerfectHash with -F; then
+// order gives the kmers' ranks in the order of the loaded table's cells,
+// so the edges are written in the same order either way.
+template<class OH>
+void findEdges(OH &oh, Allelic side[], const vector<Oligos::Index> *order,
+               int firstNonOption, int argc, char *argv[]) {
+  if (debug.check('a')) cerr << "Allocating nodes...";
+  OligoNode nodes[oh.Size];
+  if (debug.check('a')) cerr << " done." << endl;
+
   int nseqs  = 0;
   int seqset = 1;
   int filearg = 0;
@@ -565,41 +601,49 @@ int main(int argc, char *argv[]) {
     }
     else {
       cerr << "Opening sequence file " << argv[filearg] << endl;
-      igzstream inputf(argv[filearg]);
+      OligoInput inputf(argv[filearg]);
 
       OligoSeq kmers(OptOligoLen, inputf, OptSoftMasking);
       int np;
       Oligos::Index prev = NULLINDEX;
       unsigned p_strand; // 0 top/normalized in the read; 1 bottom
       int p_offset;      // offset of prev in the read
-      while ((np = kmers.nextPos()) >= 0) {
-        if (np > 0) {
-          OligoSeq::Oligo w_norm = kmers.current();
-          Oligos::Index w_rep;
-          unsigned w_strand = (w_norm != kmers.fwd()); // 0=top or 1=bottom, will be updated to reflect w_rep
-          int w_offset;  // offset in the read
-          // if (debug.check('e')) cerr << "w_norm: " << oh.Bases(w_norm) << endl;
-          w_rep = repIndex(oh, side, w_norm, w_strand);
-
-          if (w_rep == NULLINDEX) continue; // not in the table of interesting kmers
-          if (prev != NULLINDEX) {
-            if (debug.check('e')) {
-              cerr << "adding edge between " << oh.Bases(oh.getOligo(oh.hash[prev]));
-              cerr << " and " << oh.Bases(oh.hash[w_rep]) << endl;
+      OligoBatch batch;
+      OligoSeq::Index locs[OligoBatch::MAXKMERS];
+      typename OH::HashFlag flags[OligoBatch::MAXKMERS];
+      int nb;
+      while ((nb = kmers.nextBatch(batch)) >= 0) {
+        if (nb > 0) {
+          oh.lookupBatch(batch.norm, nb, locs, flags);
+          for (int b = 0; b < nb; b++) {
+            np = batch.pos[b];
+            OligoSeq::Oligo w_norm = batch.norm[b];
+            Oligos::Index w_rep;
+            unsigned w_strand = batch.strand[b]; // 0=top or 1=bottom, will be updated to reflect w_rep
+            int w_offset;  // offset in the read
+            // if (debug.check('e')) cerr << "w_norm: " << oh.Bases(w_norm) << endl;
+            w_rep = repIndex(oh, side, w_norm, flags[b], locs[b], w_strand);
+
+            if (w_rep == NULLINDEX) continue; // not in the table of interesting kmers
+            if (prev != NULLINDEX) {
+              if (debug.check('e')) {
+                cerr << "adding edge between " << oh.Bases(oh.getOligo(oh.hash[prev]));
+                cerr << " and " << oh.Bases(oh.hash[w_rep]) << endl;
+              }
+              edgeInserts++;
+              nodes[prev].add_edge(w_rep, make_orient(p_strand, w_strand),   0, np - p_offset);
+              nodes[w_rep].add_edge(prev, make_orient(!w_strand, !p_strand), 0, np - p_offset);
             }
-            edgeInserts++;
-            nodes[prev].add_edge(w_rep, make_orient(p_strand, w_strand),   0, np - p_offset);
-            nodes[w_rep].add_edge(prev, make_orient(!w_strand, !p_strand), 0, np - p_offset);
+            prev = w_rep;
+            p_strand = w_strand;
+            p_offset = np;
           }
-          prev = w_rep;
-          p_strand = w_strand;
-          p_offset = np;
         }
-        else { // ! np, beginning of a sequence fragment (read or contig, have description line)
+        else { // ! nb, beginning of a sequence fragment (read or contig, have description line)
           prev = NULLINDEX;
         }
       }
-      // now np < 0
+      // now nb < 0
       cerr << "done with " << argv[filearg] << ", #edgeInserts: " << edgeInserts << endl;
       inputf.close();
     }
@@ -607,7 +651,7 @@ int main(int argc, char *argv[]) {
 
   // INACTIVE (OptWalkFile is always empty string in this tool.)
   if (OptWalkFile.length()) {
-    ogzstream walkFile(OptWalkFile.c_str());
+    OligoOutput walkFile(OptWalkFile.c_str(), true);
     Oligos::Index i;
 
     for (i = 0; i < oh.Size; i++) {
@@ -627,9 +671,10 @@ int main(int argc, char *argv[]) {
   }
 
   if (OptEdgeFile.length()) {
-    ogzstream edgeFile(OptEdgeFile.c_str());
-    Oligos::Index i;
-    for (i = 0; i < oh.Size; i++) {
+    OligoOutput edgeFile(OptEdgeFile.c_str(), true);
+    Oligos::Index i, n = (order ? order->size() : oh.Size);
+    for (Oligos::Index k = 0; k < n; k++) {
+      i = (order ? (*order)[k] : k);
       if (! oh.hash[i])
         continue;
       unsigned j;
@@ -659,5 +704,64 @@ int main(int argc, char *argv[]) {
          << ", #edges: " << nEdges
          << endl;
   }
+}
+
+int main(int argc, char *argv[]) {
+  // const OligoSeq::Index p6bit = 2;
+  // const OligoSeq::Index p7bit = 1;
+
+  int firstNonOption = SetupOptions(argc, argv);
+
+  if (debug.check('s')) {
+    cerr << "sizes: Oligo(" << sizeof(Oligos::Oligo) 
+         << "), Index(" << sizeof(Oligos::Index)
+         << "), Allelic(" << sizeof(Allelic) 
+         << "), OligoNode(" << sizeof(OligoNode)
+         << ")" << endl;
+  }
+
+  // Configure hash table based on input table (on standard input)
+  // OptionsFromComments(cin);
+
+  // OptHashSize *= (OptHashSlicing*3)/2;  // Because size was read from one slice, and we plan
+                                          // to read all slices, have to scale up.
+  // Note that we create the hash table WITHOUT slicing. The hash table needs to store
+  // SNPmers from all slices, so we apply slicing outside of the table to 
+  // the other kmers as needed.
+  if (debug.check('a')) cerr << "Allocating big structures...";
+  ostringstream loading;  // the options that decide which records are loaded
+  loading << " -P " << OptPositions << " -a " << OptAmbiguous << " -m " << OptMin << " -M " << OptMax;
+  OligoTableSnapshot snapshot(OptSnapshot, "GenomeMmEdges", sizeof(Allelic), OptInTable,
+                              OptOligoLen, OptHashSlicing, OptHashSlice, loading.str());
+  bool fromSnapshot = snapshot.map(OptHashSize);
+  OligoHash oh = (fromSnapshot
+                  ? OligoHash(snapshot.snap)
+                  : OligoHash(OptHashSize, 1, 0, // OptHashSlicing = 1, OptHashSlice = 0 ==> no slicing
+                              OptOligoLen));    // Using extra bits only for the count (Info1, overflowing to oh.overflow);
+                                                // Also means this code works up to OligoLen=29 without change.
+  if (debug.check('a')) cerr << " hash,";
+  Allelic *side = (fromSnapshot ? (Allelic *) snapshot.snap.side :
+                   (Allelic *) allocTable(sizeof(Allelic) * OptHashSize, 16, OptHashSlice));
+  if (debug.check('a')) cerr << " allelic." << endl;
+
+  if (! fromSnapshot) {
+    loadInputTable(oh, side);
+    snapshot.save(oh, side);
+  }
+
+  if (OptPerfect) {
+    OligoPerfectHash ph(oh);
+    Allelic *ranked = ph.arrange(oh, side);
+    vector<Oligos::Index> order = ph.sourceOrder(oh);
+    if (! fromSnapshot) {
+      freeTable(side);
+    }
+    oh.release();
+    findEdges(ph, ranked, &order, firstNonOption, argc, argv);
+  }
+  else {
+    findEdges(oh, side, NULL, firstNonOption, argc, argv);
+  }
+
   exit(0);
 }
@@ -1,21 +1,29 @@
 #include "OligoSeq.hh"
 #include "OligoHash.hh"
+#include "OligoPerfect.hh"
+#include "OligoTableSnapshot.hh"
 #include "getprime.hh"
 #include <string>
-#include "gzstream.h"
+#include "OligoInput.hh"
+#include "OligoOutput.hh"
 #include <iomanip>
 #include <cctype>
 #include <cstdio>
+#include <sstream>
 
 const unsigned NKIDS = 10;
 
 Oligos::Index OptOligoLen;
 Oligos::Index OptHashSize;
+double OptMaxLoad;
 Oligos::Index OptHashSlicing;
 Oligos::Index OptHashSlice;
 unsigned OptMin;
 unsigned OptMax;
 string OptInTable;
+string OptSnapshot;
+string OptOutFile;
+bool OptPerfect;
 bool OptSoftMasking;
 bool OptSummary;
 bool OptAmbiguous;
@@ -23,6 +31,8 @@ string OptPatterns;
 string OptPositions;
 string OptDebug;
 
+OligoOutput Out;  // the kmer report, to OptOutFile
+
 bool debugging(const char which[]) {
   if (OptDebug.find('+') != string::npos) return true;
 
@@ -35,9 +45,28 @@ bool debugging(const char which[]) {
 void PrintOptions() {
   cerr << "Option values are:\n"<<
     "   -i {InputTable}  ["<< OptInTable     <<"] Input table: type kmer count bitvector [SNPpos SNPxormask SNPflip kmer count bitvector]\n" <<
-    "   -o {OligoLen}    ["<< OptOligoLen    <<"] Number of nucleotide bases per oligo (in otherwords, value of k for k-mer).\n" <<
+    "   -T {Snapshot}    ["<< OptSnapshot    <<"] Binary snapshot of the table loaded from InputTable: mapped instead of reading\n" <<
+    "                                       InputTable if it exists (and was made from the same, unchanged InputTable\n" <<
+    "                                       with the same options), else written.  InputTable must be a regular file.\n" <<
+    "   -O {OutFile}     ["<< OptOutFile     <<"] Write the kmer report here ('-' for standard output), compressed\n" <<
+    "                                       (BGZF, on a pool of threads) if the name ends in .gz.\n" <<
+    "   -F               ["<< OptPerfect     <<"] Freeze the loaded table into a minimal perfect hash before scanning:\n" <<
+    "                                       no empty cells or probing, and a side array of just the kmers.\n" <<
+    "   -o {OligoLen}    ["<< OptOligoLen    <<"] Number of nucleotide bases per oligo (in otherwords, value of k for k-mer);\n" <<
+    "                                       over 31 runs GenomeMmScanWide, with 128-bit kmers.\n" <<
     "   -H {HashSize}    ["<< OptHashSize    <<"] Number of cells in hash table (can choose based on InputTable).\n" <<
+    "   -N {MemPolicy}   ["<< tablePolicy().spec <<"] Allocate big tables as this comma-separated list says: huge\n" <<
+    "                                       (transparent huge pages), huge2m or huge1g (reserved huge pages),\n" <<
+    "                                       interleave (across NUMA nodes) or bind (to node Slice % nodes), and\n" <<
+    "                                       touch=N (zero them with N threads); see OligoMemory.hh.\n" <<
+    "   -q {FastqMask}   ["<< fastqMasking().spec <<"] Mask FASTQ input (read directly) as scripts/fastq2fam.pl would: a\n" <<
+    "                                       comma-separated list of m=, soft=, zq=, pre=, suf=, bnum=, bs= and r=\n" <<
+    "                                       settings, named for its options; see OligoFastq.hh.\n" <<
+    "   -L {MaxLoad}     ["<< OptMaxLoad     <<"] Grow the hash table (rehash into one twice as big) whenever its kmers\n" <<
+    "                                       reach this fraction of its cells, e.g. 0.8; 0 means never grow.\n" <<
 		"   -S {Slicing[:Slice]} [" << OptHashSlicing << ":" << OptHashSlice << "] Slicing factor and slice for unpartnered kmers.\n" <<
+		"   -R               ["<< mixedSlicing() <<"] Slice by a mixed hash of each kmer, not kmer % Slicing: evener slices, but\n" <<
+		"                                       every tool run on the same tables must be given -R too (see OligoSlice.hh).\n" <<
 		// "   -p {pattern[,pattern]*} [" << OptPatterns << "] Patterns for kmers to be loaded: with '-' for major-minor partners, just one of AA/AP/PA/PP for unpartnered.\n"
 		"   -P {position[,position]*} [" << OptPositions << "] SNP positions for major-minor kmers to be loaded (the base position in which the partners differ) relative to first/minor kmer of the pair\n" <<
 		"   -a               ["<< OptAmbiguous << "] Turn on loading of kmers with ambiguous SNP partners\n" <<
@@ -77,7 +106,7 @@ public:
 	unsigned unambiguous:  1; // Fields below are meaningful only if this bit is set
 	unsigned partnered:    1; // 1 means found, 0 means searched and not found (not unambiguous, as above,
 	                          //      can mean too many or too common partners.
-	unsigned pos:          5; // offset of SNP base within kmer, 0..31
+	unsigned pos:          6; // offset of SNP base within kmer, 0..63
 	unsigned xormask:      2; // mask for SNP base (see Transverse/Transit/Complement above);
 	                          //      0=NoMate => no partner kmer found => nonpolymorphic k-locus
 	unsigned flip:         1; // set if allelic partner kmer is in table RC relative to this kmer
@@ -212,9 +241,13 @@ int SetupOptions(int argc, char**argv)
   // Default values
 	OptOligoLen    = 23;        // -o <small_integer>
 	OptHashSize    = 0;         // -H <big_integer>
+	OptMaxLoad     = 0;         // -L <fraction>
 	OptHashSlicing = 11;        // -S <small_prime>[:<hashslice in 0..small_prime-1>]
 	OptHashSlice   = 0;         // override with :# on OptHashSlicing
   OptInTable     = "";        // -i <filename>
+  OptSnapshot    = "";        // -T <filename>
+  OptPerfect     = false;     // -F
+  OptOutFile     = "-";       // -O <filename>
 	//	OptPatterns    = "AA-PA,AA-PP,AP-PA,AP-PP,PA-PP";   // -p <pattern>[,<pattern>]*
 	OptPositions   = "3,12,21"; // -P <small_integer>[,<small_integer>]*
 	OptAmbiguous   = false;     // -a
@@ -236,6 +269,20 @@ int SetupOptions(int argc, char**argv)
       case 'o':
 				OptOligoLen = strtol(argv[++i], NULL, 0);
 				break;
+      case 'N':
+				if (! tablePolicy().parse(argv[++i])) {
+					PrintOptions();
+					cerr << "Argument error: -N " << argv[i] << "; MemPolicy words are huge, huge2m, huge1g, interleave, bind and touch=N.\n";
+					exit(-1);
+				}
+				break;
+      case 'q':
+				if (! fastqMasking().parse(argv[++i])) {
+					PrintOptions();
+					cerr << "Argument error: -q " << argv[i] << "; FastqMask settings are m=, soft=, zq=, pre=, suf=, bnum=, bs= and r= (a regular expression).\n";
+					exit(-1);
+				}
+				break;
       case 'H': {
 				OptHashSize = strtoll(argv[++i], NULL, 0); 
 				prime = get_prime(OptHashSize);
@@ -248,6 +295,12 @@ int SetupOptions(int argc, char**argv)
 				break;
       case 'i':
 				OptInTable = argv[++i]; break;
+      case 'T':
+				OptSnapshot = argv[++i]; break;
+      case 'O':
+				OptOutFile = argv[++i]; break;
+      case 'F':
+				OptPerfect = true; break;
 			case 'P':
 				OptPositions = argv[++i]; 
 				break;
@@ -260,12 +313,18 @@ int SetupOptions(int argc, char**argv)
 			case 'm':
 				OptMin = strtol(argv[++i], NULL, 0);
 				break;
+			case 'R':
+				mixedSlicing() = true;
+				break;
 			case 'S':
 				parseSlicing(argv[++i]); // sets OptHashSlicing and OptHashSlice
 				break;
 			case 'M':
 				OptMax = strtol(argv[++i], NULL, 0);
 				break;
+      case 'L':
+				OptMaxLoad = strtod(argv[++i], NULL);
+				break;
       case 'd':
         OptDebug = argv[++i]; break;
       case 'h':
@@ -283,6 +342,22 @@ int SetupOptions(int argc, char**argv)
 		}
   }
  EndOptions:
+	runWide(argv, OptOligoLen);
+	if (OptOligoLen < 1 || OptOligoLen > Oligos::MAXLENGTH) {
+		PrintOptions();
+		cerr << "Argument error: -o " << OptOligoLen << "; OligoLen must be in [1.."
+				 << Oligos::WIDEMAXLENGTH << "].\n";
+		exit(-1);
+	}
+	if (OptMaxLoad < 0 || OptMaxLoad >= 1) {
+		PrintOptions();
+		cerr << "Argument error: -L " << OptMaxLoad << "; MaxLoad must be in [0..1).\n";
+		exit(-1);
+	}
+	if (!OptHashSize && OptMaxLoad > 0) {
+		// Growing as needed, so just start small
+		OptHashSize = get_prime(99999);
+	}
 	// patternAddList(OptPatterns);
 	positionAddList(OptPositions);
   if (debugging("o")) PrintOptions();
@@ -323,7 +398,7 @@ KRecordType readKmerRecord(istream &in,
 			// Partnered kmers: read two kmers with their SNP relationship between
 			// Should be minor allele first, major second (check that parent bits are consistent with that)
 			// AND if filtering, enforce that the SNP position is middle or INSET bases from kmer end
-			parsed = sscanf(buf+1, "%lx %lx %lx %u %u %u %lx %lx %lx", &kmer1, &count1, &bits1, &pos, &xormask, &flip, &kmer2, &count2, &bits2);
+			parsed = scanOligos(buf+1, "%K %lx %lx %u %u %u %K %lx %lx", &kmer1, &count1, &bits1, &pos, &xormask, &flip, &kmer2, &count2, &bits2);
 			if (parsed != 9) {
 				cerr << "readKmerRecord failure on line:\n" << buf;
 				exit(-1);
@@ -334,13 +409,13 @@ KRecordType readKmerRecord(istream &in,
 		else if (type == '0') {
 			// confirmed unpartnered kmer: save only if parent bits are consistent with requested (default none)
 			// AND if filtering, enforce that the kmer is congruent to Slice module SlicingFactor
-			parsed = sscanf(buf+1, "%lx %lx %lx", &kmer1, &count1, &bits1);
+			parsed = scanOligos(buf+1, "%K %lx %lx", &kmer1, &count1, &bits1);
 			if (parsed != 3) {
 				cerr << "readKmerRecord failure on line:\n" << buf;
 				exit(-1);
 			}
 			// Only stuff in table if in current slice
-			if (OptHashSlicing && (kmer1 % OptHashSlicing != OptHashSlice)) continue;
+			if (OptHashSlicing && (sliceOf(kmer1, OptHashSlicing) != OptHashSlice)) continue;
 			// kmer isn't present in right parent or parents
 			// if (! patternCheckByBV(bits1)) continue;
 		}
@@ -356,13 +431,13 @@ KRecordType readKmerRecord(istream &in,
 			// ambiguously partnered kmer; save only if specifically asked to and parent bits match
 			// patterns requested for "confirmed unpartnered" (case '0' above)
 			// AND if filtering, enforce that the kmer is congruent to Slice module SlicingFactor
-			parsed = sscanf(buf+1, "%lx %lx %lx", &kmer1, &count1, &bits1);
+			parsed = scanOligos(buf+1, "%K %lx %lx", &kmer1, &count1, &bits1);
 			if (parsed != 3) {
 				cerr << "readKmerRecord failure on line:\n" << buf;
 				exit(-1);
 			}
 			// Only stuff in table if in current slice
-			if (OptHashSlicing && (kmer1 % OptHashSlicing != OptHashSlice)) continue;
+			if (OptHashSlicing && (sliceOf(kmer1, OptHashSlicing) != OptHashSlice)) continue;
 			// kmer isn't present in right parent or parents
 			// if (! patternCheckByBV(bits1)) continue;
 		}
@@ -377,20 +452,21 @@ KRecordType readKmerRecord(istream &in,
 	return ENDOFKMERS; // NUL character
 }
 
-void inline printFields(OligoHash oh,
+template<class OH>
+void inline printFields(OH &oh,
 												Allelic side[],
-												OligoHash::Oligo* op) {
-	OligoHash::Index oi = op - oh.hash;
-	cout 
+												Oligos::Oligo* op) {
+	Oligos::Index oi = op - oh.hash;
+	Out 
 		<< hex << setw(12) << setfill('0') 
 		<< oh.getOligo(*op) 
 		<< setw(0) << "\t" 
-		<< oh.getInfo1(*op) << "\t" 
+		<< oh.count(oi) << "\t" 
 		<< side[oi].inLibs << "\t"
 		;
 }
 
-OligoHash::Index insertOrDie(OligoHash oh,
+OligoHash::Index insertOrDie(OligoHash &oh,
 														 OligoHash::Oligo inmer,
 														 OligoHash::Index num) {
 	OligoHash::Index index;
@@ -411,32 +487,15 @@ inline OligoSeq::Oligo mutate(OligoSeq::Oligo w,
   return w ^ (mask << (2*shift));
 }
 
-int main(int argc, char *argv[]) {
-	// const OligoSeq::Index p6bit = 2;
-	// const OligoSeq::Index p7bit = 1;
-
-  int firstNonOption = SetupOptions(argc, argv);
-
-	// Configure hash table based on input table (on standard input)
-	// OptionsFromComments(cin);
-
-	// OptHashSize *= (OptHashSlicing*3)/2;  // Because size was read from one slice, and we plan
-	                                      // to read all slices, have to scale up.
-	// Note that we create the hash table WITHOUT slicing. The hash table needs to store
-	// SNPmers from all slices, so we apply slicing outside of the table to 
-	// the other kmers as needed.
-  OligoHash oh(OptHashSize, 1, 0, // OptHashSlicing = 1, OptHashSlice = 0 ==> no slicing
-							 OptOligoLen);      // Using extra bits only for the count (six bits);
-	                                // Also means this code works up to OligoLen=29 without change.
-	Allelic *side = (Allelic *) calloc(sizeof(Allelic), OptHashSize);
-
+// Fill the table and side array from the InputTable
+void loadInputTable(OligoHash &oh, Allelic *&side) {
 	// Read in kmers from input table
 	OligoSeq::Oligo kmer1, kmer2;
 	Oligos::Index total1, bits1, total2, bits2, index1, index2;
 	unsigned pos, xormask, flip;
 	KRecordType type;
 	// const OligoSeq::Oligo KIDBITMASK = ((~0ULL) >> (8*sizeof(Oligos::Index) - NKIDS));
-	igzstream inTable(OptInTable.c_str());
+	OligoInput inTable(OptInTable.c_str());
 	for (type = readKmerRecord(inTable, kmer1, total1, bits1, pos, xormask, flip, kmer2, total2, bits2);
 			 (type != ENDOFKMERS);
 			 type = readKmerRecord(inTable, kmer1, total1, bits1, pos, xormask, flip, kmer2, total2, bits2)) {
@@ -483,7 +542,13 @@ int main(int argc, char *argv[]) {
 				cerr << "Unrecognized return case " << type << " from readKmerRecord\n";
 				exit(-1);
 		}
+		// Only between records, since the side entries for both partners
+		// must be filled in before they are carried along.
+		if (oh.overloaded()) {
+			oh.grow(side);
+		}
 	}
+}
 
 	// Format of a kmer-report line:
 	// type	pos	norm	kmer1	count1	bitvector1	SNPpos	mask	flip	kmer2	count2	bitvector2
@@ -506,6 +571,10 @@ int main(int argc, char *argv[]) {
 	//        the major allelic kmer of the pair (or if arbitrary, the second in the table line); 
 	//        and SNPpos counts from the right end of normalized kmer2 if flip was set
 
+// Look up the kmers of each read in the sequence files, reporting those in
+// the table.  OH is OligoHash, or OligoPerfectHash with -F.
+template<class OH>
+void scanReads(OH &oh, Allelic side[], int firstNonOption, int argc, char *argv[]) {
 	int nseqs  = 0;
   int seqset = 1;
   int filearg = 0;
@@ -517,99 +586,161 @@ int main(int argc, char *argv[]) {
     }
     else {
       cerr << "Opening sequence file " << argv[filearg] << endl;
-      igzstream inputf(argv[filearg]);
+      OligoInput inputf(argv[filearg]);
 
       OligoSeq kmers(OptOligoLen, inputf, OptSoftMasking);
       int np;
       unsigned nonminor = 0, minor = 0;
 			string summary = "";
 			OligoSeq::Index expectedPos = oh.Length; // i.e., the oligolength
-      while ((np = kmers.nextPos()) >= 0) {
-        if (np > 0) {
-					char typechar = '#';
-					for (; expectedPos < np; expectedPos++) {
-						summary += 'q';
-					}
-					expectedPos = np + 1;
-          OligoSeq::Oligo w_norm = kmers.current();
-					OligoSeq::Index wi;                 // original kmer's index
-          if (oh.lookuploc(w_norm, wi) == OligoHash::FOUND) {
-						OligoSeq::Index bitvector;
-						char fwd = (w_norm == kmers.fwd() ? '0' : '1');
-						if (side[wi].partnered) {
-							OligoSeq::Index pi;               // kmer partner's index
-							OligoSeq::Oligo perturb = mutate(w_norm, side[wi].xormask, oh.Length - side[wi].pos);
-							OligoSeq::Oligo partner = oh.Normalize(perturb);
-							if (debugging("p") && (w_norm % 999983)) {
-								cerr << "Partner for " << oh.Bases(w_norm) << " is " ;
-								cerr << oh.Bases(perturb)
-										 << " (based on " << dec << " ( " << side[wi].pos << "," << side[wi].xormask << (side[wi].flip? ",-)" : ",+)")
-										 << ")";
-								if (perturb != partner) {
-									cerr << " normalized as " << oh.Bases(partner);
-								}
-								cerr << endl;
-							}
-							if (oh.lookuploc(partner, pi) != OligoHash::FOUND) {
-								cerr << "Failed to find partner " << hex << partner << " of " << w_norm << endl;
-								exit(-1);
-							}
-							// summary += (typechar = typeCharByBV(side[wi].inLibs, side[pi].inLibs));
-							summary += (typechar = '1');
-							cout << dec << typechar << "\t" << (np - 22) << "\t" << fwd << "\t";
-							printFields(oh, side, oh.hash + wi);
-							cout << "\t" << dec << side[wi].pos 
-									 << "\t" << side[wi].xormask
-									 << "\t" << side[wi].flip
-									 << "\t";
-							printFields(oh, side, oh.hash + pi);
-							cout << endl;
-							continue;
+      OligoBatch batch;
+      OligoSeq::Index locs[OligoBatch::MAXKMERS];
+      typename OH::HashFlag flags[OligoBatch::MAXKMERS];
+      int nb;
+      while ((nb = kmers.nextBatch(batch)) >= 0) {
+        if (nb > 0) {
+          oh.lookupBatch(batch.norm, nb, locs, flags);
+          for (int b = 0; b < nb; b++) {
+            np = batch.pos[b];
+						char typechar = '#';
+						for (; expectedPos < np; expectedPos++) {
+							summary += 'q';
 						}
-						else {
-							// not partnered
-							OligoSeq::Index count = oh.getInfo1(oh.hash[wi]);
-							// OligoSeq::Index pbits = side[wi].inLibs >> NKIDS;
-							if (count > OptMax || !side[wi].unambiguous) {
-								summary += 'r';
+						expectedPos = np + 1;
+            OligoSeq::Oligo w_norm = batch.norm[b];
+						OligoSeq::Index wi = locs[b];       // original kmer's index
+            if (flags[b] == OH::FOUND) {
+							OligoSeq::Index bitvector;
+							char fwd = (batch.strand[b] ? '1' : '0');
+							if (side[wi].partnered) {
+								OligoSeq::Index pi;               // kmer partner's index
+								OligoSeq::Oligo perturb = mutate(w_norm, side[wi].xormask, oh.Length - side[wi].pos);
+								OligoSeq::Oligo partner = oh.Normalize(perturb);
+								if (debugging("p") && (w_norm % 999983)) {
+									cerr << "Partner for " << oh.Bases(w_norm) << " is " ;
+									cerr << oh.Bases(perturb)
+											 << " (based on " << dec << " ( " << side[wi].pos << "," << side[wi].xormask << (side[wi].flip? ",-)" : ",+)")
+											 << ")";
+									if (perturb != partner) {
+										cerr << " normalized as " << oh.Bases(partner);
+									}
+									cerr << endl;
+								}
+								if (oh.lookuploc(partner, pi) != OH::FOUND) {
+									cerr << "Failed to find partner " << hex << partner << " of " << w_norm << endl;
+									exit(-1);
+								}
+								// summary += (typechar = typeCharByBV(side[wi].inLibs, side[pi].inLibs));
+								summary += (typechar = '1');
+								Out << dec << typechar << "\t" << (np - 22) << "\t" << fwd << "\t";
+								printFields(oh, side, oh.hash + wi);
+								Out << "\t" << dec << side[wi].pos 
+										 << "\t" << side[wi].xormask
+										 << "\t" << side[wi].flip
+										 << "\t";
+								printFields(oh, side, oh.hash + pi);
+								Out << endl;
 								continue;
 							}
-							typechar = 'N';
+							else {
+								// not partnered
+								OligoSeq::Index count = oh.count(wi);
+								// OligoSeq::Index pbits = side[wi].inLibs >> NKIDS;
+								if (count > OptMax || !side[wi].unambiguous) {
+									summary += 'r';
+									continue;
+								}
+								typechar = 'N';
 
-							summary += typechar;
-							cout << dec << typechar << "\t" << (np - 22) << "\t" << fwd << "\t";
-							printFields(oh, side, oh.hash + wi);
-							cout << endl;
-							continue;
+								summary += typechar;
+								Out << dec << typechar << "\t" << (np - 22) << "\t" << fwd << "\t";
+								printFields(oh, side, oh.hash + wi);
+								Out << endl;
+								continue;
+							}
+            }
+            else {
+              // Not in the minor-or-tied-homozygous allele kmer table
+							if (OptHashSlicing && (sliceOf(w_norm, OptHashSlicing) != OptHashSlice)) {
+								summary += '-';
+							}
+							else {
+								summary += 'e';
+							}
 						}
           }
-          else {
-            // Not in the minor-or-tied-homozygous allele kmer table
-						if (OptHashSlicing && (w_norm % OptHashSlicing != OptHashSlice)) {
-							summary += '-';
-						}
-						else {
-							summary += 'e';
-						}
-					}
         }
-        else { // ! np, beginning of a sequence fragment (read or contig, have description line)
+        else { // ! nb, beginning of a sequence fragment (read or contig, have description line)
 					if (summary.length()) {
-						cout << "# Summary: " << summary << endl;
+						Out << "# Summary: " << summary << endl;
 						summary = "";
 					}
-					cout << kmers.get_descrip() << endl;
+					Out << kmers.get_descrip() << endl;
 					expectedPos = oh.Length;
         }
       }
 			// Summary for last read
 			if (summary.length())
-				cout << "# Summary: " << summary << endl;
-      // now np < 0
+				Out << "# Summary: " << summary << endl;
+      // now nb < 0
       cerr << "done with " << argv[filearg] << endl;
       inputf.close();
     }
   }
 
+}
+
+int main(int argc, char *argv[]) {
+	// const OligoSeq::Index p6bit = 2;
+	// const OligoSeq::Index p7bit = 1;
+
+  int firstNonOption = SetupOptions(argc, argv);
+  Out.open(OptOutFile.c_str());
+  if (! Out) {
+    cerr << "Can't write " << OptOutFile << endl;
+    exit(-1);
+  }
+
+	// Configure hash table based on input table (on standard input)
+	// OptionsFromComments(cin);
+
+	// OptHashSize *= (OptHashSlicing*3)/2;  // Because size was read from one slice, and we plan
+	                                      // to read all slices, have to scale up.
+	// Note that we create the hash table WITHOUT slicing. The hash table needs to store
+	// SNPmers from all slices, so we apply slicing outside of the table to 
+	// the other kmers as needed.
+  ostringstream loading;  // the options that decide which records are loaded
+  loading << " -P " << OptPositions << " -a " << OptAmbiguous;
+  OligoTableSnapshot snapshot(OptSnapshot, "GenomeMmScan", sizeof(Allelic), OptInTable,
+                              OptOligoLen, OptHashSlicing, OptHashSlice, loading.str());
+  bool fromSnapshot = snapshot.map(OptHashSize);
+  OligoHash oh = (fromSnapshot
+                  ? OligoHash(snapshot.snap)
+                  : OligoHash(OptHashSize, 1, 0, // OptHashSlicing = 1, OptHashSlice = 0 ==> no slicing
+                              OptOligoLen));    // Using extra bits only for the count (Info1, overflowing to oh.overflow);
+                                                // Also means this code works up to OligoLen=29 without change.
+	Allelic *side = (fromSnapshot ? (Allelic *) snapshot.snap.side :
+	                 (Allelic *) allocTable(sizeof(Allelic) * OptHashSize, 16, OptHashSlice));
+	oh.setGrowth(OptMaxLoad);
+
+	if (! fromSnapshot) {
+		loadInputTable(oh, side);
+		snapshot.save(oh, side);
+	}
+
+	if (OptPerfect) {
+		OligoPerfectHash ph(oh);
+		Allelic *ranked = ph.arrange(oh, side);
+		if (! fromSnapshot) {
+			freeTable(side);
+		}
+		oh.release();
+		scanReads(ph, ranked, firstNonOption, argc, argv);
+	}
+	else {
+		scanReads(oh, side, firstNonOption, argc, argv);
+	}
+
+  Out.close();
   exit(0);
 }
@@ -1,11 +1,13 @@
 #include "OligoSeq.hh"
 #include "OligoHash.hh"
+#include "OligoSketch.hh"
 #include "getprime.hh"
 #include <string>
-#include "gzstream.h"
+#include "OligoInput.hh"
 #include <iomanip>
 #include <cctype>
 #include <cstdio>
+#include <vector>
 
 // const unsigned NKIDS = 10;
 
@@ -30,7 +32,7 @@ Allelic() : inLibs(0),
 	unsigned unambiguous:  1; // Fields below are meaningful only if this bit is set
 	unsigned partnered:    1; // 1 means found, 0 means searched and not found (not unambiguous, as above,
 	                          //      can mean too many or too common partners.
-	unsigned short pos:          5; // offset of SNP base within kmer, 0..31
+	unsigned short pos:          6; // offset of SNP base within kmer, 0..63
 	unsigned short xormask:      2; // mask for SNP base (see Transverse/Transit/Complement above);
 	                          //      0=NoMate => no partner kmer found => nonpolymorphic k-locus
 	unsigned short flip:         1; // set if allelic partner kmer is in table RC relative to this kmer
@@ -38,6 +40,7 @@ Allelic() : inLibs(0),
 
 Oligos::Index OptOligoLen;
 Oligos::Index OptHashSize;
+double OptMaxLoad;
 Oligos::Index OptHashSlicing;
 Oligos::Index OptHashSlice;
 Oligos::Index OptFilterCount = 254;
@@ -59,17 +62,24 @@ void PrintOptions() {
   cerr << "Option values are:\n"<<
     "   -t {Tag}         ["<< OptTag         <<"] Nametag for this analysis run.\n" <<
     "   -f {FilterCount} ["<< OptFilterCount <<"] Ignore input kmers whose total count is greater than this\n" <<
-    "   -o {OligoLen}    ["<< OptOligoLen    <<"] Number of nucleotide bases per oligo (in otherwords, value of k for k-mer).\n" <<
-    "   -H {HashSize}    ["<< OptHashSize    <<"] Number of cells in hash table (can choose based on InputTable).\n" <<
+    "   -o {OligoLen}    ["<< OptOligoLen    <<"] Number of nucleotide bases per oligo (in otherwords, value of k for k-mer);\n" <<
+    "                                       over 31 runs GenomeMmTableWide, with 128-bit kmers.\n" <<
+    "   -H {HashSize}    ["<< OptHashSize    <<"] Number of cells in hash table (can choose based on InputTable);\n" <<
+    "                                       0, with input table files named, means estimate from a pre-scan of them.\n" <<
+    "   -N {MemPolicy}   ["<< tablePolicy().spec <<"] Allocate big tables as this comma-separated list says: huge\n" <<
+    "                                       (transparent huge pages), huge2m or huge1g (reserved huge pages),\n" <<
+    "                                       interleave (across NUMA nodes) or bind (to node Slice % nodes), and\n" <<
+    "                                       touch=N (zero them with N threads); see OligoMemory.hh.\n" <<
+    "   -L {MaxLoad}     ["<< OptMaxLoad     <<"] Grow the hash table (rehash into one twice as big) whenever its kmers\n" <<
+    "                                       reach this fraction of its cells, e.g. 0.8; 0 means never grow.\n" <<
     "   -h               Print help information.\n" <<
     "   -d {DebugString} ["<< OptDebug <<"] Each character indicates a debugging option to turn on;\n" <<
     "                                       '+' indicates turn on all debugging.\n" <<
     "   [standard input]    Text with input kmers and counts as hex numbers\n" <<
     "                       (comments give oligo length, etc.)\n" <<
 		"   No more options are allowed after the first argument that can't be parsed as an option.\n" <<
-		"   What follows is then a list of file names, possibly separated by a '/' token\n" <<
-		"   to delineate boundaries between sequence sets (e.g. genome vs. reads, different\n" <<
-		"   read sets, etc.) that will be counted separately.\n" <<
+		"   What follows is then a list of input table files (e.g. GenomeBVcount outputs, possibly\n" <<
+		"   gzipped) to read instead of standard input.\n" <<
     endl;
 }
 
@@ -96,6 +106,7 @@ int SetupOptions(int argc, char**argv)
   // Default values
 	OptOligoLen    = 23;        // 'o'
 	OptHashSize    = 0;         // 'H'; will deduce from InputTable if omitted
+	OptMaxLoad     = 0;         // 'L'
   OptFilterCount = 254;       // 'f'
   OptInTable     = "";        // 'i'
   OptTag         = "";        // 't'
@@ -115,6 +126,13 @@ int SetupOptions(int argc, char**argv)
       case 'o':
 				OptOligoLen = strtol(argv[++i], NULL, 0);
 				break;
+      case 'N':
+				if (! tablePolicy().parse(argv[++i])) {
+					PrintOptions();
+					cerr << "Argument error: -N " << argv[i] << "; MemPolicy words are huge, huge2m, huge1g, interleave, bind and touch=N.\n";
+					exit(-1);
+				}
+				break;
       case 'H': {
 				OptHashSize = strtoll(argv[++i], NULL, 0); 
 				prime = get_prime(OptHashSize);
@@ -125,6 +143,9 @@ int SetupOptions(int argc, char**argv)
 				}
       }
 				break;
+      case 'L':
+				OptMaxLoad = strtod(argv[++i], NULL);
+				break;
       case 'd':
         OptDebug = argv[++i]; break;
       case 'i':
@@ -146,6 +167,22 @@ int SetupOptions(int argc, char**argv)
 		}
   }
  EndOptions:
+	runWide(argv, OptOligoLen);
+	if (OptOligoLen < 1 || OptOligoLen > Oligos::MAXLENGTH) {
+		PrintOptions();
+		cerr << "Argument error: -o " << OptOligoLen << "; OligoLen must be in [1.."
+				 << Oligos::WIDEMAXLENGTH << "].\n";
+		exit(-1);
+	}
+	if (OptMaxLoad < 0 || OptMaxLoad >= 1) {
+		PrintOptions();
+		cerr << "Argument error: -L " << OptMaxLoad << "; MaxLoad must be in [0..1).\n";
+		exit(-1);
+	}
+	if (!OptHashSize && OptMaxLoad > 0) {
+		// Growing as needed, so just start small
+		OptHashSize = get_prime(99999);
+	}
   if (debugging("o")) PrintOptions();
   return i;
 }
@@ -268,7 +305,8 @@ OligoSeq::Oligo readKmerRecord(istream &in,
 			continue; // skip past any lines that don't start with a hex-encoded kmer
 		}
 		// parsed = sscanf(buf, "%qx %lx %lx %lx", &kmer, &count1, &count2, &count3);
-		parsed = sscanf(buf, "%lx %lx %lx", &kmer, &count1, &count2);
+		kmer = parseOligo(buf, &bufp);  // (up to 128 bits, with OLIGO_WIDE)
+		parsed = 1 + sscanf(bufp, "%lx %lx", &count1, &count2);
 		if (parsed != 3) {
 			// skip past other problem lines (should probably just die...)
 			continue;
@@ -281,7 +319,7 @@ OligoSeq::Oligo readKmerRecord(istream &in,
 	return ~0;
 }
 
-void inline printFields(OligoHash oh,
+void inline printFields(OligoHash &oh,
 												Allelic side[],
 												OligoHash::Oligo* op) {
 	OligoHash::Index oi = op - oh.hash;
@@ -289,16 +327,49 @@ void inline printFields(OligoHash oh,
 		<< hex << setw((OptOligoLen + 1)/2) << setfill('0') 
 		<< oh.getOligo(*op) 
 		<< setw(0) << "\t" 
-		<< oh.getInfo1(*op) << "\t" 
+		<< oh.count(oi) << "\t" 
 		<< side[oi].inLibs
 		;
 }
 
+// Cells for the kmers that will be loaded from the named input tables
+// (those with total count over 1), estimated with a HyperLogLog sketch, at
+// 80% load.
+Oligos::Index planHashSize(vector<string> &names)
+{
+	HyperLogLog loaded;
+	Oligos::Index total, bitvector;
+	for (unsigned f = 0; f < names.size(); f++) {
+		cerr << "Pre-scanning input table " << names[f] << endl;
+		OligoInput in(names[f].c_str());
+		for (OligoSeq::Oligo kmer = readKmerRecord(in, total, bitvector);
+				 total;
+				 kmer = readKmerRecord(in, total, bitvector)) {
+			if (total > 1) {
+				loaded.add(kmer);
+			}
+		}
+	}
+	Oligos::Index size = get_prime((Oligos::Index) (loaded.estimate() / 0.8) + 1000);
+	cerr << "Planned HashSize " << size << " for about " << (Oligos::Index) loaded.estimate()
+			 << " kmers." << endl;
+	return size;
+}
+
 int main(int argc, char *argv[]) {
 	const OligoSeq::Index p6bit = 2;
 	const OligoSeq::Index p7bit = 1;
 
   int firstNonOption = SetupOptions(argc, argv);
+	vector<string> inputs(argv + firstNonOption, argv + argc);
+	if (! OptHashSize) {
+		if (inputs.empty()) {
+			PrintOptions();
+			cerr << "Argument error: need -H or -L when reading standard input.\n";
+			exit(-1);
+		}
+		OptHashSize = planHashSize(inputs);
+	}
 
 	// Configure hash table based on input table (on standard input)
 	// OptionsFromComments(cin);
@@ -306,35 +377,45 @@ int main(int argc, char *argv[]) {
 	// OptHashSize *= (OptHashSlicing*3)/2;  // Because size was read from one slice, and we plan
 	                                      // to read all slices, have to scale up.
   OligoHash oh(OptHashSize, 1, 0, // OptHashSlicing = 1, OptHashSlice = 0 ==> no slicing
-							 OptOligoLen);      // Using extra bits only for the count (six bits);
+							 OptOligoLen);      // Using extra bits only for the count (Info1, overflowing to oh.overflow);
 	                                // Also means this code works up to OligoLen=29 without change.
-	Allelic *side = (Allelic *) calloc(sizeof(Allelic), OptHashSize);
+	Allelic *side = (Allelic *) allocTable(sizeof(Allelic) * OptHashSize, 16, OptHashSlice);
+	oh.setGrowth(OptMaxLoad);
 
-	// Read in kmers from input table
+	// Read in kmers from input tables (standard input, if none are named)
 	OligoSeq::Oligo inmer;
 	Oligos::Index bitvector, total, index;
 	// const OligoSeq::Oligo KIDBITMASK = ((~0ULL) >> (8*sizeof(Oligos::Index) - NKIDS));
-	for (inmer = readKmerRecord(cin, total, bitvector);
-			 total;  // zero total from readKmerRecord means EOF
-			 inmer = readKmerRecord(cin, total, bitvector)) {
+	for (unsigned f = 0; f == 0 || f < inputs.size(); f++) {
+		istream *in = inputs.empty() ? &cin : new OligoInput(inputs[f].c_str());
+		for (inmer = readKmerRecord(*in, total, bitvector);
+				 total;  // zero total from readKmerRecord means EOF
+				 inmer = readKmerRecord(*in, total, bitvector)) {
 
-		if (total > 1) {             // ignore the total flukes
-			
-			if ((oh.insert(inmer, total) == OligoHash::MISSING) &&
-					(oh.lookuploc(inmer, index) == OligoHash::FOUND)) {
-				side[index].inLibs = bitvector;
-			}
-			else {
-				// Should have been missing until we inserted it, then found when looking again!
-				cerr << "Failed to insert or find again " << hex << inmer << dec << endl;
-				exit(-1);
-			}
-			if (debugging("h") && !(inmer % 999983)) {
-				cerr << "Inserted " << hex << inmer << " with total " << total 
-						 << " and bit vector " << side[index].inLibs
-						 << dec << endl;
+			if (total > 1) {             // ignore the total flukes
+				
+				if ((oh.insert(inmer, total) == OligoHash::MISSING) &&
+						(oh.lookuploc(inmer, index) == OligoHash::FOUND)) {
+					side[index].inLibs = bitvector;
+				}
+				else {
+					// Should have been missing until we inserted it, then found when looking again!
+					cerr << "Failed to insert or find again " << hex << inmer << dec << endl;
+					exit(-1);
+				}
+				if (debugging("h") && !(inmer % 999983)) {
+					cerr << "Inserted " << hex << inmer << " with total " << total 
+							 << " and bit vector " << side[index].inLibs
+							 << dec << endl;
+				}
+				if (oh.overloaded()) {
+					oh.grow(side);
+				}
 			}
 		}
+		if (in != &cin) {
+			delete in;
+		}
 	}
 
 	// Now iterate throught the hash, finding partners
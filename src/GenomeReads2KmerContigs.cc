@@ -3,7 +3,8 @@
 #include "getprime.hh"
 #include <string>
 #include "debugging.hh"
-#include "gzstream.h"
+#include "OligoInput.hh"
+#include "OligoOutput.hh"
 #include <iomanip>
 #include <cctype>
 #include <cstdio>
@@ -15,6 +16,28 @@ const unsigned NKIDS = 10;
 //       map you in the specified way (where "Transverse" means the 
 //       transversion that isn't to a complementary base)
 const unsigned short NoMate = 0, Transverse = 1, Transit = 2, Complement = 3;
+// Where a kmer is in the kmer contigs: all that is looked at for each
+// kmer of each read, packed in 8 bytes (the table's hot side array).
+class ContigPlace
+{
+public:
+	ContigPlace() :
+		contig(0),
+		inFwd(0)
+  {
+  }
+	void print(ostream &o) {
+		o << dec << "side: " << contig << ":" << contigPos << ":" << contigFlip << " ";
+	}
+	// Mapping to contig
+	Oligos::Index32 contig:      32; // Index of containing kmers contig or scaffold
+	Oligos::Index32 contigPos:   30; // Starting base position (1-based) within containing contig or scaffold
+	Oligos::Index32 contigFlip:   1; // 0 if same strand sense as contig, 1 if opposite
+	Oligos::Index32 inFwd:        1; // Used in read processing only
+}; // total bits: 64
+
+// The rest of what is known about a kmer, used while loading the kmer
+// contigs (the table's cold side array).
 class Allelic
 {
 public:
@@ -24,8 +47,6 @@ public:
 		pos(0),
 		xormask(NoMate),
 		flip(0),
-		inFwd(0),
-		contig(0),
 		upDist(0),
 		dnDist(0),
 		upFuzzy(0),
@@ -33,24 +54,18 @@ public:
   {
   }
 	void print(ostream &o) {
-		o << dec << "side: " << contig << ":" << contigPos << ":" << contigFlip << " "
-			<< hex << inLibs << " " 
+		o << hex << inLibs << " " 
 			<< partnered << ":" << pos << ":" << xormask << ":" << flip << " "
 			<< endl;
 	}
-	// Mapping to contig
-	Oligos::Index32 contig;          // Index of containing kmers contig or scaffold
-	Oligos::Index32 contigPos:   30; // Starting base position (1-based) within containing contig or scaffold
-	Oligos::Index32 contigFlip:   1; // 0 if same strand sense as contig, 1 if opposite
 	// Oligos::Index32 count:				10;     // Total count of k-mer in all parents & offspring
   Oligos::Index32 inLibs: (NKIDS+2); // 00 = neither, 11 = both, etc. (ignore kmers not in any offspring)
   Oligos::Index32 partnered:    1; // 1 means unambiguous partner found; 0 is usually confirmed 
 	                                 //    nonpolymorphic, for which next three SNP fields are undefined
-  Oligos::Index32 pos:          5; // offset of SNP base within kmer, 0..31
+  Oligos::Index32 pos:          6; // offset of SNP base within kmer, 0..63
   Oligos::Index32 xormask:      2; // mask for SNP base (see Transverse/Transit/Complement above);
                                    //      0=NoMate => no partner kmer found => nonpolymorphic k-locus
   Oligos::Index32 flip:         1; // set if allelic partner kmer is in table RC relative to this kmer
-	Oligos::Index32 inFwd:       1; // Used in read processing only
 	// links to upstream and downstream kmers in this contig (note that up & down are relative to kmer, not contig head/tail)
 	Oligos::Index32 upDist : 7;       // upstream offset distance to prev kmer (gapsize + kmer length)
 	Oligos::Index32 upFlip : 1;      // opposite sense? no=0 or yes=1
@@ -60,9 +75,9 @@ public:
 	Oligos::Index32 dnFuzzy : 1;   // fuzzy because only in terms of templates? no=exact b/c of reads=0, yes=fuzzy=1
 	Oligos::Index32 up;
 	Oligos::Index32 down;
-}; // total bits: 32 (22, plus 10-bit count)
+};
 
-typedef OligoHash<Allelic> OligoHashPlus;
+typedef OligoHash<ContigPlace, Allelic> OligoHashPlus;
 
 class Contig {
 public:
@@ -108,6 +123,7 @@ public:
 };
 
 string OptKmerContigs;
+string OptOutFile;
 Oligos::Index32 OptNkmerContigs;
 Oligos::Index32 OptOligoLen;
 Oligos::Index32 OptInfo1Len;
@@ -119,14 +135,25 @@ string OptDebug;
 
 Debugging debug;
 
+OligoOutput Out;  // the read links, to OptOutFile
+
 void PrintOptions() {
   cerr << "Option values are:\n"<<
-    "   -o {OligoLen}    ["<< OptOligoLen << "] Length of oligos (typically in 16..32).\n" <<
+    "   -o {OligoLen}    ["<< OptOligoLen << "] Length of oligos (typically in 16..32;\n" <<
+    "                                       over 31 runs GenomeReads2KmerContigsWide, with 128-bit kmers).\n" <<
     "   -H {HashSize}    ["<< OptHashSize    <<"] Number of cells in hash table (can choose based on InputTable).\n" <<
+		"   -N {MemPolicy}   ["<< tablePolicy().spec <<"] Allocate big tables as this comma-separated list says: huge\n" <<
+		"                                       (transparent huge pages), huge2m or huge1g (reserved huge pages),\n" <<
+		"                                       interleave (across NUMA nodes) or bind (to node Slice % nodes), and\n" <<
+		"                                       touch=N (zero them with N threads); see OligoMemory.hh.\n" <<
 		"   -S {Slicing[:Slice]} [" << OptHashSlicing << ":" << OptHashSlice << "] Slicing factor and slice for unpartnered kmers.\n" <<
+		"   -R               ["<< mixedSlicing() <<"] Slice by a mixed hash of each kmer, not kmer % Slicing: evener slices, but\n" <<
+		"                                       every tool run on the same tables must be given -R too (see OligoSlice.hh).\n" <<
     "   -x {SoftMasking} ["<< OptSoftMasking <<"] Treat lowercase as masked?\n" <<
 		"   -c {KmerContigs} ["<< OptKmerContigs <<"] File with contigs/scaffolds as lists of kmers (or paired SNPmers)\n" <<
 		"   -n {nKmerContigs} ["<< OptNkmerContigs << "] Numberof kmer contigs, including singleton kmers not in -c KmerContigs file\n" <<
+		"   -O {OutFile}     ["<< OptOutFile <<"] Write the read links here ('-' for standard output), compressed\n" <<
+		"                                       (BGZF, on a pool of threads) if the name ends in .gz.\n" <<
     "   -h               Print help information.\n" <<
     "   -d {DebugString} ["<< OptDebug <<"] Each character indicates a debugging option to turn on;\n" <<
     "                                       '+' indicates turn on all debugging.\n" <<
@@ -188,6 +215,7 @@ int SetupOptions(int argc, char**argv)
   OptSoftMasking = false;     // -x
 	OptKmerContigs = "";        // -c <string>
 	OptNkmerContigs = 0;        // -n <integer>
+	OptOutFile     = "-";       // -O <filename>
   OptDebug = "";              // 'd'
 
   // Handle the options...
@@ -201,6 +229,13 @@ int SetupOptions(int argc, char**argv)
       case 'o':
         OptOligoLen = strtol(argv[++i], NULL, 0);
         break;
+      case 'N':
+				if (! tablePolicy().parse(argv[++i])) {
+					PrintOptions();
+					cerr << "Argument error: -N " << argv[i] << "; MemPolicy words are huge, huge2m, huge1g, interleave, bind and touch=N.\n";
+					exit(-1);
+				}
+				break;
       case 'H': {
 				OptHashSize = strtoll(argv[++i], NULL, 0); 
 				prime = get_prime(OptHashSize);
@@ -211,6 +246,9 @@ int SetupOptions(int argc, char**argv)
 				}
       }
 				break;
+      case 'R':
+        mixedSlicing() = true;
+        break;
       case 'S':
         parseSlicing(argv[++i]); // sets OptHashSlicing and OptHashSlice
         break;
@@ -218,6 +256,8 @@ int SetupOptions(int argc, char**argv)
         OptSoftMasking = true; break;
 			case 'c':
 				OptKmerContigs = argv[++i]; break;
+      case 'O':
+				OptOutFile = argv[++i]; break;
       case 'n':
 				OptNkmerContigs = strtoll(argv[++i], NULL, 0); 
 				break;
@@ -240,6 +280,13 @@ int SetupOptions(int argc, char**argv)
 		}
   }
  EndOptions:
+  runWide(argv, OptOligoLen);
+  if (OptOligoLen < 1 || OptOligoLen > Oligos::MAXLENGTH) {
+    PrintOptions();
+    cerr << "Argument error: -o " << OptOligoLen << "; OligoLen must be in [1.."
+         << Oligos::WIDEMAXLENGTH << "].\n";
+    exit(-1);
+  }
   // if (debug.check('o')) 
 		PrintOptions();
   return i;
@@ -267,7 +314,8 @@ inline void add_to_contig(OligoHashPlus &oh,
 													Oligos::Index32 c_id,
 													Oligos::Index32 k_id)
 {
-	Allelic *kp = &(oh.side[k_id]);
+	ContigPlace *kp = &(oh.side[k_id]);
+	Allelic     *kc = &(oh.cold[k_id]);
 	kp->contig = c_id;
 	max_contig = c_id;
 	Contig *cp = &(contigs[c_id]);
@@ -282,24 +330,24 @@ inline void add_to_contig(OligoHashPlus &oh,
 		unsigned distance    = kp->contigPos - oh.side[prev].contigPos;
 		unsigned diff_strand = (cp->flip_last != kp->contigFlip);
 		if (cp->flip_last) {
-			oh.side[prev].upDist = distance;
-			oh.side[prev].up     = k_id;
-			oh.side[prev].upFlip = diff_strand;
+			oh.cold[prev].upDist = distance;
+			oh.cold[prev].up     = k_id;
+			oh.cold[prev].upFlip = diff_strand;
 		}
 		else {
-			oh.side[prev].dnDist = distance;
-			oh.side[prev].down   = k_id;
-			oh.side[prev].dnFlip = diff_strand;
+			oh.cold[prev].dnDist = distance;
+			oh.cold[prev].down   = k_id;
+			oh.cold[prev].dnFlip = diff_strand;
 		}
 		if (kp->contigFlip) {
-			kp->dnDist = distance;
-			kp->down   = prev;
-			kp->dnFlip = diff_strand;
+			kc->dnDist = distance;
+			kc->down   = prev;
+			kc->dnFlip = diff_strand;
 		}
 		else {
-			kp->upDist = distance;
-			kp->up     = prev;
-			kp->upFlip = diff_strand;
+			kc->upDist = distance;
+			kc->up     = prev;
+			kc->upFlip = diff_strand;
 		}
 		cp->klast     = k_id;
 		cp->flip_last = kp->contigFlip;
@@ -311,7 +359,7 @@ void inputKmerContigs(OligoHashPlus &oh,
 											Contig *contigs)
 {
   // Read in kmers from input table
-  igzstream inKc(OptKmerContigs.c_str());
+  OligoInput inKc(OptKmerContigs.c_str());
 
 	OligoSeq::Oligo kmer;
 	char buf[BUFSIZE];
@@ -327,7 +375,7 @@ void inputKmerContigs(OligoHashPlus &oh,
 		Oligos::Index32 cPosn;   // Contig position of kmer locus
 		unsigned cFlip;          // Strand of kmer locus (1 = bottom, opposite from contig)
 		char type;
-		parsed = sscanf(buf, "%c %u %u %lx %x %x %u %u %u %lx %x %x", 
+		parsed = scanOligos(buf, "%c %u %u %K %x %x %u %u %u %K %x %x", 
 										&type, // kmer or SNPmer type (ignore, redundant with the bitvector information)
 										&cPosn, &cFlip, // kmer mapping to contig
 										&kmer1, &count1, &bits1, // kmer, count, & bit vector information for only or representative allele
@@ -339,20 +387,20 @@ void inputKmerContigs(OligoHashPlus &oh,
 			// Need not check kmer normalization because that rule is universal for OligoHash implementation & saved files
 			//   -- (except for saved files tied to reads, in which case kmer in read is first)
 			index1 = insertOrDie(oh, kmer1, count1);
-			oh.side[index1].inLibs = bits1;
-			oh.side[index1].partnered = 1;
-			oh.side[index1].pos = pos;
-			oh.side[index1].xormask = xormask;
-			oh.side[index1].flip = flip;
+			oh.cold[index1].inLibs = bits1;
+			oh.cold[index1].partnered = 1;
+			oh.cold[index1].pos = pos;
+			oh.cold[index1].xormask = xormask;
+			oh.cold[index1].flip = flip;
 			oh.side[index1].contigPos  = cPosn;
 			oh.side[index1].contigFlip = cFlip;
 			// index2 = insertOrDie(oh, kmer2, total2);
-			// oh.side[index2].inLibs = bits2;
-			// oh.side[index2].unambiguous = 1;
-			// oh.side[index2].partnered = 1;
-			// oh.side[index2].pos = (flip? oh.Length + 1 - pos : pos);
-			// oh.side[index2].xormask = xormask; // unchanged by flip
-			// oh.side[index2].flip = flip;
+			// oh.cold[index2].inLibs = bits2;
+			// oh.cold[index2].unambiguous = 1;
+			// oh.cold[index2].partnered = 1;
+			// oh.cold[index2].pos = (flip? oh.Length + 1 - pos : pos);
+			// oh.cold[index2].xormask = xormask; // unchanged by flip
+			// oh.cold[index2].flip = flip;
 			if (debug.check('i') && !(kmer1 % 999983)) {
 				cerr << "Inserting partners " << oh.Bases(kmer1) << " & " ;
 				cerr << oh.Bases(kmer2);
@@ -363,8 +411,8 @@ void inputKmerContigs(OligoHashPlus &oh,
 		else if (6 == parsed) {
 			// it's an unpartnered kmer (nonpolymorphic)
 			index1 = insertOrDie(oh, kmer1, count1);
-			oh.side[index1].inLibs = bits1;
-			oh.side[index1].partnered = 0;
+			oh.cold[index1].inLibs = bits1;
+			oh.cold[index1].partnered = 0;
 			oh.side[index1].contigPos  = cPosn;
 			oh.side[index1].contigFlip = cFlip;
 			if (debug.check('i') && !(kmer1 % 999983)) {
@@ -421,9 +469,9 @@ inline Oligos::Index repIndex(OligoHashPlus oh,
 															unsigned &oppstrand) { // can be updated if w_rep kmer not the same as w_norm
   OligoSeq::Index wi;      // to get original kmer's index
   if (oh.lookuploc(w_norm, wi) == OligoHashPlus::FOUND) {
-    if (oh.side[wi].partnered) {
+    if (oh.cold[wi].partnered) {
       OligoSeq::Index pi;               // kmer partner's index
-      OligoSeq::Oligo perturb = mutate(w_norm, oh.side[wi].xormask, oh.Length - oh.side[wi].pos);
+      OligoSeq::Oligo perturb = mutate(w_norm, oh.cold[wi].xormask, oh.Length - oh.cold[wi].pos);
       OligoSeq::Oligo partner = oh.Normalize(perturb);
       if (oh.lookuploc(partner, pi) != OligoHashPlus::FOUND) {
         cerr << "Failed to find partner " << hex << partner << " of " << w_norm << endl;
@@ -440,7 +488,7 @@ inline Oligos::Index repIndex(OligoHashPlus oh,
     }
     else {
       // not partnered
-      // if (oh.side[wi].unambiguous)
+      // if (oh.cold[wi].unambiguous)
 			return wi; // unpartnered => representative index is its own
       // else
 			// return NULLINDEX; // don't bother with ambiguously pairable kmers
@@ -499,7 +547,7 @@ inline KRecordType nextReadKmerID(istream &in,
 		unsigned pos, xormask, flip;
 
 		char type;
-		parsed = sscanf(buf, "%c %u %u %lx %x %x %u %u %u %lx %x %x", 
+		parsed = scanOligos(buf, "%c %u %u %K %x %x %u %u %u %K %x %x", 
 										&type, // kmer or SNPmer type (ignore, redundant with the bitvector information)
 										&rPosn, &rFlip, // kmer mapping to contig
 										&kmer1, &count1, &bits1, // kmer, count, & bit vector information for only or representative allele
@@ -647,16 +695,16 @@ inline void processKmerDiags(string &prID,
 	// unmated: (minFwd,maxFwd)                   <- even if the read was actually a reverse read
 	for (unsigned i = 0; i < dvec.size(); i++) {
 		Oligos::Index32 cID = dvec[i].contigID;
-		cout << dec
+		Out << dec
 				 << cID << "\t"
 				 << prID << dec << '('
 				 << (maxFwdPos == 0? 0 : minFwdPos) << ',' << maxFwdPos;
 		if (maxRevPos > 0) {
-			cout << (matesOL ? ':' : ';')
+			Out << (matesOL ? ':' : ';')
 					 << minRevPos << ',' << maxRevPos;
 		}
-		cout << ')';
-		cout << dvec[i].diag << ":"
+		Out << ')';
+		Out << dvec[i].diag << ":"
 				 << (dvec[i].anti ? '-' : '+') 
 				 << (dvec[i].revmate ? 'r' : 'f')
 				 << '['
@@ -667,17 +715,17 @@ inline void processKmerDiags(string &prID,
 				 << '#'
 				 << ((int) (dvec[i].nKmers));
 		if (snpF.size() + snpR.size()) {
-			cout << '(';
+			Out << '(';
 			for (unsigned jf = 0; jf < snpF.size(); jf++) {
-				cout << hex << snpF[jf] << ',';
+				Out << hex << snpF[jf] << ',';
 			}
-			cout << ';';
+			Out << ';';
 			for (unsigned jr = 0; jr < snpR.size(); jr++) {
-				cout << hex << snpR[jr] << ',';
+				Out << hex << snpR[jr] << ',';
 			}
-			cout << ')';
+			Out << ')';
 		}
-		cout << dec << endl;
+		Out << dec << endl;
 	}
 }
 
@@ -686,10 +734,16 @@ int main(int argc, char *argv[]) {
 	const OligoSeq::Index p7bit = 1 << NKIDS;
 
   int firstNonOption = SetupOptions(argc, argv);
+	Out.open(OptOutFile.c_str());
+	if (! Out) {
+		cerr << "Can't write " << OptOutFile << endl;
+		exit(-1);
+	}
 
   if (1) { // debug.check('s')) {
     cerr << "sizes: Oligo(" << sizeof(Oligos::Oligo) 
          << "), Index(" << sizeof(Oligos::Index)
+         << "), ContigPlace(" << sizeof(ContigPlace)
          << "), Allelic(" << sizeof(Allelic) 
          << ")" << endl << flush;
   }
@@ -724,7 +778,7 @@ int main(int argc, char *argv[]) {
     }
     else {
       cerr << "Opening read-kmers file " << argv[filearg] << endl;
-			igzstream inreads(argv[filearg]);
+			OligoInput inreads(argv[filearg]);
 
 			string prev_rID = "";
 			string rID = "";
@@ -796,10 +850,11 @@ int main(int argc, char *argv[]) {
 			snpR.clear();
 
       cerr << "done with " << argv[filearg] << endl;
-      cout << "# Complete for " << argv[filearg] << endl;
+      Out << "# Complete for " << argv[filearg] << endl;
       inreads.close();
     }
   }
 
+  Out.close();
   exit(0);
 }
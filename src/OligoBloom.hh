@@ -0,0 +1,103 @@
+///////////////////////////////////////////////////////////////////////////////
+// OligoTools
+// = OligoTools for genome analysis
+// by Paul Havlak
+// copyright 2009-2013 Rice University
+//
+// OligoTools for genome analysis by Paul Havlak is licensed under a 
+// <a rel="license" href="http://creativecommons.org/licenses/by/3.0/deed.en_US">
+// Creative Commons Attribution 3.0 Unported License.
+// </a>
+//
+// OligoTools for genome analysis incorporates unpublished modules for Kmer 
+// hash tables originally developed under the Atlas Project 
+// (Atlas Whole Genome Assembly Suite) at Baylor College of Medicine
+// Human Genome Sequencing Center during 2003-2006.
+// The BCM-HGSC copyrighted predecessor is available through the 
+// Atlas WGA Suite source distribution on the HGSC web site:
+//    http://www.hgsc.bcm.tmc.edu/content/atlas-whole-genome-assembly-suite
+// 
+// Extensive modifications and additional modules, including all features
+// for SNPmer pairing and library bitvectors, were developed in the Putnam
+// Lab at Rice University:
+//    http://nputnam.web.rice.edu
+// 
+// Open-source repository: part of the Putnam Lab JAM project
+//    https://github.com/putnamlab/jam-pipeline
+//    https://github.com/putnamlab/jam-pipeline/tree/master/source
+//     
+// Contact: Paul Havlak:
+//    havlak@rice.edu
+//    havlak@alumni.rice.edu
+//    http://www.linkedin.com/in/havlak
+///////////////////////////////////////////////////////////////////////////////
+// A Bloom filter of kmers.
+//
+// OligoHash can purge the kmers it has counted only once, to make room
+// for more (see purgeSingletons).  Recording the purged kmers in an
+// OligoBloom lets a later sighting of one of them be credited as its
+// second, at the cost of a few false positives: kmers seen once that are
+// counted twice, about (1 - e^(-HASHES*n/bits))^HASHES of those checked
+// after n kmers are added, e.g. 2% at 8 bits per kmer.
+//
+
+#ifndef DEFINED_OLIGOBLOOM
+#define DEFINED_OLIGOBLOOM 1
+#include "Oligos.hh"
+#include <stdlib.h>
+#include <iostream>
+
+using namespace std;
+
+class OligoBloom {
+public:
+  typedef Oligos::Oligo Oligo;
+  typedef Oligos::Index64 Index64;
+  static const unsigned HASHES = 4;
+
+  const Index64 Bits;     // a multiple of 64
+  Index64 added;
+protected:
+  Index64 *bits;
+
+  // Two independent 64-bit hashes of a kmer (splitmix64 finalizers), from
+  // which the HASHES bit positions are derived as h1 + i*h2.
+  static inline Index64 mix(Index64 z) {
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+  }
+public:
+  OligoBloom(Index64 nbits) :
+    Bits((nbits + 63) & ~63ULL),
+    added(0),
+    bits((Index64 *) calloc(sizeof(Index64), (nbits + 63) / 64))
+    {
+      if (! bits) {
+        cerr << "OligoBloom failed to allocate " << Bits << " bits." << endl;
+        exit(-1);
+      }
+    }
+
+  void add(Oligo kmer) {
+    Index64 key = Oligos::fold(kmer);
+    Index64 h1 = mix(key), h2 = mix(key ^ 0x9E3779B97F4A7C15ULL) | 1;
+    for (unsigned i = 0; i < HASHES; i++, h1 += h2) {
+      Index64 b = h1 % Bits;
+      bits[b >> 6] |= 1ULL << (b & 63);
+    }
+    added++;
+  }
+  bool contains(Oligo kmer) const {
+    Index64 key = Oligos::fold(kmer);
+    Index64 h1 = mix(key), h2 = mix(key ^ 0x9E3779B97F4A7C15ULL) | 1;
+    for (unsigned i = 0; i < HASHES; i++, h1 += h2) {
+      Index64 b = h1 % Bits;
+      if (! (bits[b >> 6] & (1ULL << (b & 63)))) {
+        return false;
+      }
+    }
+    return true;
+  }
+};
+#endif
@@ -0,0 +1,127 @@
+///////////////////////////////////////////////////////////////////////////////
+// OligoTools
+// = OligoTools for genome analysis
+// by Paul Havlak
+// copyright 2009-2013 Rice University
+//
+// OligoTools for genome analysis by Paul Havlak is licensed under a 
+// <a rel="license" href="http://creativecommons.org/licenses/by/3.0/deed.en_US">
+// Creative Commons Attribution 3.0 Unported License.
+// </a>
+//
+// OligoTools for genome analysis incorporates unpublished modules for Kmer 
+// hash tables originally developed under the Atlas Project 
+// (Atlas Whole Genome Assembly Suite) at Baylor College of Medicine
+// Human Genome Sequencing Center during 2003-2006.
+// The BCM-HGSC copyrighted predecessor is available through the 
+// Atlas WGA Suite source distribution on the HGSC web site:
+//    http://www.hgsc.bcm.tmc.edu/content/atlas-whole-genome-assembly-suite
+// 
+// Extensive modifications and additional modules, including all features
+// for SNPmer pairing and library bitvectors, were developed in the Putnam
+// Lab at Rice University:
+//    http://nputnam.web.rice.edu
+// 
+// Open-source repository: part of the Putnam Lab JAM project
+//    https://github.com/putnamlab/jam-pipeline
+//    https://github.com/putnamlab/jam-pipeline/tree/master/source
+//     
+// Contact: Paul Havlak:
+//    havlak@rice.edu
+//    havlak@alumni.rice.edu
+//    http://www.linkedin.com/in/havlak
+///////////////////////////////////////////////////////////////////////////////
+// Cache-line buckets for OligoHash.
+//
+// Compiled with -DOLIGOHASH_BUCKETS, OligoHash groups its cells into
+// buckets of OLIGOBUCKET cells, 64 bytes (one cache line) each.  A kmer's
+// home is a bucket rather than a cell, cells within a bucket fill in
+// order, and double hashing steps from bucket to bucket, so that most
+// lookups cost one cache miss.  bucketScan checks all the cells of a
+// bucket at once, with AVX2 or SSE4.1 compares when the compiler is
+// allowed to use them (e.g. -mavx2), else with a plain loop.
+//
+// Without OLIGOHASH_BUCKETS, OLIGOBUCKET is 1 (cell by cell probing), and
+// is recorded as such in table snapshots.  Wide (128-bit) cells make
+// buckets of 4, always scanned with the plain loop.
+//
+
+#ifndef DEFINED_OLIGOBUCKET
+#define DEFINED_OLIGOBUCKET 1
+#include "Oligos.hh"
+#include "OligoMemory.hh"
+#include <stdlib.h>
+#include <string.h>
+#if defined(OLIGOHASH_BUCKETS) && ! defined(OLIGO_WIDE) && (defined(__AVX2__) || defined(__SSE4_1__))
+#define OLIGOBUCKET_SIMD 1
+#include <immintrin.h>
+#endif
+
+#ifdef OLIGOHASH_BUCKETS
+const unsigned OLIGOBUCKET = 64 / sizeof(Oligos::Oligo);  // cells per 64-byte bucket
+#else
+const unsigned OLIGOBUCKET = 1;
+#endif
+
+// Bit i of the result is set if cell i of the bucket holds key (in its
+// oligo bits); bit i of empty is set if cell i is empty.  Since an empty
+// cell also has zero oligo bits, empty cells never count as matches.
+// Callers only rely on the lowest bits: the first match, and the empty
+// cells from the first one on.
+inline unsigned bucketScan(const Oligos::Oligo *bucket, Oligos::Oligo key,
+                           Oligos::Oligo valMask, unsigned &empty) {
+#if defined(OLIGOBUCKET_SIMD) && defined(__AVX2__)
+  const __m256i k = _mm256_set1_epi64x(key);
+  const __m256i m = _mm256_set1_epi64x(valMask);
+  const __m256i z = _mm256_setzero_si256();
+  __m256i lo = _mm256_load_si256((const __m256i *) bucket);
+  __m256i hi = _mm256_load_si256((const __m256i *) (bucket + 4));
+  empty = (_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(lo, z)))
+           | (_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(hi, z))) << 4));
+  unsigned found =
+    (_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(_mm256_and_si256(lo, m), k)))
+     | (_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(_mm256_and_si256(hi, m), k))) << 4));
+  return found & ~empty;
+#elif defined(OLIGOBUCKET_SIMD) && defined(__SSE4_1__)
+  const __m128i k = _mm_set1_epi64x(key);
+  const __m128i m = _mm_set1_epi64x(valMask);
+  const __m128i z = _mm_setzero_si128();
+  unsigned found = 0;
+  empty = 0;
+  for (unsigned i = 0; i < OLIGOBUCKET; i += 2) {
+    __m128i v = _mm_load_si128((const __m128i *) (bucket + i));
+    empty |= _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(v, z))) << i;
+    found |= _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(_mm_and_si128(v, m), k))) << i;
+  }
+  return found & ~empty;
+#else
+  // Cells of a bucket fill in order, so a plain loop can stop at the first
+  // match or empty cell (all cells after an empty one are empty too);
+  // that beats building both masks cell by cell.
+  for (unsigned i = 0; i < OLIGOBUCKET; i++) {
+#ifdef OLIGO_WIDE
+    Oligos::Oligo cell = Oligos::readCell(bucket + i);  // (threads may be inserting)
+#else
+    Oligos::Oligo cell = bucket[i];
+#endif
+    if (! cell) {
+      empty = (~0U << i) & ((1U << OLIGOBUCKET) - 1);
+      return 0;
+    }
+    if ((cell & valMask) == key) {
+      empty = 0;
+      return 1U << i;
+    }
+  }
+  empty = 0;
+  return 0;
+#endif
+}
+
+// Zeroed cells for a table of the given slice, aligned so that buckets
+// are cache lines; free with freeTable.
+inline Oligos::Oligo *allocCells(size_t n, size_t slice = 0) {
+  return (Oligos::Oligo *) allocTable(n * sizeof(Oligos::Oligo),
+                                      OLIGOBUCKET > 1 ? 64 : 16, slice);
+}
+#endif
@@ -76,14 +76,14 @@ public:
   OligoCells(Index tLength, Index tInfo2Len = 0, Index tInfo3Len = 0): // 1 or 2 added fields
     Oligos(tLength),
     Info1Len(BitsUnused - (tInfo2Len + tInfo3Len)),
-    Info1Shift(64 - Info1Len),
-    Info1Mask(~0ULL >> (OLIGOBITS - Info1Len)),
+    Info1Shift(OLIGOBITS - Info1Len),
+    Info1Mask(~((Oligo) 0) >> (OLIGOBITS - Info1Len)),
     Info2Len(tInfo2Len),
-    Info2Shift(64 - (Info1Len + Info2Len)),
-    Info2Mask(~0ULL >> (OLIGOBITS - Info2Len)),
+    Info2Shift(OLIGOBITS - (Info1Len + Info2Len)),
+    Info2Mask(~((Oligo) 0) >> (OLIGOBITS - Info2Len)),
     Info3Len(tInfo3Len),
-    Info3Shift(64 - BitsUnused),
-    Info3Mask(~0ULL >> (OLIGOBITS - Info3Len))
+    Info3Shift(OLIGOBITS - BitsUnused),
+    Info3Mask(~((Oligo) 0) >> (OLIGOBITS - Info3Len))
   { }
 
   inline Index getInfo1(Oligo w) {
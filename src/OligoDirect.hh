@@ -0,0 +1,185 @@
+///////////////////////////////////////////////////////////////////////////////
+// OligoTools
+// = OligoTools for genome analysis
+// by Paul Havlak
+// copyright 2009-2013 Rice University
+//
+// OligoTools for genome analysis by Paul Havlak is licensed under a 
+// <a rel="license" href="http://creativecommons.org/licenses/by/3.0/deed.en_US">
+// Creative Commons Attribution 3.0 Unported License.
+// </a>
+//
+// OligoTools for genome analysis incorporates unpublished modules for Kmer 
+// hash tables originally developed under the Atlas Project 
+// (Atlas Whole Genome Assembly Suite) at Baylor College of Medicine
+// Human Genome Sequencing Center during 2003-2006.
+// The BCM-HGSC copyrighted predecessor is available through the 
+// Atlas WGA Suite source distribution on the HGSC web site:
+//    http://www.hgsc.bcm.tmc.edu/content/atlas-whole-genome-assembly-suite
+// 
+// Extensive modifications and additional modules, including all features
+// for SNPmer pairing and library bitvectors, were developed in the Putnam
+// Lab at Rice University:
+//    http://nputnam.web.rice.edu
+// 
+// Open-source repository: part of the Putnam Lab JAM project
+//    https://github.com/putnamlab/jam-pipeline
+//    https://github.com/putnamlab/jam-pipeline/tree/master/source
+//     
+// Contact: Paul Havlak:
+//    havlak@rice.edu
+//    havlak@alumni.rice.edu
+//    http://www.linkedin.com/in/havlak
+///////////////////////////////////////////////////////////////////////////////
+// OligoDirectTable: a kmer table with a cell for every possible kmer.
+//
+// For short kmers a table needs no hashing at all.  An odd-length kmer is
+// never its own reverse complement, and of the two strands exactly one has
+// A or C (0 or 1, high bit clear) for its middle base.  So each canonical
+// kmer has a rank in 0..4^k/2-1: take that strand and drop the high bit of
+// its middle base.  Counting a kmer is then one increment of the 32-bit
+// count at its rank, with no probing, no modulo and nothing to grow;
+// k=15 takes 2^29 counts (2 GB) plus the side array, k=13 1/16 of that.
+//
+// The interface follows OligoHash<T2> (OligoHashSide.hh) as far as
+// GenomeBVcount uses it: insertloc and insertlocAtomic, insertlocBatch,
+// prefetch, count, oligoAt, and a side array parallel to the counts
+// (hash, named as in OligoHash, with 0 for a kmer not seen).  A table
+// still holds just its slice's kmers, but its arrays cover every slice,
+// so the tables for all slices (GenomeBVcount -A) share one set of arrays:
+// see the slice constructor, and occupied().
+//
+
+#ifndef DEFINED_OLIGODIRECT
+#define DEFINED_OLIGODIRECT 1
+#include "Oligos.hh"
+#include "OligoSlice.hh"
+#include "OligoMemory.hh"
+#include <iostream>
+
+using namespace std;
+
+template<class T2> class OligoDirectTable: public Oligos {
+public:
+  typedef enum { FOUND, MISSING, SLICED, FULL } HashFlag;
+  static const Index MAXLENGTH = 15;
+  static const Index PREFETCHAHEAD = 16;
+  typedef unsigned int Count;   // 32 bits (Index32 is 64 without <climits>)
+  static const Count MAXCOUNT = 0xFFFFFFFFU;
+
+  const Index Size;        // 4^Length / 2, one cell per canonical kmer
+  const Index Slicing;
+  const Index Slice;
+  Count *hash;             // count of the kmer at each rank
+  T2 *side;
+  Index64 purged;          // always 0: nothing is ever purged
+protected:
+  const Index MidShift;    // bit position of the middle base
+  const Index64 LowMask;   // bits of a rank below the middle base's high bit
+public:
+  OligoDirectTable(Index tSlicing, Index tSlice, Index tLength) :
+    Oligos(tLength),
+    Size(1UL << (BASEBITS * tLength - 1)),
+    Slicing(tSlicing),
+    Slice(tSlice),
+    hash(0),
+    side(0),
+    purged(0),
+    MidShift(BASEBITS * (tLength / 2)),
+    LowMask((1ULL << (BASEBITS * (tLength / 2) + 1)) - 1)
+    {
+      if (! (tLength % 2) || tLength > MAXLENGTH) {
+        cerr << "OligoDirectTable needs an odd oligo length of at most " << MAXLENGTH
+             << ", not " << tLength << "." << endl;
+        exit(-1);
+      }
+      hash = (Count *) allocTable(sizeof(Count) * Size);
+      side = (T2 *) allocTable(sizeof(T2) * Size);
+      if (! (hash && side)) {
+        cerr << "OligoDirectTable failed to allocate for " << Size << " kmers." << endl;
+        exit(-1);
+      }
+    }
+  // Another slice's table, sharing whole's arrays
+  OligoDirectTable(const OligoDirectTable &whole, Index tSlice) :
+    Oligos(whole.Length),
+    Size(whole.Size),
+    Slicing(whole.Slicing),
+    Slice(tSlice),
+    hash(whole.hash),
+    side(whole.side),
+    purged(0),
+    MidShift(whole.MidShift),
+    LowMask(whole.LowMask)
+    { }
+
+  // Reverse complement, by reversing the bases of a whole 64-bit word at
+  // once (even when Oligos are wider)
+  inline Oligo revcomp(Oligo kmer) {
+    Index64 w = ~((Index64) kmer);
+    w = ((w >> 2) & 0x3333333333333333ULL) | ((w & 0x3333333333333333ULL) << 2);
+    w = ((w >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((w & 0x0F0F0F0F0F0F0F0FULL) << 4);
+    return __builtin_bswap64(w) >> (64 - BASEBITS * Length);
+  }
+  // Rank of a canonical kmer (either strand, in fact)
+  inline Index rankOf(Oligo w) {
+    if ((w >> MidShift) & 2) {
+      w = revcomp(w);
+    }
+    return ((w >> (MidShift + 2)) << (MidShift + 1)) | (w & LowMask);
+  }
+  // The canonical kmer of a rank
+  inline Oligo oligoAt(Index rank) {
+    Oligo w = ((((Oligo) rank) >> (MidShift + 1)) << (MidShift + 2)) | (rank & LowMask);
+    return min(w, revcomp(w));
+  }
+  inline bool inslice(Oligo w) {
+    return (Slicing == 1) || (sliceOf(w, Slicing) == Slice);
+  }
+  // Whether this slice has a kmer at a rank
+  inline bool occupied(Index rank) {
+    return hash[rank] && (Slicing == 1 || sliceOf(oligoAt(rank), Slicing) == Slice);
+  }
+  inline Index count(Index rank) {
+    return hash[rank];
+  }
+
+  inline void prefetch(Oligo key) {
+    Index rank = rankOf(key);
+    __builtin_prefetch(&hash[rank], 1);
+    __builtin_prefetch(&side[rank], 1);
+  }
+  inline HashFlag insertloc(Oligo key, Index &location) {
+    if (! inslice(key)) return SLICED;
+    location = rankOf(key);
+    Count &c = hash[location];
+    if (c == MAXCOUNT) return FOUND;
+    return (c++ ? FOUND : MISSING);
+  }
+  // For many threads inserting at once
+  inline HashFlag insertlocAtomic(Oligo key, Index &location) {
+    if (! inslice(key)) return SLICED;
+    location = rankOf(key);
+    return (__sync_fetch_and_add(&hash[location], 1) ? FOUND : MISSING);
+  }
+  // Insert n keys, prefetching ahead; all n are always done.
+  Index insertlocBatch(const Oligo *keys, Index n, Index *locations, HashFlag *flags) {
+    Index i;
+    for (i = 0; i < n && i < PREFETCHAHEAD; i++) {
+      prefetch(keys[i]);
+    }
+    for (i = 0; i < n; i++) {
+      if (i + PREFETCHAHEAD < n) {
+        prefetch(keys[i + PREFETCHAHEAD]);
+      }
+      flags[i] = insertloc(keys[i], locations[i]);
+    }
+    return n;
+  }
+
+  // Never overloaded; there is nothing to grow or purge.
+  inline bool overloaded() {
+    return false;
+  }
+};
+#endif
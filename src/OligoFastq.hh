@@ -0,0 +1,202 @@
+///////////////////////////////////////////////////////////////////////////////
+// OligoTools
+// = OligoTools for genome analysis
+// by Paul Havlak
+// copyright 2009-2013 Rice University
+//
+// OligoTools for genome analysis by Paul Havlak is licensed under a 
+// <a rel="license" href="http://creativecommons.org/licenses/by/3.0/deed.en_US">
+// Creative Commons Attribution 3.0 Unported License.
+// </a>
+//
+// OligoTools for genome analysis incorporates unpublished modules for Kmer 
+// hash tables originally developed under the Atlas Project 
+// (Atlas Whole Genome Assembly Suite) at Baylor College of Medicine
+// Human Genome Sequencing Center during 2003-2006.
+// The BCM-HGSC copyrighted predecessor is available through the 
+// Atlas WGA Suite source distribution on the HGSC web site:
+//    http://www.hgsc.bcm.tmc.edu/content/atlas-whole-genome-assembly-suite
+// 
+// Extensive modifications and additional modules, including all features
+// for SNPmer pairing and library bitvectors, were developed in the Putnam
+// Lab at Rice University:
+//    http://nputnam.web.rice.edu
+// 
+// Open-source repository: part of the Putnam Lab JAM project
+//    https://github.com/putnamlab/jam-pipeline
+//    https://github.com/putnamlab/jam-pipeline/tree/master/source
+//     
+// Contact: Paul Havlak:
+//    havlak@rice.edu
+//    havlak@alumni.rice.edu
+//    http://www.linkedin.com/in/havlak
+///////////////////////////////////////////////////////////////////////////////
+// FASTQ input, quality-masked on the fly into the masked FASTA that
+// scripts/fastq2fam.pl makes, so the tools can read FASTQ(.gz) directly:
+// OligoSeq puts a FastqFilter between itself and any input that starts
+// with '@'.  Each four-line read becomes a description line and a line
+// of bases in which, base by base, a quality below m is made 'N', one
+// below soft is lowercased, and any other is uppercased, quality
+// characters counting up from zq.  (Lowercase bases are masked only in
+// tools given -x, as with .fam input.)
+//
+// FastqMasking::parse (the -q option of the Genome* tools) takes
+// fastq2fam.pl's options as a comma-separated list:
+//
+//   m=N       hard-masking quality (-m)            [20]
+//   soft=N    soft-masking quality (-soft)         [30]
+//   zq=N      ASCII code of quality zero (-zq)     [33]
+//   pre=S     read name prefix (-p)
+//   suf=S     read name suffix (-suf)
+//   bnum=N    batch number (-bnum)                 [1]
+//   bs=N      batch size (-bs)                     [4000000]
+//   r=RE      pattern read headers must match after '@' (-r); unlike
+//             fastq2fam.pl, none by default
+//
+// With a prefix, suffix or batch past the first, read n (from 0) of a
+// file is renamed pre.NNNNNNNNN.suf, numbered from (bnum - 1) * bs, ahead
+// of its original header.  The same settings apply to every FASTQ file a
+// tool reads.
+//
+
+#ifndef DEFINED_OLIGOFASTQ
+#define DEFINED_OLIGOFASTQ 1
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <regex.h>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+class FastqMasking {
+public:
+  int minqual;
+  int softmask;
+  int zeroqual;
+  std::string prefix;
+  std::string suffix;
+  long long batch;
+  long long bsize;
+  std::string readpat;
+  std::string spec;       // as given to parse
+  regex_t pattern;        // ^(readpat), if there is one
+
+  FastqMasking() : minqual(20), softmask(30), zeroqual(33), batch(1), bsize(4000000),
+                   spec("default") { }
+
+  // Set the options from a comma-separated list of the words above;
+  // false if one isn't recognized.
+  bool parse(const std::string &words) {
+    std::stringstream in(words);
+    std::string word;
+    while (getline(in, word, ',')) {
+      size_t eq = word.find('=');
+      std::string key = word.substr(0, eq);
+      std::string value = (eq == std::string::npos) ? "" : word.substr(eq + 1);
+      if (key == "m") minqual = strtol(value.c_str(), NULL, 0);
+      else if (key == "soft") softmask = strtol(value.c_str(), NULL, 0);
+      else if (key == "zq") zeroqual = strtol(value.c_str(), NULL, 0);
+      else if (key == "pre") prefix = value;
+      else if (key == "suf") suffix = value;
+      else if (key == "bnum") batch = strtoll(value.c_str(), NULL, 0);
+      else if (key == "bs") bsize = strtoll(value.c_str(), NULL, 0);
+      else if (key == "r") {
+        if (readpat.length()) regfree(&pattern);
+        readpat = value;
+        if (readpat.length() &&
+            regcomp(&pattern, ("^(" + readpat + ")").c_str(), REG_EXTENDED | REG_NOSUB)) {
+          readpat.clear();
+          return false;
+        }
+      }
+      else if (word != "default") return false;
+    }
+    spec = words;
+    return true;
+  }
+  bool renames() const {
+    return prefix.length() || suffix.length() || (batch - 1) * bsize != 0;
+  }
+};
+
+// The settings for all FASTQ input; set them before reading any.
+inline FastqMasking &fastqMasking() {
+  static FastqMasking masking;
+  return masking;
+}
+
+// A streambuf reading FASTQ from in and giving masked FASTA, some reads
+// at a time.
+class FastqFilter : public std::streambuf {
+protected:
+  static const size_t CHUNK = 1 << 16;
+  std::istream *in;
+  const FastqMasking &masking;
+  long long nreads;
+  std::string out;
+  std::string descrip, bases, plus, quals;
+
+  // Append one read to out; false at the end of the input.
+  bool convert() {
+    if (! getline(*in, descrip)) return false;
+    if (descrip.empty() || descrip[0] != '@' || (masking.readpat.length() &&
+                              regexec(&masking.pattern, descrip.c_str() + 1, 0, NULL, 0))) {
+      std::cerr << "FASTQ read header doesn't match @(" << masking.readpat << "): "
+                << descrip << std::endl;
+      exit(-1);
+    }
+    nreads++;
+    out += '>';
+    if (masking.renames()) {
+      char id[64];
+      snprintf(id, sizeof(id), ".%09lld.", (masking.batch - 1) * masking.bsize + nreads - 1);
+      out += masking.prefix;
+      out += id;
+      out += masking.suffix;
+      out += ' ';
+    }
+    out.append(descrip, 1, std::string::npos);
+    out += '\n';
+    getline(*in, bases);
+    getline(*in, plus);
+    if (! getline(*in, quals)) {
+      return false;  // a read cut short is just its description
+    }
+    const int minq = masking.zeroqual + masking.minqual;
+    const int softm = masking.zeroqual + masking.softmask;
+    size_t n = (quals.length() < bases.length()) ? quals.length() : bases.length();
+    for (size_t i = 0; i < n; i++) {
+      char &b = bases[i];
+      int q = (unsigned char) quals[i];
+      if (q < minq) {
+        b = 'N';
+      }
+      else if (q < softm) {
+        if (b >= 'A' && b <= 'Z') b += 'a' - 'A';
+      }
+      else if (b >= 'a' && b <= 'z') {
+        b -= 'a' - 'A';
+      }
+    }
+    out += bases;
+    out += '\n';
+    return true;
+  }
+
+public:
+  FastqFilter(std::istream &t_in, const FastqMasking &m = fastqMasking()) :
+    in(&t_in), masking(m), nreads(0) { }
+
+  virtual int underflow() {
+    if (gptr() < egptr()) {
+      return traits_type::to_int_type(*gptr());
+    }
+    out.clear();
+    while (out.length() < CHUNK && convert()) { }
+    if (out.empty()) return traits_type::eof();
+    setg(&out[0], &out[0], &out[0] + out.length());
+    return traits_type::to_int_type(*gptr());
+  }
+};
+#endif
@@ -81,6 +81,38 @@ public:
     ngood++;
     return (ngood >= Length);
   }
+  // Advance over a run of n bases, given as 2-bit codes (A=0, C=1, G=2,
+  // T=3), putting each kmer completed in canon (normalized, as from
+  // current()) with strand set if that is the reverse complement (if
+  // rev() < fwd()).  Returns how many kmers; as every base after the
+  // first complete kmer completes another, they end at the last that many
+  // bases of the run.  Both strands are kept as advance() keeps them, one
+  // shift each per base, but with no per-base bookkeeping or branches, so
+  // the two chains and the min overlap from base to base.
+  inline int kmersForRun(const unsigned char *codes, int n,
+                         Oligo *canon, unsigned char *strand) {
+    const Index top = (OLIGOBITS - BASEBITS) - BitsUnused;
+    Oligo fw = f, rc = r, last = r;
+    int i = 0, m = 0;
+    for (; i < n && ngood + i + 1 < Length; i++) {
+      last = rc;
+      fw = ((fw << BASEBITS) | codes[i]) & ValMask;
+      rc = (rc >> BASEBITS) | ((Oligo) (BASEMASK ^ codes[i]) << top);
+    }
+    for (; i < n; i++, m++) {
+      last = rc;
+      fw = ((fw << BASEBITS) | codes[i]) & ValMask;
+      rc = (rc >> BASEBITS) | ((Oligo) (BASEMASK ^ codes[i]) << top);
+      unsigned char s = rc < fw;
+      canon[m] = s ? rc : fw;
+      strand[m] = s;
+    }
+    f = fw;
+    r = rc;
+    pred = (~last) & BASEMASK;
+    ngood += n;
+    return m;
+  }
   inline unsigned char shifted_out() {
     // Gives only the two bits coding for [ACGT]
     return pred;
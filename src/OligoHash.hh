@@ -25,6 +25,12 @@
 #include <stdlib.h>
 #include <iostream>
 #include <assert.h>
+#include <pthread.h>
+#include <vector>
+#include "getprime.hh"
+#include "OligoSnapshot.hh"
+#include "OligoBucket.hh"
+#include "OligoSlice.hh"
 
 using namespace std;
 
@@ -32,51 +38,89 @@ class OligoHash: public OligoCells {
 public:
   Index64 insertions;
   Index distinct;
-  Oligo *const hash;
-  const Index HashPct;
-  const Index Size;
+  Oligo *hash;    // reallocated if the table grows
+  OligoOverflow overflow;  // counts too big for Info1
+  Index HashPct;
+  Index Size;
   const Index Slicing;
   const Index Slice;
 protected:
   Index primes[13];
   const Index NstepPrimes;
+  double MaxLoad;      // grow when distinct kmers reach this fraction of Size;
+  Index GrowAt;        //   0 means never grow (FULL when out of cells)
+  bool Mapped;         // hash (and side) arrays are in a mapped snapshot, not allocTable'd
 public:
   typedef enum { FOUND, MISSING, SLICED, FULL } HashFlag;
 
   OligoHash(Index HashSize, Index HashSlicing, Index HashSlice,
 	    Index OligoLen, Index Info2Len = 0, Index Info3Len = 0) :
     OligoCells(OligoLen, Info2Len, Info3Len),
-    Size(HashSize),
-    HashPct(HashSize/100),
+    Size(tableSize(HashSize)),
+    HashPct(tableSize(HashSize)/100),
     Slicing(HashSlicing),
     Slice(HashSlice),
     // Could use C++ new, but not sure if that initializes to zero
-    hash((Oligo *) calloc(sizeof(Oligo), HashSize)),
+    hash(allocCells(tableSize(HashSize), HashSlice)),
     insertions(0),
     distinct(0),
     NstepPrimes((HashSlicing == (sizeof primes)/sizeof(Index) 
 		 ? (HashSlicing - 2)
-		 : (sizeof primes)/sizeof(Index)))
+		 : (sizeof primes)/sizeof(Index))),
+    MaxLoad(0),
+    GrowAt(0),
+    Mapped(false)
     {
-      // modulo 3 doesn't work well with powers of 4 (see Knuth)
-      assert(NstepPrimes != 3);
-      assert(Slicing != 3);
-      assert(Slicing > Slice);
-      assert(HashSize > 1000);
-      static int tprimes[] = { 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41 };
-      for (int i = 0; i < NstepPrimes; i++) {
-	if (tprimes[i] == NstepPrimes) {
-	  primes[i] = 43;
-	}
-	else if (tprimes[i] == Slicing) {
-	  primes[i] = 47;
-	}
-	else {
-	  primes[i] = tprimes[i];
-	}
+      setupPrimes();
+    }
+  // Use the table in a mapped snapshot (see save())
+  OligoHash(OligoSnapshot &snap) :
+    OligoCells(snap.header->length, snap.header->info2Len, snap.header->info3Len),
+    Size(snap.header->size),
+    HashPct(snap.header->size/100),
+    Slicing(snap.header->slicing),
+    Slice(snap.header->slice),
+    hash(snap.hash),
+    insertions(snap.header->insertions),
+    distinct(snap.header->distinct),
+    NstepPrimes((snap.header->slicing == (sizeof primes)/sizeof(Index) 
+		 ? (snap.header->slicing - 2)
+		 : (sizeof primes)/sizeof(Index))),
+    MaxLoad(0),
+    GrowAt(0),
+    Mapped(true)
+    {
+      assert(Info1Len == snap.header->info1Len);
+      overflow.load(snap.overflow, snap.header->overflowCount);
+      setupPrimes();
+    }
+protected:
+  void setupPrimes() {
+    // modulo 3 doesn't work well with powers of 4 (see Knuth)
+    assert(NstepPrimes != 3);
+    assert(Slicing != 3);
+    assert(Slicing > Slice);
+    assert(Size > 1000);
+    static int tprimes[] = { 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41 };
+    for (int i = 0; i < NstepPrimes; i++) {
+      if (tprimes[i] == NstepPrimes) {
+	primes[i] = 43;
+      }
+      else if (tprimes[i] == Slicing) {
+	primes[i] = 47;
+      }
+      else {
+	primes[i] = tprimes[i];
       }
-	
     }
+  }
+public:
+  // Number of cells to use for a table asked to have about n cells: a prime
+  // number of buckets (or cells), never more than n, so that arrays of
+  // n entries can parallel the table.
+  static Index tableSize(Index n) {
+    return OLIGOBUCKET * get_prime(n / OLIGOBUCKET);
+  }
 
   inline Oligo* first() {
     Index i;
@@ -98,9 +142,37 @@ public:
 
 protected:
   inline bool inslice(Oligo w) {
-    return (w % Slicing == Slice);
+    return (sliceOf(w, Slicing) == Slice);
   }
 public:
+#ifdef OLIGOHASH_BUCKETS
+  // Bucketed engine (see OligoBucket.hh): the home and probe steps are
+  // buckets, and a kmer goes in the first empty cell of the first bucket
+  // with room, so one scan of a bucket decides FOUND or MISSING unless
+  // the bucket is full.
+  HashFlag lookuploc(Oligo key, Index &location) {
+    key = getOligo(key);
+    if (! inslice(key)) return SLICED;
+    const Index nbuckets = Size / OLIGOBUCKET;
+    Index start, bucket, step;
+    unsigned found, empty;
+
+    bucket = start = fold(key) % nbuckets;
+    step = primes[fold(key) % NstepPrimes];
+    do {
+      found = bucketScan(hash + bucket * OLIGOBUCKET, key, ValMask, empty);
+      if (found | empty) {
+	unsigned cell = __builtin_ctz(found | empty);
+	location = bucket * OLIGOBUCKET + cell;
+	return ((found >> cell) & 1) ? FOUND : MISSING;
+      }
+      bucket += step;
+      bucket = (bucket >= nbuckets)? (bucket - nbuckets) : bucket;
+    } while (bucket != start);
+    location = (Index) ~0ULL;
+    return FULL;
+  }
+#else
   HashFlag lookuploc(Oligo key, Index &location) {
     key = getOligo(key);
     if (! inslice(key)) return SLICED;
@@ -108,11 +180,11 @@ public:
     Oligo temp = 0;
     
     // make sure to use hardware integer modulus below
-    if (sizeof(Index) < sizeof(Oligo)) {
-      tkey  = (Index) (key ^ (key >> 31));
+    if (sizeof(Index) < sizeof(Index64)) {
+      tkey  = (Index) (fold(key) ^ (fold(key) >> 31));
     }
     else {
-      tkey = key;
+      tkey = fold(key);
     }
     probe = start = tkey % Size;
     if ((temp = hash[probe]) && (getOligo(temp) != key)) {
@@ -140,6 +212,7 @@ public:
       return FOUND;
     }
   }
+#endif
   HashFlag lookup(Oligo key, Oligo &result) {
     Index loc;
     HashFlag flag = lookuploc(key, loc);
@@ -153,6 +226,59 @@ public:
       return flag;
     }
   }
+  // Start loading the cell (or bucket) where a lookup of key begins, so
+  // that a lookup issued a little later doesn't stall on a cache miss.
+  inline void prefetch(Oligo key) {
+    key = getOligo(key);
+    if (! inslice(key)) return;
+#ifdef OLIGOHASH_BUCKETS
+    __builtin_prefetch(hash + (fold(key) % (Size / OLIGOBUCKET)) * OLIGOBUCKET);
+#else
+    // the same home cell as lookuploc
+    Index tkey = ((sizeof(Index) < sizeof(Index64))
+	          ? (Index) (fold(key) ^ (fold(key) >> 31))
+	          : fold(key));
+    __builtin_prefetch(hash + tkey % Size);
+#endif
+  }
+  // How many kmers ahead of the current one lookupBatch
+  // prefetches: enough to cover a memory latency, few enough to stay cached.
+  static const Index PREFETCHAHEAD = 16;
+
+  // lookuploc for n kmers at once, prefetching each home cell well ahead
+  // of its lookup; locations[i] and flags[i] are as from lookuploc(keys[i]).
+  void lookupBatch(const Oligo *keys, Index n, Index *locations, HashFlag *flags) {
+    Index i;
+    for (i = 0; i < n && i < PREFETCHAHEAD; i++) {
+      prefetch(keys[i]);
+    }
+    for (i = 0; i < n; i++) {
+      if (i + PREFETCHAHEAD < n) {
+	prefetch(keys[i + PREFETCHAHEAD]);
+      }
+      flags[i] = lookuploc(keys[i], locations[i]);
+    }
+  }
+  // A kmer's count, from its cell or, once that saturates, from overflow
+  inline Index64 count(Index location) {
+    Index c = getInfo1(hash[location]);
+    return (c == Info1Mask) ? overflow.get(getOligo(hash[location])) : c;
+  }
+  // Add to the count of the kmer in a cell, moving it to overflow when it
+  // no longer fits in Info1.
+  inline void addInfo1(Index location, Index64 inc) {
+    Index c = getInfo1(hash[location]);
+    if (c + inc < Info1Mask) {
+      putInfo1(hash[location], c + inc);
+    }
+    else if (c == Info1Mask) {
+      overflow.add(getOligo(hash[location]), inc);
+    }
+    else {
+      overflow.add(getOligo(hash[location]), c + inc);
+      putInfo1(hash[location], Info1Mask);
+    }
+  }
   HashFlag insert(Oligo key, Index info1inc = 1, Index info2inc = 0, Index info3inc = 0) {
     Index loc;
     Oligo newval;
@@ -184,12 +310,175 @@ public:
     else { // flag == FOUND
       newval = hash[loc];
     }
-    putInfo1(newval, getInfo1(newval) + info1inc);
     putInfo2(newval, getInfo2(newval) + info2inc);
     putInfo3(newval, getInfo3(newval) + info3inc);
     hash[loc] = newval;
+    addInfo1(loc, info1inc);
     return flag;
   }
+
+  // Growth policy: once the distinct kmers reach maxLoad (a fraction of Size,
+  // e.g. 0.8), overloaded() tells the caller to grow() the table.
+  // The caller does the growing, since only it knows where its side
+  // arrays (indexed by cell) are to be carried along.
+  void setGrowth(double maxLoad) {
+    MaxLoad = maxLoad;
+    GrowAt = (Index) (maxLoad * Size);
+  }
+  inline bool overloaded() {
+    return GrowAt && distinct >= GrowAt;
+  }
+  // Rehash all cells into a table of newSize cells (default: largest prime
+  // up to twice the current size), moving the side array entries along
+  // into a new side array.  The cells are split into nthreads ranges that
+  // are reinserted in parallel; the old arrays are freed at the end.
+  template<class T2> void grow(T2 *&side, unsigned nthreads = 1, Index newSize = 0) {
+    if (newSize <= Size) {
+      newSize = 2 * Size;
+    }
+    newSize = tableSize(newSize);
+    cerr << "OligoHash is " << dec << distinct / HashPct
+	 << " percent full; growing from " << Size
+	 << " to " << newSize << " cells." << endl;
+    Oligo *oldhash = hash;
+    T2 *oldside = side;
+    Index oldSize = Size;
+
+    hash = allocCells(newSize, Slice);
+    if (oldside) {
+      side = (T2 *) allocTable(sizeof(T2) * newSize, 16, Slice);
+    }
+    if (! hash || (oldside && ! side)) {
+      cerr << "OligoHash failed to allocate " << newSize << " cells to grow into." << endl;
+      exit(-1);
+    }
+    Size = newSize;
+    HashPct = newSize/100;
+    GrowAt = (Index) (MaxLoad * Size);
+
+    if (nthreads < 1) nthreads = 1;
+    vector< Rehasher<T2> > parts(nthreads);
+    for (unsigned t = 0; t < nthreads; t++) {
+      parts[t].oh = this;
+      parts[t].oldhash = oldhash;
+      parts[t].oldside = oldside;
+      parts[t].side = side;
+      parts[t].from = oldSize * t / nthreads;
+      parts[t].to = oldSize * (t + 1) / nthreads;
+    }
+    if (nthreads == 1) {
+      rehashRange<T2>(&(parts[0]));
+    }
+    else {
+      for (unsigned t = 0; t < nthreads; t++) {
+	pthread_create(&(parts[t].thread), NULL, rehashRange<T2>, &(parts[t]));
+      }
+      for (unsigned t = 0; t < nthreads; t++) {
+	pthread_join(parts[t].thread, NULL);
+      }
+    }
+    if (! Mapped) {
+      freeTable(oldhash);
+      freeTable(oldside);
+    }
+    Mapped = false;
+  }
+  void grow(unsigned nthreads = 1, Index newSize = 0) {
+    char *noside = 0;
+    grow(noside, nthreads, newSize);
+  }
+protected:
+  // One thread's share of a rehash: cells [from, to) of the old arrays.
+  template<class T2> class Rehasher {
+  public:
+    OligoHash *oh;
+    Oligo *oldhash;
+    T2 *oldside;
+    T2 *side;
+    Index from, to;
+    pthread_t thread;
+  };
+  template<class T2> static void *rehashRange(void *arg) {
+    Rehasher<T2> *r = (Rehasher<T2> *) arg;
+    for (Index i = r->from; i < r->to; i++) {
+      if (r->oldhash[i]) {
+	Index loc = r->oh->place(r->oldhash[i]);
+	if (r->side) {
+	  r->side[loc] = r->oldside[i];
+	}
+      }
+    }
+    return NULL;
+  }
+  // Claim an empty cell for a whole cell (kmer and counts) whose kmer is
+  // known not to be in the table yet, e.g. while rehashing.
+#ifdef OLIGOHASH_BUCKETS
+  Index place(Oligo cell) {
+    Oligo key = getOligo(cell);
+    const Index nbuckets = Size / OLIGOBUCKET;
+    Index bucket = fold(key) % nbuckets;
+    Index step = primes[fold(key) % NstepPrimes];
+    unsigned empty;
+    while (1) {
+      bucketScan(hash + bucket * OLIGOBUCKET, key, ValMask, empty);
+      for (; empty; empty &= empty - 1) {
+	Index probe = bucket * OLIGOBUCKET + __builtin_ctz(empty);
+	if (! __sync_val_compare_and_swap(&hash[probe], (Oligo) 0, cell)) {
+	  return probe;
+	}
+      }
+      bucket += step;
+      bucket = (bucket >= nbuckets)? (bucket - nbuckets) : bucket;
+    }
+  }
+#else
+  Index place(Oligo cell) {
+    Oligo key = getOligo(cell);
+    Index probe, step, tkey;
+    if (sizeof(Index) < sizeof(Index64)) {
+      tkey  = (Index) (fold(key) ^ (fold(key) >> 31));
+    }
+    else {
+      tkey = fold(key);
+    }
+    probe = tkey % Size;
+    step = primes[tkey % NstepPrimes];
+    while (__sync_val_compare_and_swap(&hash[probe], (Oligo) 0, cell)) {
+      probe += step;
+      probe = (probe >= Size)? (probe -= Size) : probe;
+    }
+    return probe;
+  }
+#endif
+public:
+  // Save the table, with a side array of entries indexed by cell, as a
+  // snapshot that later runs can map instead of rebuilding the table.
+  // The tag should name the side array type and whatever options decided
+  // which kmers went into the table; a snapshot is only used by a run
+  // that expects the same tag.
+  template<class T2> bool save(const char *name, const T2 *side, const string &tag) {
+    OligoSnapshot::Header h;
+    h.length = Length;
+    h.info1Len = Info1Len;
+    h.info2Len = Info2Len;
+    h.info3Len = Info3Len;
+    h.slicing = Slicing;
+    h.slice = Slice;
+    h.size = Size;
+    h.distinct = distinct;
+    h.insertions = insertions;
+    h.sideSize = sizeof(T2);
+    return OligoSnapshot::write(name, h, tag, hash, side, overflow);
+  }
+  // Give back the cells, once the kmers are copied elsewhere (e.g. into
+  // an OligoPerfectHash); those of a mapped snapshot stay mapped.
+  void release() {
+    if (! Mapped) {
+      freeTable(hash);
+    }
+    hash = 0;
+    Size = distinct = 0;
+  }
   void clear() {
     memset(hash, 0, sizeof(Oligo) * Size);
     insertions = distinct = 0;
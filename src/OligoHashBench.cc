@@ -0,0 +1,145 @@
+#include "OligoHash.hh"
+#include "getprime.hh"
+#include <string>
+#include <iomanip>
+#include <time.h>
+
+// Benchmark of the OligoHash engine: inserts, hits and misses at a range
+// of table loads.  Built twice by the Makefile, as OligoHashBench (cell by
+// cell double hashing) and OligoHashBenchBuckets (-DOLIGOHASH_BUCKETS),
+// to compare the two engines on the same machine.
+
+Oligos::Index OptOligoLen;
+Oligos::Index OptHashSize;
+Oligos::Index OptLookups;
+
+void PrintOptions() {
+  cerr << "Option values are:\n"<<
+    "   -o {OligoLen}    ["<< OptOligoLen << "] Length of oligos.\n" <<
+    "   -H {HashSize}    ["<< OptHashSize << "] Number of cells in hash table.\n" <<
+    "   -N {MemPolicy}   ["<< tablePolicy().spec << "] Table memory policy (see OligoMemory.hh), e.g. huge,touch=4.\n" <<
+    "   -n {Lookups}     ["<< OptLookups << "] Number of hits and of misses to time at each load.\n" <<
+    "   -h               Print help information.\n" <<
+    endl;
+}
+
+void PrintHelp()
+{
+  cerr <<"\n"<<
+    "   OligoHashBench  Times OligoHash inserts and lookups (hits and misses) of random kmers\n" <<
+    "                   as the table fills to 50, 60, 70, 80 and 90 percent of its cells.\n" <<
+    "                   Prints nanoseconds per operation to STDOUT.\n" <<
+    "                   [Defaults are given in square braces.]\n";
+  PrintOptions();
+}
+
+int SetupOptions(int argc, char**argv)
+{
+  // Default values
+  OptOligoLen    = 23;                  // -o
+  OptHashSize    = get_prime(16000000); // -H
+  OptLookups     = 4000000;             // -n
+
+  int i;
+  for (i = 1; i < argc; i++) {
+    char prefix = argv[i][0];
+    char theOption = argv[i][1];
+    if (prefix == '-') {
+      switch(theOption) {
+      case 'o':
+        OptOligoLen = strtol(argv[++i], NULL, 0);
+        break;
+      case 'H':
+        OptHashSize = get_prime(strtoll(argv[++i], NULL, 0));
+        break;
+      case 'n':
+        OptLookups = strtoll(argv[++i], NULL, 0);
+        break;
+      case 'N':
+        if (! tablePolicy().parse(argv[++i])) {
+          cerr << "Unrecognized memory policy: " << argv[i] << "\n";
+          exit(-1);
+        }
+        break;
+      case 'h':
+        PrintHelp(); exit(0);
+        break;
+      default:
+        cerr << "Unrecognized option: -" << theOption << "\n";
+        PrintHelp();
+        exit(-1);
+      }
+    }
+    else {
+      break;
+    }
+  }
+  return i;
+}
+
+// splitmix64: a repeatable stream of random kmers
+inline Oligos::Oligo nextRandom(Oligos::Oligo &state) {
+  Oligos::Oligo z = (state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+double seconds() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + 1e-9 * ts.tv_nsec;
+}
+
+int main(int argc, char *argv[]) {
+  SetupOptions(argc, argv);
+
+  OligoHash oh(OptHashSize, 1, 0, OptOligoLen);
+  // Kmers to insert come from one stream, kmers to miss from another;
+  // a collision between the two streams is vanishingly unlikely.
+  Oligos::Oligo inState = 1, missState = 0x5DEECE66DULL;
+  Oligos::Index inserted = 0;
+  Oligos::Index loc;
+  Oligos::Oligo result;
+  long sink = 0;
+
+  cout << "# engine:\t" << (OLIGOBUCKET > 1 ? "buckets" : "cells")
+#if defined(OLIGOHASH_BUCKETS) && defined(__AVX2__)
+       << " (AVX2)"
+#elif defined(OLIGOHASH_BUCKETS) && defined(__SSE4_1__)
+       << " (SSE4.1)"
+#endif
+       << "\tcells:\t" << oh.Size << "\toligolen:\t" << OptOligoLen << endl;
+  cout << "# load\tinsert_ns\thit_ns\tmiss_ns" << endl;
+  for (unsigned pct = 50; pct <= 90; pct += 10) {
+    Oligos::Index target = oh.Size / 100 * pct;
+    Oligos::Index batch = target - inserted;
+    double t0 = seconds();
+    for (; inserted < target; inserted++) {
+      oh.insert(nextRandom(inState) & oh.ValMask);
+    }
+    double t1 = seconds();
+
+    // Hits: replay the insert stream, from the start
+    Oligos::Oligo hitState = 1;
+    Oligos::Index n;
+    for (n = 0; n < OptLookups; n++) {
+      if (n % inserted == 0) hitState = 1;
+      sink += oh.lookuploc(nextRandom(hitState) & oh.ValMask, loc);
+    }
+    double t2 = seconds();
+    Oligos::Oligo missFrom = missState;
+    for (n = 0; n < OptLookups; n++) {
+      sink += oh.lookup(nextRandom(missFrom) & oh.ValMask, result);
+    }
+    double t3 = seconds();
+
+    cout << pct << setprecision(3) << fixed
+         << "\t" << 1e9 * (t1 - t0) / batch
+         << "\t" << 1e9 * (t2 - t1) / OptLookups
+         << "\t" << 1e9 * (t3 - t2) / OptLookups << endl;
+  }
+  // Keep the optimizer from discarding the lookups
+  cerr << "# checksum " << sink << endl;
+  exit(0);
+}
@@ -58,60 +58,157 @@
 #include <stdlib.h>
 #include <iostream>
 #include <assert.h>
+#include <pthread.h>
+#include <vector>
+#include "getprime.hh"
+#include "OligoSnapshot.hh"
+#include "OligoBucket.hh"
+#include "OligoSlice.hh"
+#include "OligoBloom.hh"
+#include "OligoLayout.hh"
 
 using namespace std;
 
-template<class T2> class OligoHash: public OligoCells {
+// A table may keep a second, "cold" side array (T3) next to the "hot" one
+// (T2), so that the fields used for every kmer looked up stay packed
+// densely in the hot array, and the rest, used only now and then, stay
+// out of the way.  NoSide, the default, means no cold array; these
+// helpers then allocate and move nothing.
+class NoSide { };
+template<class T> inline T *allocSide(size_t n, size_t slice) {
+  return (T *) allocTable(sizeof(T) * n, 16, slice);
+}
+template<> inline NoSide *allocSide<NoSide>(size_t n, size_t slice) {
+  return 0;
+}
+template<class T> inline void copySide(T *to, size_t i, const T *from, size_t j) {
+  to[i] = from[j];
+}
+template<> inline void copySide<NoSide>(NoSide *to, size_t i, const NoSide *from, size_t j) {
+}
+template<class T> inline void clearSide(T *side, size_t i) {
+  memset(&side[i], 0, sizeof(T));
+}
+template<> inline void clearSide<NoSide>(NoSide *side, size_t i) {
+}
+
+// Layout says where the cells and their side entries are kept: in two
+// arrays (SplitCells), or together, bucket by bucket (InterleavedCells);
+// see OligoLayout.hh.
+template<class T2, class T3 = NoSide, class Layout = DefaultCells<T2> >
+class OligoHash: public OligoCells {
 public:
   typedef enum { FOUND, MISSING, SLICED, FULL } HashFlag;
 
   Index64 insertions;
   Index64 distinct;
-  Oligo *const hash;
-  T2 *const side;
-  const Index HashPct;
-  const Index Size;
+  Index64 purged;      // singletons removed by purgeSingletons, in all
+  typename Layout::Keys hash;    // hash, side and cold are reallocated if the table grows
+  typename Layout::Sides side;
+  T3 *cold;       // 0 for NoSide
+  OligoOverflow overflow;  // counts too big for Info1
+  Index HashPct;
+  Index Size;
   const Index Slicing;
   const Index Slice;
 protected:
   Index primes[13];
   const Index NstepPrimes;
+  double MaxLoad;      // grow when distinct kmers reach this fraction of Size;
+  Index GrowAt;        //   0 means never grow (FULL when out of cells)
+  unsigned GrowThreads;
+  bool Mapped;         // hash and side arrays are in a mapped snapshot, not allocTable'd
+  double PurgeLoad;    // purge singletons when distinct kmers reach this fraction
+  Index PurgeAt;       //   of Size; 0 means never purge
+  OligoBloom *Purged;  // purged singletons, if they are to be remembered
 public:
   OligoHash(Index HashSize, Index HashSlicing, Index HashSlice,
             Index OligoLen, Index Info2Len = 0, Index Info3Len = 0) :
     OligoCells(OligoLen, Info2Len, Info3Len),
-    Size(HashSize),
-    HashPct(HashSize/100),
+    Size(tableSize(HashSize)),
+    HashPct(tableSize(HashSize)/100),
     Slicing(HashSlicing),
     Slice(HashSlice),
-    // Could use C++ new, but not sure if that initializes to zero
-    hash((Oligo *) calloc(sizeof(Oligo), HashSize)),
-    side((T2 *) calloc(sizeof(T2), HashSize)),
+    cold(allocSide<T3>(tableSize(HashSize), HashSlice)),
     insertions(0),
     distinct(0),
     NstepPrimes((HashSlicing == (sizeof primes)/sizeof(Index) 
                  ? (HashSlicing - 2)
-                 : (sizeof primes)/sizeof(Index)))
+                 : (sizeof primes)/sizeof(Index))),
+    MaxLoad(0),
+    GrowAt(0),
+    GrowThreads(1),
+    Mapped(false),
+    PurgeLoad(0),
+    PurgeAt(0),
+    Purged(0),
+    purged(0)
     {
-      // modulo 3 doesn't work well with powers of 4 (see Knuth)
-      assert(NstepPrimes != 3);
-      assert(Slicing != 3);
-      assert(Slicing > Slice);
-      assert(HashSize > 1000);
-      static int tprimes[] = { 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41 };
-      for (int i = 0; i < NstepPrimes; i++) {
-        if (tprimes[i] == NstepPrimes) {
-          primes[i] = 43;
-        }
-        else if (tprimes[i] == Slicing) {
-          primes[i] = 47;
-        }
-        else {
-          primes[i] = tprimes[i];
-        }
+      // Zeroed cells and side entries
+      Layout::alloc(tableSize(HashSize), hash, side, HashSlice);
+      setupPrimes();
+    }
+  // Use the table and side array in a mapped snapshot (see save()); a
+  // cold array starts out empty.
+  OligoHash(OligoSnapshot &snap) :
+    OligoCells(snap.header->length, snap.header->info2Len, snap.header->info3Len),
+    Size(snap.header->size),
+    HashPct(snap.header->size/100),
+    Slicing(snap.header->slicing),
+    Slice(snap.header->slice),
+    hash(snap.hash),
+    side((T2 *) snap.side),
+    cold(allocSide<T3>(snap.header->size, snap.header->slice)),
+    insertions(snap.header->insertions),
+    distinct(snap.header->distinct),
+    NstepPrimes((snap.header->slicing == (sizeof primes)/sizeof(Index) 
+                 ? (snap.header->slicing - 2)
+                 : (sizeof primes)/sizeof(Index))),
+    MaxLoad(0),
+    GrowAt(0),
+    GrowThreads(1),
+    Mapped(true),
+    PurgeLoad(0),
+    PurgeAt(0),
+    Purged(0),
+    purged(0)
+    {
+      assert(Info1Len == snap.header->info1Len);
+      assert(side);
+      overflow.load(snap.overflow, snap.header->overflowCount);
+      setupPrimes();
+    }
+protected:
+  void setupPrimes() {
+    // modulo 3 doesn't work well with powers of 4 (see Knuth)
+    assert(NstepPrimes != 3);
+    assert(Slicing != 3);
+    assert(Slicing > Slice);
+    assert(Size > 1000);
+    static int tprimes[] = { 2, 3, 5, 7, 11, 13, 17, 19, 23, 29, 31, 37, 41 };
+    for (int i = 0; i < NstepPrimes; i++) {
+      if (tprimes[i] == NstepPrimes) {
+        primes[i] = 43;
+      }
+      else if (tprimes[i] == Slicing) {
+        primes[i] = 47;
+      }
+      else {
+        primes[i] = tprimes[i];
       }
     }
+  }
+public:
+  // Number of cells to use for a table asked to have about n cells: a prime
+  // number of buckets (or cells), never more than n.
+  static Index tableSize(Index n) {
+    return OLIGOBUCKET * get_prime(n / OLIGOBUCKET);
+  }
 
+  // The kmer held at a location returned by a lookup or a scan
+  inline Oligo oligoAt(Index location) {
+    return getOligo(hash[location]);
+  }
   inline Oligo* first() {
     Index i;
     for (i = 0; i < Size; i++) {
@@ -122,9 +219,10 @@ public:
     return 0;
   }
   inline Oligo* next(Oligo* current) {
-    for (current++; current < hash + Size; current++) {
-      if (*current) {
-        return current;
+    Index i;
+    for (i = Layout::indexOf(hash, current) + 1; i < Size; i++) {
+      if (hash[i]) {
+        return &(hash[i]);
       }
     }
     return 0;
@@ -132,9 +230,37 @@ public:
 
 protected:
   inline bool inslice(Oligo w) {
-    return (w % Slicing == Slice);
+    return (sliceOf(w, Slicing) == Slice);
   }
 public:
+#ifdef OLIGOHASH_BUCKETS
+  // Bucketed engine (see OligoBucket.hh): the home and probe steps are
+  // buckets, and a kmer goes in the first empty cell of the first bucket
+  // with room, so one scan of a bucket decides FOUND or MISSING unless
+  // the bucket is full.
+  HashFlag lookuploc(Oligo key, Index &location) {
+    key = getOligo(key);
+    if (! inslice(key)) return SLICED;
+    const Index nbuckets = Size / OLIGOBUCKET;
+    Index start, bucket, step;
+    unsigned found, empty;
+
+    bucket = start = fold(key) % nbuckets;
+    step = primes[fold(key) % NstepPrimes];
+    do {
+      found = bucketScan(&hash[bucket * OLIGOBUCKET], key, ValMask, empty);
+      if (found | empty) {
+        unsigned cell = __builtin_ctz(found | empty);
+        location = bucket * OLIGOBUCKET + cell;
+        return ((found >> cell) & 1) ? FOUND : MISSING;
+      }
+      bucket += step;
+      bucket = (bucket >= nbuckets)? (bucket - nbuckets) : bucket;
+    } while (bucket != start);
+    location = (Index) ~0ULL;
+    return FULL;
+  }
+#else
   HashFlag lookuploc(Oligo key, Index &location) {
     key = getOligo(key);
     if (! inslice(key)) return SLICED;
@@ -148,11 +274,11 @@ public:
     // else {
     // tkey = key;
     // }
-    probe = start = key % Size;
+    probe = start = fold(key) % Size;
     if ((temp = hash[probe]) && (getOligo(temp) != key)) {
 
       // NstepPrimes relatively prime to Slicing
-      step = primes[key % NstepPrimes];
+      step = primes[fold(key) % NstepPrimes];
 
       do {
         probe += step;
@@ -174,6 +300,7 @@ public:
       return FOUND;
     }
   }
+#endif
   HashFlag lookup(Oligo key, Oligo &result) {
     Index loc;
     HashFlag flag = lookuploc(key, loc);
@@ -187,6 +314,57 @@ public:
       return flag;
     }
   }
+  // Start loading the cell (or bucket) where a lookup of key begins, so
+  // that a lookup issued a little later doesn't stall on a cache miss.
+  inline void prefetch(Oligo key) {
+    key = getOligo(key);
+    if (inslice(key)) {
+      Index home = (fold(key) % (Size / OLIGOBUCKET)) * OLIGOBUCKET;
+      __builtin_prefetch(&hash[home]);
+      if (Layout::INTERLEAVED) {
+        // The side entries follow the bucket, in the next cache line
+        __builtin_prefetch(&side[home]);
+      }
+    }
+  }
+  // How many kmers ahead of the current one lookupBatch and insertlocBatch
+  // prefetch: enough to cover a memory latency, few enough to stay cached.
+  static const Index PREFETCHAHEAD = 16;
+
+  // lookuploc for n kmers at once, prefetching each home cell well ahead
+  // of its lookup; locations[i] and flags[i] are as from lookuploc(keys[i]).
+  void lookupBatch(const Oligo *keys, Index n, Index *locations, HashFlag *flags) {
+    Index i;
+    for (i = 0; i < n && i < PREFETCHAHEAD; i++) {
+      prefetch(keys[i]);
+    }
+    for (i = 0; i < n; i++) {
+      if (i + PREFETCHAHEAD < n) {
+        prefetch(keys[i + PREFETCHAHEAD]);
+      }
+      flags[i] = lookuploc(keys[i], locations[i]);
+    }
+  }
+  // A kmer's count, from its cell or, once that saturates, from overflow
+  inline Index64 count(Index location) {
+    Index c = getInfo1(hash[location]);
+    return (c == Info1Mask) ? overflow.get(getOligo(hash[location])) : c;
+  }
+  // Add to the count of the kmer in a cell, moving it to overflow when it
+  // no longer fits in Info1.
+  inline void addInfo1(Index location, Index64 inc) {
+    Index c = getInfo1(hash[location]);
+    if (c + inc < Info1Mask) {
+      putInfo1(hash[location], c + inc);
+    }
+    else if (c == Info1Mask) {
+      overflow.add(getOligo(hash[location]), inc);
+    }
+    else {
+      overflow.add(getOligo(hash[location]), c + inc);
+      putInfo1(hash[location], Info1Mask);
+    }
+  }
   inline void increment(Oligo &val, Index inc1 = 1, Index inc2 = 0, Index inc3 = 0) {
     putInfo1(val, getInfo1(val) + inc1);
     putInfo2(val, getInfo2(val) + inc2);
@@ -224,12 +402,457 @@ public:
     else { // flag == FOUND
       newval = hash[loc];
     }
-    increment(newval, info1inc, info2inc, info3inc);
+    increment(newval, 0, info2inc, info3inc);
     hash[loc] = newval;
+    addInfo1(loc, info1inc);
     return flag;
   }
+  // Like insert, but hands back the cell location so that the caller can
+  // update the side array, and doesn't complain about a FULL hash.
+  // An overloaded table is purged or grown (see relieve) before the insert,
+  // so that the location handed back stays good until the next insert.
+  HashFlag insertloc(Oligo key, Index &location, Index info1inc = 1) {
+    if (overloaded()) {
+      relieve(GrowThreads);
+    }
+    key = getOligo(key);
+    HashFlag flag = lookuploc(key, location);
+
+    if (flag == MISSING) {
+      hash[location] = key;
+      distinct++;
+      if (!(distinct % HashPct)) {
+        cerr << "OligoHash is " << dec << distinct / HashPct
+             << " percent full." << endl;
+      }
+      info1inc += purgedBefore(key);
+    }
+    if (flag == MISSING || flag == FOUND) {
+      addInfo1(location, info1inc);
+    }
+    return flag;
+  }
+  // insertloc for up to n kmers at once, prefetching as lookupBatch does.
+  // Returns how many kmers it inserted: it stops short before a kmer that
+  // would have the table purged or grown, since that moves the cells of
+  // the earlier locations[].  The caller uses those, then calls again for
+  // the rest.
+  Index insertlocBatch(const Oligo *keys, Index n, Index *locations, HashFlag *flags,
+                       Index info1inc = 1) {
+    Index i;
+    for (i = 0; i < n && i < PREFETCHAHEAD; i++) {
+      prefetch(keys[i]);
+    }
+    for (i = 0; i < n; i++) {
+      if (i && overloaded()) {
+        break;
+      }
+      if (i + PREFETCHAHEAD < n) {
+        prefetch(keys[i + PREFETCHAHEAD]);
+      }
+      flags[i] = insertloc(keys[i], locations[i], info1inc);
+    }
+    return i;
+  }
+  // Thread-safe version of insertloc, for many threads counting into one table.
+  // The kmer and its Info1 count share one 64-bit cell, so an empty cell is
+  // claimed (key and first count together) with a single compare-and-swap,
+  // and a found cell has its count bumped by compare-and-swap retries.
+  // Cells are never emptied while counting, so any thread probing for a key
+  // stops at the same first empty cell as a thread that is claiming it.
+  // Side array updates are left to the caller (e.g. __sync_fetch_and_or).
+  // Nor does it purge or grow the table: the caller must stop all inserting
+  // threads before calling relieve() when overloaded(), or grow() when FULL
+  // comes back.
+#ifdef OLIGOHASH_BUCKETS
+  HashFlag insertlocAtomic(Oligo key, Index &location, Index info1inc = 1) {
+    key = getOligo(key);
+    if (! inslice(key)) return SLICED;
+    const Index nbuckets = Size / OLIGOBUCKET;
+    Index start, bucket, step, probe;
+    unsigned found, empty, cell;
+    Oligo temp, newval;
+
+    bucket = start = fold(key) % nbuckets;
+    step = primes[fold(key) % NstepPrimes];
+    do {
+      found = bucketScan(&hash[bucket * OLIGOBUCKET], key, ValMask, empty);
+      while (found | empty) {
+        cell = __builtin_ctz(found | empty);
+        probe = bucket * OLIGOBUCKET + cell;
+        if ((found >> cell) & 1) {
+          temp = readCell(&hash[probe]);
+        }
+        else {
+          Index first = info1inc + purgedBefore(key);
+          newval = key;
+          putInfo1(newval, first);
+          temp = __sync_val_compare_and_swap(&hash[probe], (Oligo) 0, newval);
+          if (! temp) {
+            location = probe;
+            if (first >= Info1Mask) {
+              overflow.add(key, first);
+            }
+            Index64 nowdistinct = __sync_add_and_fetch(&distinct, 1);
+            if (!(nowdistinct % HashPct)) {
+              cerr << "OligoHash is " << dec << nowdistinct / HashPct
+                   << " percent full." << endl;
+            }
+            return MISSING;
+          }
+          if (getOligo(temp) != key) {
+            // lost the race to another kmer; try the rest of the bucket
+            empty &= ~(1U << cell);
+            continue;
+          }
+        }
+        addInfo1Atomic(probe, temp, key, info1inc);
+        location = probe;
+        return FOUND;
+      }
+      bucket += step;
+      bucket = (bucket >= nbuckets)? (bucket - nbuckets) : bucket;
+    } while (bucket != start);
+    location = (Index) ~0ULL;
+    return FULL;
+  }
+#else
+  HashFlag insertlocAtomic(Oligo key, Index &location, Index info1inc = 1) {
+    key = getOligo(key);
+    if (! inslice(key)) return SLICED;
+    Index start, probe, step = 0;
+    Oligo temp, newval;
+
+    probe = start = fold(key) % Size;
+    while (1) {
+      temp = readCell(&hash[probe]);
+      if (! temp) {
+        Index first = info1inc + purgedBefore(key);
+        newval = key;
+        putInfo1(newval, first);
+        temp = __sync_val_compare_and_swap(&hash[probe], (Oligo) 0, newval);
+        if (! temp) {
+          location = probe;
+          if (first >= Info1Mask) {
+            overflow.add(key, first);
+          }
+          Index64 nowdistinct = __sync_add_and_fetch(&distinct, 1);
+          if (!(nowdistinct % HashPct)) {
+            cerr << "OligoHash is " << dec << nowdistinct / HashPct
+                 << " percent full." << endl;
+          }
+          return MISSING;
+        }
+        // else lost the race; temp now holds the winner's cell
+      }
+      if (getOligo(temp) == key) {
+        addInfo1Atomic(probe, temp, key, info1inc);
+        location = probe;
+        return FOUND;
+      }
+      if (! step) {
+        // NstepPrimes relatively prime to Slicing
+        step = primes[fold(key) % NstepPrimes];
+      }
+      probe += step;
+      probe = (probe >= Size)? (probe -= Size) : probe;
+      if (probe == start) {
+        location = (Index) ~0ULL;
+        return FULL;
+      }
+    }
+  }
+#endif
+
+  // Growth policy: once the distinct kmers reach maxLoad (a fraction of Size,
+  // e.g. 0.8), the table is rehashed into one about twice as big, using
+  // nthreads threads, instead of eventually filling up and returning FULL.
+  void setGrowth(double maxLoad, unsigned nthreads = 1) {
+    MaxLoad = maxLoad;
+    GrowAt = (Index) (maxLoad * Size);
+    GrowThreads = nthreads;
+  }
+  // Purge policy: once the distinct kmers reach purgeLoad (a fraction of
+  // Size, best below any growth maxLoad), the kmers counted only once so far
+  // are removed to make room (see purgeSingletons).  If seen is given, the
+  // purged kmers are recorded there, and one seen again is counted from 2.
+  void setPurge(double purgeLoad, OligoBloom *seen = 0) {
+    PurgeLoad = purgeLoad;
+    PurgeAt = (Index) (purgeLoad * Size);
+    Purged = seen;
+  }
+  inline bool overloaded() {
+    return (PurgeAt && distinct >= PurgeAt) || (GrowAt && distinct >= GrowAt);
+  }
+  // Make room in an overloaded table: purge singletons if that is due, then
+  // grow if that is (still) due.  A purge that frees less than a tenth of
+  // the table won't pay for itself again, so it is the last one.
+  void relieve(unsigned nthreads = 1) {
+    if (PurgeAt && distinct >= PurgeAt) {
+      Index64 before = distinct;
+      purgeSingletons();
+      if (before - distinct < Size / 10) {
+        cerr << "OligoHash purge freed under 10 percent of the table; no more purges." << endl;
+        PurgeAt = 0;
+      }
+    }
+    if (GrowAt && distinct >= GrowAt) {
+      grow(nthreads);
+    }
+  }
+  // Remove the kmers counted only once so far, with their side array
+  // entries, recording them in the setPurge filter if there is one.  The
+  // remaining kmers are then moved, in place, back along their probe
+  // sequences to fill the holes ahead of them, so that lookups still find
+  // them.  Returns the number removed.
+  Index64 purgeSingletons() {
+    const Index nbuckets = Size / OLIGOBUCKET;
+    Index64 removed = 0;
+    Index bucket, i, c, filled;
+    cerr << "OligoHash is " << dec << distinct / HashPct
+         << " percent full; purging singletons." << endl;
+    for (bucket = 0; bucket < nbuckets; bucket++) {
+      // Cells fill each bucket in order; keep the survivors in front
+      filled = bucket * OLIGOBUCKET;
+      for (i = filled; i < (bucket + 1) * OLIGOBUCKET && hash[i]; i++) {
+        if (getInfo1(hash[i]) == 1) {
+          if (Purged) {
+            Purged->add(getOligo(hash[i]));
+          }
+          removed++;
+        }
+        else {
+          if (filled != i) {
+            hash[filled] = hash[i];
+            side[filled] = side[i];
+            copySide(cold, filled, cold, i);
+          }
+          filled++;
+        }
+      }
+      for (c = filled; c < i; c++) {
+        hash[c] = 0;
+        memset(&side[c], 0, sizeof(T2));
+        clearSide(cold, c);
+      }
+    }
+    distinct -= removed;
+    purged += removed;
+
+    // Each move takes a kmer to an earlier point on its own probe
+    // sequence, so repeated passes settle.
+    bool moved = true;
+    while (moved) {
+      moved = false;
+      for (bucket = 0; bucket < nbuckets; bucket++) {
+        for (c = 0; c < OLIGOBUCKET && hash[bucket * OLIGOBUCKET + c]; ) {
+          if (settle(bucket, c)) {
+            moved = true;
+          }
+          else {
+            c++;
+          }
+        }
+      }
+    }
+    cerr << "OligoHash purged " << removed << " singletons; now "
+         << distinct / HashPct << " percent full." << endl;
+    return removed;
+  }
+  // Rehash all cells, with their side (and cold) entries, into a table of
+  // newSize cells (default: largest prime up to twice the current size).
+  // The cells are split into nthreads ranges that are reinserted in
+  // parallel; the old arrays are freed as soon as the last one is done.
+  void grow(unsigned nthreads = 1, Index newSize = 0) {
+    if (newSize <= Size) {
+      newSize = 2 * Size;
+    }
+    newSize = tableSize(newSize);
+    cerr << "OligoHash is " << dec << distinct / HashPct
+         << " percent full; growing from " << Size
+         << " to " << newSize << " cells." << endl;
+    typename Layout::Keys oldhash = hash;
+    typename Layout::Sides oldside = side;
+    T3 *oldcold = cold;
+    Index oldSize = Size;
+
+    bool allocated = Layout::alloc(newSize, hash, side, Slice);
+    cold = allocSide<T3>(newSize, Slice);
+    if (! allocated || (oldcold && ! cold)) {
+      cerr << "OligoHash failed to allocate " << newSize << " cells to grow into." << endl;
+      exit(-1);
+    }
+    Size = newSize;
+    HashPct = newSize/100;
+    GrowAt = (Index) (MaxLoad * Size);
+    if (PurgeAt) {
+      PurgeAt = (Index) (PurgeLoad * Size);
+    }
+
+    if (nthreads < 1) nthreads = 1;
+    vector<Rehasher> parts(nthreads);
+    for (unsigned t = 0; t < nthreads; t++) {
+      parts[t].oh = this;
+      parts[t].oldhash = oldhash;
+      parts[t].oldside = oldside;
+      parts[t].oldcold = oldcold;
+      parts[t].from = oldSize * t / nthreads;
+      parts[t].to = oldSize * (t + 1) / nthreads;
+    }
+    if (nthreads == 1) {
+      rehashRange(&(parts[0]));
+    }
+    else {
+      for (unsigned t = 0; t < nthreads; t++) {
+        pthread_create(&(parts[t].thread), NULL, rehashRange, &(parts[t]));
+      }
+      for (unsigned t = 0; t < nthreads; t++) {
+        pthread_join(parts[t].thread, NULL);
+      }
+    }
+    if (! Mapped) {
+      Layout::release(oldhash, oldside);
+    }
+    freeTable(oldcold);
+    Mapped = false;
+  }
+protected:
+  // One thread's share of a rehash: cells [from, to) of the old arrays.
+  class Rehasher {
+  public:
+    OligoHash *oh;
+    typename Layout::Keys oldhash;
+    typename Layout::Sides oldside;
+    T3 *oldcold;
+    Index from, to;
+    pthread_t thread;
+  };
+  static void *rehashRange(void *arg) {
+    Rehasher *r = (Rehasher *) arg;
+    for (Index i = r->from; i < r->to; i++) {
+      if (r->oldhash[i]) {
+        Index loc = r->oh->place(r->oldhash[i]);
+        r->oh->side[loc] = r->oldside[i];
+        copySide(r->oh->cold, loc, r->oldcold, i);
+      }
+    }
+    return NULL;
+  }
+  // addInfo1 for many threads: temp is the cell as last read.  Whichever
+  // thread saturates the cell moves the count to overflow; after that,
+  // counts just go to overflow (whose adds are locked, and commute).
+  inline void addInfo1Atomic(Index location, Oligo temp, Oligo key, Index inc) {
+    while (1) {
+      Index c = getInfo1(temp);
+      if (c == Info1Mask) {
+        overflow.add(key, inc);
+        return;
+      }
+      Oligo newval = temp;
+      putInfo1(newval, c + inc);
+      Oligo prev = __sync_val_compare_and_swap(&hash[location], temp, newval);
+      if (prev == temp) {
+        if (c + inc >= Info1Mask) {
+          overflow.add(key, c + inc);
+        }
+        return;
+      }
+      temp = prev;
+    }
+  }
+  // One for a new kmer that was purged as a singleton before.
+  inline Index purgedBefore(Oligo key) {
+    return (Purged && Purged->contains(key)) ? 1 : 0;
+  }
+  // Move the kmer in cell c of bucket to the first bucket with room on its
+  // probe sequence, if that comes before this bucket (where lookups of it
+  // would stop short); close up the bucket behind it.  Returns whether it
+  // moved.  (Without buckets, a bucket is one cell and c is always 0.)
+  bool settle(Index bucket, Index c) {
+    const Index nbuckets = Size / OLIGOBUCKET;
+    Index from = bucket * OLIGOBUCKET + c;
+    Oligo key = getOligo(hash[from]);
+    Index probe = fold(key) % nbuckets;
+    Index step = primes[fold(key) % NstepPrimes];
+    for (; probe != bucket; probe = (probe + step >= nbuckets) ? (probe + step - nbuckets) : (probe + step)) {
+      if (hash[(probe + 1) * OLIGOBUCKET - 1]) {
+        continue; // bucket full
+      }
+      Index to = probe * OLIGOBUCKET;
+      while (hash[to]) {
+        to++;
+      }
+      hash[to] = hash[from];
+      side[to] = side[from];
+      copySide(cold, to, cold, from);
+      Index end = (bucket + 1) * OLIGOBUCKET;
+      for (; from + 1 < end && hash[from + 1]; from++) {
+        hash[from] = hash[from + 1];
+        side[from] = side[from + 1];
+        copySide(cold, from, cold, from + 1);
+      }
+      hash[from] = 0;
+      memset(&side[from], 0, sizeof(T2));
+      clearSide(cold, from);
+      return true;
+    }
+    return false;
+  }
+  // Claim an empty cell for a whole cell (kmer and counts) whose kmer is
+  // known not to be in the table yet, e.g. while rehashing.
+#ifdef OLIGOHASH_BUCKETS
+  Index place(Oligo cell) {
+    Oligo key = getOligo(cell);
+    const Index nbuckets = Size / OLIGOBUCKET;
+    Index bucket = fold(key) % nbuckets;
+    Index step = primes[fold(key) % NstepPrimes];
+    unsigned empty;
+    while (1) {
+      bucketScan(&hash[bucket * OLIGOBUCKET], key, ValMask, empty);
+      for (; empty; empty &= empty - 1) {
+        Index probe = bucket * OLIGOBUCKET + __builtin_ctz(empty);
+        if (! __sync_val_compare_and_swap(&hash[probe], (Oligo) 0, cell)) {
+          return probe;
+        }
+      }
+      bucket += step;
+      bucket = (bucket >= nbuckets)? (bucket - nbuckets) : bucket;
+    }
+  }
+#else
+  Index place(Oligo cell) {
+    Oligo key = getOligo(cell);
+    Index probe = fold(key) % Size;
+    Index step = primes[fold(key) % NstepPrimes];
+    while (__sync_val_compare_and_swap(&hash[probe], (Oligo) 0, cell)) {
+      probe += step;
+      probe = (probe >= Size)? (probe -= Size) : probe;
+    }
+    return probe;
+  }
+#endif
+public:
+  // Save the table and side array (not a cold array) as a snapshot that
+  // later runs can map instead of rebuilding the table.  The tag should
+  // name the side array type and whatever options decided which kmers
+  // went into the table; a snapshot is only used by a run that expects
+  // the same tag.
+  bool save(const char *name, const string &tag) {
+    OligoSnapshot::Header h;
+    h.length = Length;
+    h.info1Len = Info1Len;
+    h.info2Len = Info2Len;
+    h.info3Len = Info3Len;
+    h.slicing = Slicing;
+    h.slice = Slice;
+    h.size = Size;
+    h.distinct = distinct;
+    h.insertions = insertions;
+    h.sideSize = sizeof(T2);
+    return OligoSnapshot::write(name, h, tag, hash, side, overflow);
+  }
   void clear() {
-    memset(hash, 0, sizeof(Oligo) * Size);
+    Layout::clearCells(hash, Size);
     insertions = distinct = 0;
   }
   void dump(ostream &os, int minreport) {
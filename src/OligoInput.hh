@@ -0,0 +1,547 @@
+///////////////////////////////////////////////////////////////////////////////
+// OligoTools
+// = OligoTools for genome analysis
+// by Paul Havlak
+// copyright 2009-2013 Rice University
+//
+// OligoTools for genome analysis by Paul Havlak is licensed under a 
+// <a rel="license" href="http://creativecommons.org/licenses/by/3.0/deed.en_US">
+// Creative Commons Attribution 3.0 Unported License.
+// </a>
+//
+// OligoTools for genome analysis incorporates unpublished modules for Kmer 
+// hash tables originally developed under the Atlas Project 
+// (Atlas Whole Genome Assembly Suite) at Baylor College of Medicine
+// Human Genome Sequencing Center during 2003-2006.
+// The BCM-HGSC copyrighted predecessor is available through the 
+// Atlas WGA Suite source distribution on the HGSC web site:
+//    http://www.hgsc.bcm.tmc.edu/content/atlas-whole-genome-assembly-suite
+// 
+// Extensive modifications and additional modules, including all features
+// for SNPmer pairing and library bitvectors, were developed in the Putnam
+// Lab at Rice University:
+//    http://nputnam.web.rice.edu
+// 
+// Open-source repository: part of the Putnam Lab JAM project
+//    https://github.com/putnamlab/jam-pipeline
+//    https://github.com/putnamlab/jam-pipeline/tree/master/source
+//     
+// Contact: Paul Havlak:
+//    havlak@rice.edu
+//    havlak@alumni.rice.edu
+//    http://www.linkedin.com/in/havlak
+///////////////////////////////////////////////////////////////////////////////
+// OligoInput: an istream over a sequence or table file, gzipped or not,
+// for use wherever the tools used igzstream.
+//
+// igzstream reads through a 303-byte buffer, one gzread at a time, on the
+// calling thread.  OligoInput reads a megabyte at a time, and when the
+// file is BGZF (gzip made of independent blocks of at most 64 kB, as
+// bgzip writes) it inflates many blocks at once on a pool of
+// threads: a loader thread reads runs of blocks into batches, the pool
+// inflates (and checks) the blocks of each batch, and the stream hands
+// them on in file order (and should ordinary gzip members follow the
+// blocks, as when files are concatenated, hands the rest of the file to
+// the ring below).  Other gzip files, and plain ones, are read by
+// a producer thread, gunzipped if need be, into a ring of RINGCHUNKS chunks
+// that the stream reads from; so the tools' parsing and hashing, even
+// single-threaded, overlap reading and gunzip instead of waiting on them.
+//
+// inputThreads() sets the size of the pool for files opened after; it
+// starts as the number of processors online, at most MAXTHREADS.
+//
+
+#ifndef DEFINED_OLIGOINPUT
+#define DEFINED_OLIGOINPUT 1
+#include <zlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+inline unsigned &inputThreads() {
+  static unsigned threads = 0;
+  if (! threads) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = (n < 1) ? 1 : (n > 8) ? 8 : n;
+  }
+  return threads;
+}
+
+class OligoInputBuf : public std::streambuf {
+public:
+  static const unsigned MAXTHREADS = 8;
+  static const size_t BUFBYTES = 1 << 20;       // a chunk, of input or output
+  static const unsigned RINGCHUNKS = 4;
+  static const size_t BLOCKBYTES = 1 << 16;     // most a BGZF block holds
+  static const unsigned BATCHBLOCKS = 64;       // per thread, in a batch
+  static const unsigned NBATCHES = 3;
+
+protected:
+  // Blocks read from the file, their inflated data, and where each
+  // stands; batch b's blocks are inflated into out[i * BLOCKBYTES].
+  class Batch {
+  public:
+    std::vector<char> in;
+    std::vector<size_t> start;    // of each block in in, and its end
+    std::vector<size_t> length;   // of each block's data in out
+    std::vector<char> good;       // block inflated and checked
+    std::vector<char> out;
+    unsigned nblocks;
+    unsigned claimed;             // blocks taken by an inflating thread
+    unsigned inflated;
+    bool loaded;                  // by the loader, for inflating
+    bool last;                    // the file ends with this batch
+  };
+
+  FILE *file;
+  unsigned char head[18];       // the file's first bytes, read to identify it
+  size_t headBytes, headUsed;
+  bool opened;
+  bool bgzf;
+  bool gzipTail;                // a gzip member that isn't BGZF follows the blocks
+  std::string error;
+  bool stopping;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;       // a chunk or batch was filled or read
+
+  // gzip (or plain) into a ring of chunks
+  bool gzipped;
+  bool midMember;               // of a gzip file
+  z_stream zs;
+  std::vector<char> packed;     // gzip read from the file
+  std::vector<std::vector<char> > ring;
+  std::vector<int> filled;      // bytes in each chunk, -1 if it's free
+  unsigned producing;           // chunk the producer fills next
+  unsigned consuming;           // chunk the stream reads now
+  pthread_t producer;
+
+  // BGZF
+  std::vector<Batch> batches;
+  unsigned batchBlocks;
+  unsigned nthreads;
+  unsigned loading;             // batch the loader fills next
+  unsigned inflating;           // batch the pool takes blocks from
+  unsigned reading;             // batch the stream reads now
+  unsigned block;               // block of it the stream is on
+  pthread_t loader;
+  std::vector<pthread_t> pool;
+
+  // Read from the file, starting with the bytes read to identify it;
+  // so a pipe can be read too.
+  size_t readRaw(void *to, size_t n) {
+    size_t got = 0;
+    if (headUsed < headBytes) {
+      got = (n < headBytes - headUsed) ? n : headBytes - headUsed;
+      memcpy(to, head + headUsed, got);
+      headUsed += got;
+    }
+    return got + fread((char *) to + got, 1, n - got, file);
+  }
+
+  // A BGZF block's total size, from its header (the first 18 bytes), or 0
+  // if it is no BGZF block.
+  static size_t bgzfBlockSize(const unsigned char *h) {
+    if (h[0] != 0x1f || h[1] != 0x8b || h[2] != 8 || ! (h[3] & 4)) return 0;
+    unsigned xlen = h[10] | (h[11] << 8);
+    if (xlen < 6 || h[12] != 'B' || h[13] != 'C' || h[14] != 2 || h[15] != 0) return 0;
+    return (h[16] | (h[17] << 8)) + 1;
+  }
+
+  // Read the next run of blocks into a batch; false at the end of the file
+  bool load(Batch &b) {
+    b.in.clear();
+    b.start.clear();
+    b.nblocks = 0;
+    unsigned char h[18];
+    while (b.nblocks < batchBlocks) {
+      size_t got = readRaw(h, sizeof(h));
+      if (got == 0) return false;
+      size_t size = (got == sizeof(h)) ? bgzfBlockSize(h) : 0;
+      if (size <= sizeof(h) + 8) {
+        if (got >= 2 && h[0] == 0x1f && h[1] == 0x8b) {
+          // Ordinary gzip: the ring reads the rest, from this header on
+          memcpy(head, h, got);
+          headBytes = got;
+          headUsed = 0;
+          gzipTail = true;
+        }
+        else {
+          fail("not a BGZF block");
+        }
+        return false;
+      }
+      size_t at = b.in.size();
+      b.start.push_back(at);
+      b.in.resize(at + size);
+      memcpy(&b.in[at], h, sizeof(h));
+      if (readRaw(&b.in[at + sizeof(h)], size - sizeof(h)) != size - sizeof(h)) {
+        b.in.resize(at);
+        b.start.pop_back();
+        fail("BGZF block cut short");
+        return false;
+      }
+      b.nblocks++;
+    }
+    return true;
+  }
+  // Inflate block i of a batch, checking its length and CRC
+  void inflateBlock(Batch &b, unsigned i) {
+    const unsigned char *p = (const unsigned char *) &b.in[b.start[i]];
+    size_t size = ((i + 1 < b.nblocks) ? b.start[i + 1] : b.in.size()) - b.start[i];
+    unsigned xlen = p[10] | (p[11] << 8);
+    const unsigned char *t = p + size - 8;
+    uLong crc = t[0] | (t[1] << 8) | (t[2] << 16) | ((uLong) t[3] << 24);
+    size_t isize = t[4] | (t[5] << 8) | (t[6] << 16) | ((size_t) t[7] << 24);
+    char *out = &b.out[i * BLOCKBYTES];
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    inflateInit2(&z, -15);
+    z.next_in = (Bytef *) p + 12 + xlen;
+    z.avail_in = size - 12 - xlen - 8;
+    z.next_out = (Bytef *) out;
+    z.avail_out = BLOCKBYTES;
+    int status = inflate(&z, Z_FINISH);
+    b.length[i] = BLOCKBYTES - z.avail_out;
+    inflateEnd(&z);
+    b.good[i] = (status == Z_STREAM_END && b.length[i] == isize
+                 && crc32(0, (const Bytef *) out, b.length[i]) == crc);
+    if (! b.good[i]) {
+      fail("bad BGZF block");
+    }
+  }
+  void fail(const char *why) {
+    pthread_mutex_lock(&lock);
+    if (error.empty()) {
+      error = why;
+    }
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&lock);
+  }
+
+  static void *loaderMain(void *arg) {
+    OligoInputBuf *ib = (OligoInputBuf *) arg;
+    pthread_mutex_lock(&ib->lock);
+    while (1) {
+      // The batch after the one the stream reads must be free to fill
+      Batch *b = &ib->batches[ib->loading];
+      while (! ib->stopping && b->loaded) {
+        pthread_cond_wait(&ib->changed, &ib->lock);
+      }
+      if (ib->stopping) break;
+      pthread_mutex_unlock(&ib->lock);
+      bool more = ib->load(*b);
+      pthread_mutex_lock(&ib->lock);
+      b->claimed = b->inflated = 0;
+      b->last = ! more;
+      b->loaded = true;
+      ib->loading = (ib->loading + 1) % NBATCHES;
+      pthread_cond_broadcast(&ib->changed);
+      if (! more) break;
+    }
+    pthread_mutex_unlock(&ib->lock);
+    return NULL;
+  }
+  static void *inflaterMain(void *arg) {
+    OligoInputBuf *ib = (OligoInputBuf *) arg;
+    pthread_mutex_lock(&ib->lock);
+    while (1) {
+      // Take the next block of the batches, in the order they're loaded
+      Batch *b = &ib->batches[ib->inflating];
+      while (! ib->stopping && ! (b->loaded && b->claimed < b->nblocks)
+             && ! (b->loaded && b->last)) {
+        pthread_cond_wait(&ib->changed, &ib->lock);
+        b = &ib->batches[ib->inflating];
+      }
+      if (ib->stopping || b->claimed == b->nblocks) break;  // at the end
+      unsigned i = b->claimed++;
+      if (b->claimed == b->nblocks && ! b->last) {
+        ib->inflating = (ib->inflating + 1) % NBATCHES;
+      }
+      pthread_mutex_unlock(&ib->lock);
+      ib->inflateBlock(*b, i);
+      pthread_mutex_lock(&ib->lock);
+      if (++b->inflated == b->nblocks) {
+        pthread_cond_broadcast(&ib->changed);
+      }
+    }
+    pthread_mutex_unlock(&ib->lock);
+    return NULL;
+  }
+
+  int underflowBgzf() {
+    pthread_mutex_lock(&lock);
+    while (1) {
+      Batch &b = batches[reading];
+      while (! (b.loaded && b.inflated == b.nblocks)) {
+        pthread_cond_wait(&changed, &lock);
+      }
+      while (block < b.nblocks && b.good[block] && ! b.length[block]) {
+        block++;  // empty blocks, such as the end-of-file marker
+      }
+      if (block < b.nblocks) {
+        if (! b.good[block]) break;
+        char *out = &b.out[block * BLOCKBYTES];
+        setg(out, out, out + b.length[block]);
+        block++;
+        pthread_mutex_unlock(&lock);
+        return traits_type::to_int_type(*gptr());
+      }
+      if (b.last) {
+        if (gzipTail && error.empty()) {
+          pthread_mutex_unlock(&lock);
+          switchToRing();
+          return underflowRing();
+        }
+        break;
+      }
+      // Done with this batch: back to the loader with it
+      b.loaded = false;
+      reading = (reading + 1) % NBATCHES;
+      block = 0;
+      pthread_cond_broadcast(&changed);
+    }
+    pthread_mutex_unlock(&lock);
+    return endOfInput();
+  }
+
+  // At the end of the input, say if it ended early (once)
+  int endOfInput() {
+    pthread_mutex_lock(&lock);
+    std::string why;
+    why.swap(error);
+    pthread_mutex_unlock(&lock);
+    if (! why.empty()) {
+      std::cerr << "OligoInput: " << why << "; reading no further." << std::endl;
+    }
+    return traits_type::eof();
+  }
+
+  // Fill a chunk from a gzip or plain file; 0 at the end.  Like gzread,
+  // this reads gzip files of many members, and stops at anything after
+  // the last one that isn't gzip.
+  size_t readChunk(char *out) {
+    if (! gzipped) {
+      return readRaw(out, BUFBYTES);
+    }
+    zs.next_out = (Bytef *) out;
+    zs.avail_out = BUFBYTES;
+    while (zs.avail_out) {
+      if (! zs.avail_in) {
+        zs.avail_in = readRaw(&packed[0], packed.size());
+        zs.next_in = (Bytef *) &packed[0];
+        if (! zs.avail_in) {
+          if (midMember) {
+            fail("gzip file cut short");
+          }
+          break;
+        }
+      }
+      if (! midMember) {
+        if (zs.next_in[0] != 0x1f) {
+          zs.avail_in = 0;  // not another member
+          break;
+        }
+        inflateReset(&zs);
+        midMember = true;
+      }
+      int status = inflate(&zs, Z_NO_FLUSH);
+      if (status == Z_STREAM_END) {
+        midMember = false;
+      }
+      else if (status != Z_OK && status != Z_BUF_ERROR) {
+        fail("bad gzip data");
+        break;
+      }
+    }
+    return BUFBYTES - zs.avail_out;
+  }
+
+  static void *producerMain(void *arg) {
+    OligoInputBuf *ib = (OligoInputBuf *) arg;
+    pthread_mutex_lock(&ib->lock);
+    while (1) {
+      unsigned c = ib->producing;
+      while (! ib->stopping && ib->filled[c] >= 0) {
+        pthread_cond_wait(&ib->changed, &ib->lock);
+      }
+      if (ib->stopping) break;
+      pthread_mutex_unlock(&ib->lock);
+      size_t n = ib->readChunk(&ib->ring[c][0]);
+      pthread_mutex_lock(&ib->lock);
+      ib->filled[c] = n;
+      ib->producing = (c + 1) % RINGCHUNKS;
+      pthread_cond_broadcast(&ib->changed);
+      if (! n) break;  // an empty chunk ends the input
+    }
+    pthread_mutex_unlock(&ib->lock);
+    return NULL;
+  }
+
+  int underflowRing() {
+    pthread_mutex_lock(&lock);
+    if (eback()) {
+      // Done with this chunk: back to the producer with it
+      if (filled[consuming] == 0) {
+        pthread_mutex_unlock(&lock);
+        return endOfInput();
+      }
+      filled[consuming] = -1;
+      consuming = (consuming + 1) % RINGCHUNKS;
+      pthread_cond_broadcast(&changed);
+    }
+    while (filled[consuming] < 0) {
+      pthread_cond_wait(&changed, &lock);
+    }
+    char *p = &ring[consuming][0];
+    setg(p, p, p + filled[consuming]);
+    pthread_mutex_unlock(&lock);
+    if (gptr() == egptr()) return endOfInput();
+    return traits_type::to_int_type(*gptr());
+  }
+
+  void startRing() {
+    gzipped = (headBytes >= 2 && head[0] == 0x1f && head[1] == 0x8b);
+    midMember = false;
+    if (gzipped) {
+      memset(&zs, 0, sizeof(zs));
+      inflateInit2(&zs, 15 + 16);
+      packed.resize(BUFBYTES);
+    }
+    ring.resize(RINGCHUNKS);
+    filled.assign(RINGCHUNKS, -1);
+    for (unsigned c = 0; c < RINGCHUNKS; c++) {
+      ring[c].resize(BUFBYTES);
+    }
+    producing = consuming = 0;
+    pthread_create(&producer, NULL, producerMain, this);
+  }
+
+  void startBgzf() {
+    nthreads = inputThreads();
+    if (nthreads > MAXTHREADS) nthreads = MAXTHREADS;
+    if (nthreads < 1) nthreads = 1;
+    batchBlocks = BATCHBLOCKS * nthreads;
+    batches.resize(NBATCHES);
+    for (unsigned b = 0; b < NBATCHES; b++) {
+      batches[b].out.resize(batchBlocks * BLOCKBYTES);
+      batches[b].length.resize(batchBlocks);
+      batches[b].good.resize(batchBlocks);
+      batches[b].nblocks = batches[b].claimed = batches[b].inflated = 0;
+      batches[b].loaded = batches[b].last = false;
+    }
+    loading = inflating = reading = block = 0;
+    pthread_create(&loader, NULL, loaderMain, this);
+    pool.resize(nthreads);
+    for (unsigned t = 0; t < nthreads; t++) {
+      pthread_create(&pool[t], NULL, inflaterMain, this);
+    }
+  }
+
+  // After the last BGZF block, read the gzip members that follow through
+  // the ring; the loader and pool are done by then.
+  void switchToRing() {
+    pthread_join(loader, NULL);
+    for (unsigned t = 0; t < pool.size(); t++) {
+      pthread_join(pool[t], NULL);
+    }
+    pool.clear();
+    batches.clear();
+    bgzf = false;
+    setg(0, 0, 0);
+    startRing();
+  }
+
+public:
+  OligoInputBuf() : file(0), opened(false), bgzf(false), gzipTail(false) { }
+  ~OligoInputBuf() { close(); }
+
+  bool is_open() { return opened; }
+
+  OligoInputBuf *open(const char *name) {
+    if (opened) return 0;
+    error.clear();
+    file = fopen(name, "rb");
+    if (! file) return 0;
+    headBytes = fread(head, 1, sizeof(head), file);
+    headUsed = 0;
+    bgzf = (headBytes == sizeof(head) && bgzfBlockSize(head));
+    gzipTail = false;
+    setg(0, 0, 0);
+    stopping = false;
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&changed, NULL);
+    if (bgzf) {
+      startBgzf();
+    }
+    else {
+      startRing();
+    }
+    opened = true;
+    return this;
+  }
+  OligoInputBuf *close() {
+    if (! opened) return 0;
+    opened = false;
+    pthread_mutex_lock(&lock);
+    stopping = true;
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&lock);
+    if (bgzf) {
+      pthread_join(loader, NULL);
+      for (unsigned t = 0; t < pool.size(); t++) {
+        pthread_join(pool[t], NULL);
+      }
+      pool.clear();
+      batches.clear();
+    }
+    else {
+      pthread_join(producer, NULL);
+      ring.clear();
+      if (gzipped) {
+        inflateEnd(&zs);
+        packed.clear();
+      }
+    }
+    fclose(file);
+    file = 0;
+    pthread_mutex_destroy(&lock);
+    pthread_cond_destroy(&changed);
+    setg(0, 0, 0);
+    return this;
+  }
+
+  virtual int underflow() {
+    if (gptr() && gptr() < egptr()) {
+      return traits_type::to_int_type(*gptr());
+    }
+    if (! opened) return traits_type::eof();
+    return bgzf ? underflowBgzf() : underflowRing();
+  }
+};
+
+class OligoInput : public std::istream {
+protected:
+  OligoInputBuf buf;
+public:
+  OligoInput() : std::istream(&buf) { }
+  OligoInput(const char *name) : std::istream(&buf) {
+    open(name);
+  }
+  OligoInputBuf *rdbuf() { return &buf; }
+  void open(const char *name) {
+    if (! buf.open(name)) {
+      clear(rdstate() | std::ios::badbit);
+    }
+  }
+  void close() {
+    if (buf.is_open() && ! buf.close()) {
+      clear(rdstate() | std::ios::badbit);
+    }
+  }
+};
+#endif
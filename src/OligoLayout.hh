@@ -0,0 +1,148 @@
+///////////////////////////////////////////////////////////////////////////////
+// OligoTools
+// = OligoTools for genome analysis
+// by Paul Havlak
+// copyright 2009-2013 Rice University
+//
+// OligoTools for genome analysis by Paul Havlak is licensed under a 
+// <a rel="license" href="http://creativecommons.org/licenses/by/3.0/deed.en_US">
+// Creative Commons Attribution 3.0 Unported License.
+// </a>
+//
+// OligoTools for genome analysis incorporates unpublished modules for Kmer 
+// hash tables originally developed under the Atlas Project 
+// (Atlas Whole Genome Assembly Suite) at Baylor College of Medicine
+// Human Genome Sequencing Center during 2003-2006.
+// The BCM-HGSC copyrighted predecessor is available through the 
+// Atlas WGA Suite source distribution on the HGSC web site:
+//    http://www.hgsc.bcm.tmc.edu/content/atlas-whole-genome-assembly-suite
+// 
+// Extensive modifications and additional modules, including all features
+// for SNPmer pairing and library bitvectors, were developed in the Putnam
+// Lab at Rice University:
+//    http://nputnam.web.rice.edu
+// 
+// Open-source repository: part of the Putnam Lab JAM project
+//    https://github.com/putnamlab/jam-pipeline
+//    https://github.com/putnamlab/jam-pipeline/tree/master/source
+//     
+// Contact: Paul Havlak:
+//    havlak@rice.edu
+//    havlak@alumni.rice.edu
+//    http://www.linkedin.com/in/havlak
+///////////////////////////////////////////////////////////////////////////////
+// Cell layouts for OligoHash<T2, T3, Layout> of OligoHashSide.hh: where a
+// table keeps its cells (kmers with their counts) and the side entries
+// of the cells.
+//
+// SplitCells keeps them in two arrays, hash[] and side[], so a lookup
+// followed by a look at the kmer's side entry misses the cache twice, in
+// places far apart.  InterleavedCells keeps them in blocks of one bucket
+// of OLIGOBUCKET cells (just one cell without OLIGOHASH_BUCKETS) followed
+// by the side entries of those cells: the side entry is then in the same
+// cache line as its cell, or the next one.  The cells of a bucket stay
+// together, for bucketScan.
+//
+// Either way, a table's hash[i] and side[i] are references to cell i and
+// its side entry; code that needs their addresses takes &hash[i], since
+// hash + i only works for SplitCells.  SplitCells is the default, unless
+// built with -DOLIGOHASH_INTERLEAVED (see DefaultCells).  Only SplitCells
+// tables can be saved as, or mapped from, snapshots.
+//
+
+#ifndef DEFINED_OLIGOLAYOUT
+#define DEFINED_OLIGOLAYOUT 1
+#include "Oligos.hh"
+#include "OligoBucket.hh"
+#include <stdlib.h>
+#include <string.h>
+
+template<class T2> class SplitCells {
+public:
+  typedef Oligos::Oligo Oligo;
+  typedef Oligo *Keys;
+  typedef T2 *Sides;
+  static const bool INTERLEAVED = false;
+
+  // n cells (a multiple of OLIGOBUCKET) and their side entries, all 0,
+  // placed as tablePolicy() says for a table of the given slice
+  static bool alloc(size_t n, Keys &hash, Sides &side, size_t slice) {
+    hash = allocCells(n, slice);
+    side = (T2 *) allocTable(sizeof(T2) * n, 16, slice);
+    return hash && side;
+  }
+  static void release(Keys hash, Sides side) {
+    freeTable(hash);
+    freeTable(side);
+  }
+  // Index of a cell, from its address
+  static inline size_t indexOf(Keys hash, const Oligo *cell) {
+    return cell - hash;
+  }
+  static void clearCells(Keys hash, size_t n) {
+    memset(hash, 0, sizeof(Oligo) * n);
+  }
+};
+
+template<class T2> class InterleavedCells {
+public:
+  typedef Oligos::Oligo Oligo;
+  static const bool INTERLEAVED = true;
+
+  // Aligned like a bucket, for bucketScan
+  class Block {
+  public:
+    Oligo cell[OLIGOBUCKET];
+    T2 side[OLIGOBUCKET];
+  } __attribute__ ((aligned (OLIGOBUCKET * sizeof(Oligo))));
+
+  class Keys {
+  public:
+    Block *blocks;
+    void *base;         // as allocated, for freeTable
+    Keys(Block *b = 0) : blocks(b), base(b) { }
+    inline Oligo &operator[](size_t i) const {
+      return blocks[i / OLIGOBUCKET].cell[i % OLIGOBUCKET];
+    }
+  };
+  class Sides {
+  public:
+    Block *blocks;
+    Sides(Block *b = 0) : blocks(b) { }
+    inline T2 &operator[](size_t i) const {
+      return blocks[i / OLIGOBUCKET].side[i % OLIGOBUCKET];
+    }
+  };
+
+  // Unaligned (calloc, by default), and aligned here, so that a big
+  // table's pages are only zeroed as they are first touched
+  static bool alloc(size_t n, Keys &hash, Sides &side, size_t slice) {
+    size_t align = __alignof__(Block);
+    void *p = allocTable(sizeof(Block) * (n / OLIGOBUCKET) + align, 16, slice);
+    if (! p) {
+      return false;
+    }
+    hash.base = p;
+    hash.blocks = side.blocks = (Block *) (((size_t) p + align - 1) & ~(align - 1));
+    return true;
+  }
+  static void release(Keys hash, Sides side) {
+    freeTable(hash.base);
+  }
+  static inline size_t indexOf(Keys hash, const Oligo *cell) {
+    size_t offset = (const char *) cell - (const char *) hash.blocks;
+    return (offset / sizeof(Block)) * OLIGOBUCKET + (offset % sizeof(Block)) / sizeof(Oligo);
+  }
+  static void clearCells(Keys hash, size_t n) {
+    for (size_t b = 0; b < n / OLIGOBUCKET; b++) {
+      memset(hash.blocks[b].cell, 0, sizeof(hash.blocks[b].cell));
+    }
+  }
+};
+
+#ifdef OLIGOHASH_INTERLEAVED
+template<class T2> class DefaultCells: public InterleavedCells<T2> { };
+#else
+template<class T2> class DefaultCells: public SplitCells<T2> { };
+#endif
+#endif
@@ -0,0 +1,312 @@
+///////////////////////////////////////////////////////////////////////////////
+// OligoTools
+// = OligoTools for genome analysis
+// by Paul Havlak
+// copyright 2009-2013 Rice University
+//
+// OligoTools for genome analysis by Paul Havlak is licensed under a 
+// <a rel="license" href="http://creativecommons.org/licenses/by/3.0/deed.en_US">
+// Creative Commons Attribution 3.0 Unported License.
+// </a>
+//
+// OligoTools for genome analysis incorporates unpublished modules for Kmer 
+// hash tables originally developed under the Atlas Project 
+// (Atlas Whole Genome Assembly Suite) at Baylor College of Medicine
+// Human Genome Sequencing Center during 2003-2006.
+// The BCM-HGSC copyrighted predecessor is available through the 
+// Atlas WGA Suite source distribution on the HGSC web site:
+//    http://www.hgsc.bcm.tmc.edu/content/atlas-whole-genome-assembly-suite
+// 
+// Extensive modifications and additional modules, including all features
+// for SNPmer pairing and library bitvectors, were developed in the Putnam
+// Lab at Rice University:
+//    http://nputnam.web.rice.edu
+// 
+// Open-source repository: part of the Putnam Lab JAM project
+//    https://github.com/putnamlab/jam-pipeline
+//    https://github.com/putnamlab/jam-pipeline/tree/master/source
+//     
+// Contact: Paul Havlak:
+//    havlak@rice.edu
+//    havlak@alumni.rice.edu
+//    http://www.linkedin.com/in/havlak
+///////////////////////////////////////////////////////////////////////////////
+// Memory for the big arrays of a table: cells, side and cold arrays.
+//
+// By default these come from calloc (or posix_memalign, when they must be
+// aligned to cache lines), as they always have.  A table of tens of GB
+// then gets 4 kB pages, so that random probes miss the TLB as well as
+// the cache; lands on whichever NUMA node first touches each page; and
+// is zeroed, lazily, by whichever thread gets there first.  The policy
+// set with TablePolicy::parse (the -N option of the Genome* tools) maps
+// big arrays directly instead, with:
+//
+//   huge          transparent huge pages (madvise MADV_HUGEPAGE)
+//   huge2m        reserved 2 MB huge pages (MAP_HUGETLB; see
+//   huge1g        reserved 1 GB huge pages   /proc/sys/vm/nr_hugepages),
+//                 falling back to transparent ones if none are left
+//   interleave    pages spread round-robin across the NUMA nodes
+//   bind          each slice's arrays on node Slice % nodes
+//   touch=N       pages faulted in (zeroed) up front by N threads
+//
+// and reports to cerr which pages and nodes each array actually got.
+// Arrays from allocTable must be freed with freeTable.
+//
+
+#ifndef DEFINED_OLIGOMEMORY
+#define DEFINED_OLIGOMEMORY 1
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MPOL_BIND
+#define MPOL_BIND 2
+#define MPOL_INTERLEAVE 3
+#endif
+
+class TablePolicy {
+public:
+  typedef enum { SMALLPAGES, HUGEPAGES, HUGETLB2M, HUGETLB1G } PageKind;
+  typedef enum { FIRSTTOUCH, INTERLEAVE, BIND } Placement;
+  PageKind pages;
+  Placement placement;
+  unsigned touchThreads;  // 0: pages are zeroed as they are first used
+  std::string spec;       // as given to parse
+
+  TablePolicy() : pages(SMALLPAGES), placement(FIRSTTOUCH), touchThreads(0), spec("default") { }
+
+  // Arrays are only mapped under a policy, and only if at least this big
+  static const size_t MINMAPPED = 1 << 21;
+
+  bool isDefault() const {
+    return pages == SMALLPAGES && placement == FIRSTTOUCH && touchThreads == 0;
+  }
+  // Set the policy from a comma-separated list of the words above;
+  // false if one isn't recognized.
+  bool parse(const std::string &words) {
+    std::stringstream in(words);
+    std::string word;
+    while (getline(in, word, ',')) {
+      if (word == "huge") pages = HUGEPAGES;
+      else if (word == "huge2m") pages = HUGETLB2M;
+      else if (word == "huge1g") pages = HUGETLB1G;
+      else if (word == "interleave") placement = INTERLEAVE;
+      else if (word == "bind") placement = BIND;
+      else if (word.compare(0, 6, "touch=") == 0) touchThreads = strtol(word.c_str() + 6, NULL, 0);
+      else if (word != "default") return false;
+    }
+    spec = words;
+    return true;
+  }
+};
+
+// The policy of all tables in the process; set it before making any.
+inline TablePolicy &tablePolicy() {
+  static TablePolicy policy;
+  return policy;
+}
+
+// Arrays mapped by allocTable, with their mapped sizes, for freeTable.
+inline std::map<void *, size_t> &mappedTables() {
+  static std::map<void *, size_t> mapped;
+  return mapped;
+}
+inline pthread_mutex_t *mappedTablesLock() {
+  static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+  return &lock;
+}
+
+// Number of NUMA nodes (1 if the kernel doesn't say)
+inline unsigned numaNodes() {
+  static unsigned nodes = 0;
+  if (! nodes) {
+    DIR *dir = opendir("/sys/devices/system/node");
+    if (dir) {
+      struct dirent *entry;
+      while ((entry = readdir(dir))) {
+        if (strncmp(entry->d_name, "node", 4) == 0 && entry->d_name[4] >= '0' && entry->d_name[4] <= '9') {
+          nodes++;
+        }
+      }
+      closedir(dir);
+    }
+    if (! nodes) nodes = 1;
+  }
+  return nodes;
+}
+
+// One thread's share of faulting in an array: bytes [from, to).
+class TableToucher {
+public:
+  volatile char *base;
+  size_t from, to, step;
+  pthread_t thread;
+};
+inline void *touchRange(void *arg) {
+  TableToucher *t = (TableToucher *) arg;
+  for (size_t b = t->from; b < t->to; b += t->step) {
+    t->base[b] = 0;
+  }
+  return NULL;
+}
+
+// Print the page sizes and NUMA nodes an array at p got, from the
+// kernel's smaps and numa_maps entries for the mapping holding it.
+inline void reportTable(std::ostream &os, void *p, size_t bytes) {
+  size_t at = (size_t) p;
+  std::string line, pageSize, hugeBytes, nodes;
+  std::ifstream smaps("/proc/self/smaps");
+  bool inside = false;
+  while (getline(smaps, line)) {
+    unsigned long start, end;
+    if (sscanf(line.c_str(), "%lx-%lx ", &start, &end) == 2) {
+      if (inside) break;
+      inside = (start <= at && at < end);
+    }
+    else if (inside && line.compare(0, 15, "KernelPageSize:") == 0) {
+      pageSize = line.substr(line.find_first_not_of(' ', 15) - 1);
+    }
+    else if (inside && line.compare(0, 14, "AnonHugePages:") == 0) {
+      hugeBytes = line.substr(line.find_first_not_of(' ', 14) - 1);
+    }
+  }
+  std::ifstream numaMaps("/proc/self/numa_maps");
+  while (getline(numaMaps, line)) {
+    if (strtoul(line.c_str(), NULL, 16) == at) {
+      std::stringstream fields(line);
+      std::string address, mode, field;
+      fields >> address >> mode;
+      while (fields >> field) {
+        if (field[0] == 'N' && field.find('=') != std::string::npos) {
+          nodes += " " + field;
+        }
+      }
+      if (! nodes.empty()) {
+        nodes += " (" + mode + ")";
+      }
+      break;
+    }
+  }
+  os << "OligoMemory: " << bytes << " bytes at " << p << ":"
+     << " page size" << pageSize << ", transparent huge pages" << hugeBytes
+     << ", pages on nodes" << (nodes.empty() ? " (none touched yet)" : nodes) << std::endl;
+}
+
+// bytes of zeroed memory, aligned to align bytes (at most 64); slice
+// picks the NUMA node for bind placement.
+inline void *allocTable(size_t bytes, size_t align = 16, size_t slice = 0) {
+  TablePolicy &policy = tablePolicy();
+  if (policy.isDefault() || bytes < TablePolicy::MINMAPPED) {
+    if (align <= 16) {
+      return calloc(bytes ? bytes : 1, 1);
+    }
+    void *p = 0;
+    if (posix_memalign(&p, align, bytes ? bytes : 1)) {
+      return 0;
+    }
+    memset(p, 0, bytes);
+    return p;
+  }
+
+  // Mapped: zeroed, and aligned to a page
+  size_t length = bytes;
+  void *p = MAP_FAILED;
+  if (policy.pages == TablePolicy::HUGETLB2M || policy.pages == TablePolicy::HUGETLB1G) {
+    int shift = (policy.pages == TablePolicy::HUGETLB1G) ? 30 : 21;
+    size_t pageBytes = (size_t) 1 << shift;
+    length = (bytes + pageBytes - 1) & ~(pageBytes - 1);
+    p = mmap(0, length, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (shift << MAP_HUGE_SHIFT), -1, 0);
+    if (p == MAP_FAILED) {
+      std::cerr << "OligoMemory: no reserved " << (pageBytes >> 20)
+                << " MB huge pages for " << bytes << " bytes; using transparent huge pages." << std::endl;
+      length = bytes;
+    }
+  }
+  if (p == MAP_FAILED) {
+    p = mmap(0, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+      return 0;
+    }
+    if (policy.pages != TablePolicy::SMALLPAGES) {
+      madvise(p, length, MADV_HUGEPAGE);
+    }
+  }
+
+  unsigned nodes = numaNodes();
+  if (policy.placement != TablePolicy::FIRSTTOUCH && nodes > 1) {
+    unsigned long mask[16] = { 0 };
+    unsigned maxnode = (sizeof mask) * 8;
+    int mode = MPOL_INTERLEAVE;
+    if (policy.placement == TablePolicy::BIND) {
+      unsigned node = slice % nodes;
+      mask[node / 64] = 1UL << (node % 64);
+      mode = MPOL_BIND;
+    }
+    else {
+      for (unsigned node = 0; node < nodes && node < maxnode; node++) {
+        mask[node / 64] |= 1UL << (node % 64);
+      }
+    }
+    if (syscall(SYS_mbind, p, length, mode, mask, maxnode, 0)) {
+      std::cerr << "OligoMemory: couldn't set NUMA placement (mbind failed); using first touch." << std::endl;
+    }
+  }
+
+  if (policy.touchThreads > 0) {
+    unsigned nthreads = policy.touchThreads;
+    size_t step = sysconf(_SC_PAGESIZE);
+    size_t pages = (length + step - 1) / step;
+    std::vector<TableToucher> parts(nthreads);
+    for (unsigned t = 0; t < nthreads; t++) {
+      parts[t].base = (volatile char *) p;
+      parts[t].from = pages * t / nthreads * step;
+      parts[t].to = pages * (t + 1) / nthreads * step;
+      parts[t].step = step;
+      pthread_create(&(parts[t].thread), NULL, touchRange, &(parts[t]));
+    }
+    for (unsigned t = 0; t < nthreads; t++) {
+      pthread_join(parts[t].thread, NULL);
+    }
+  }
+
+  pthread_mutex_lock(mappedTablesLock());
+  mappedTables()[p] = length;
+  pthread_mutex_unlock(mappedTablesLock());
+  reportTable(std::cerr, p, length);
+  return p;
+}
+
+// Free an array from allocTable
+inline void freeTable(void *p) {
+  if (! p) return;
+  pthread_mutex_lock(mappedTablesLock());
+  std::map<void *, size_t>::iterator m = mappedTables().find(p);
+  size_t length = 0;
+  if (m != mappedTables().end()) {
+    length = m->second;
+    mappedTables().erase(m);
+  }
+  pthread_mutex_unlock(mappedTablesLock());
+  if (length) {
+    munmap(p, length);
+  }
+  else {
+    free(p);
+  }
+}
+#endif
@@ -0,0 +1,316 @@
+///////////////////////////////////////////////////////////////////////////////
+// OligoTools
+// = OligoTools for genome analysis
+// by Paul Havlak
+// copyright 2009-2013 Rice University
+//
+// OligoTools for genome analysis by Paul Havlak is licensed under a 
+// <a rel="license" href="http://creativecommons.org/licenses/by/3.0/deed.en_US">
+// Creative Commons Attribution 3.0 Unported License.
+// </a>
+//
+// OligoTools for genome analysis incorporates unpublished modules for Kmer 
+// hash tables originally developed under the Atlas Project 
+// (Atlas Whole Genome Assembly Suite) at Baylor College of Medicine
+// Human Genome Sequencing Center during 2003-2006.
+// The BCM-HGSC copyrighted predecessor is available through the 
+// Atlas WGA Suite source distribution on the HGSC web site:
+//    http://www.hgsc.bcm.tmc.edu/content/atlas-whole-genome-assembly-suite
+// 
+// Extensive modifications and additional modules, including all features
+// for SNPmer pairing and library bitvectors, were developed in the Putnam
+// Lab at Rice University:
+//    http://nputnam.web.rice.edu
+// 
+// Open-source repository: part of the Putnam Lab JAM project
+//    https://github.com/putnamlab/jam-pipeline
+//    https://github.com/putnamlab/jam-pipeline/tree/master/source
+//     
+// Contact: Paul Havlak:
+//    havlak@rice.edu
+//    havlak@alumni.rice.edu
+//    http://www.linkedin.com/in/havlak
+///////////////////////////////////////////////////////////////////////////////
+// OligoOutput: an ostream for the tools' big text outputs (kmer reports,
+// edge and walk files) that takes writing, and compressing, off the
+// thread producing the text.
+//
+// The stream fills a chunk at a time and hands each full chunk on; a
+// writer thread writes the chunks out in order.  If the output is to be
+// compressed (a name ending in ".gz", or open(name, true)) the chunks
+// are BGZF blocks, deflated several at once by a pool of outputThreads()
+// threads, so the file is ordinary gzip (and OligoInput reads it back in
+// parallel).  The stream only waits when every chunk is in flight.
+//
+// Data go out in whole chunks: flushing (endl included) does not cut a
+// chunk short, and the last one is written by close(), which main must
+// call before exit() (or the destructor, if it runs).  "-" is standard
+// output.
+//
+
+#ifndef DEFINED_OLIGOOUTPUT
+#define DEFINED_OLIGOOUTPUT 1
+#include <zlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+inline unsigned &outputThreads() {
+  static unsigned threads = 0;
+  if (! threads) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = (n < 1) ? 1 : (n > 8) ? 8 : n;
+  }
+  return threads;
+}
+
+class OligoOutputBuf : public std::streambuf {
+public:
+  static const unsigned MAXTHREADS = 8;
+  static const size_t BLOCKDATA = 0xff00;       // per BGZF block, as bgzip
+  static const size_t PLAINBYTES = 1 << 20;     // per chunk, uncompressed
+  static const unsigned SLOTSPERTHREAD = 4;
+
+protected:
+  enum SlotState { FREE, FILLED, CLAIMED, READY };
+  class Slot {
+  public:
+    std::vector<char> data;
+    std::vector<char> packed;     // the BGZF block, when compressing
+    size_t used;
+    size_t packedBytes;
+    SlotState state;
+  };
+
+  FILE *file;
+  bool opened;
+  bool compress;
+  bool closing;
+  bool failed;
+  std::vector<Slot> slots;
+  unsigned filling;             // slot the stream writes into
+  unsigned deflating;           // slot the pool takes next
+  unsigned writing;             // slot the writer writes next
+  pthread_t writer;
+  std::vector<pthread_t> pool;
+  pthread_mutex_t lock;
+  pthread_cond_t changed;       // a slot changed state, or closing
+
+  // Deflate a slot's data as one BGZF block
+  void pack(Slot &s) {
+    static const unsigned char header[18] = {
+      0x1f, 0x8b, 8, 4, 0, 0, 0, 0, 0, 0xff, 6, 0, 'B', 'C', 2, 0, 0, 0 };
+    unsigned char *p = (unsigned char *) &s.packed[0];
+    memcpy(p, header, sizeof(header));
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+    z.next_in = (Bytef *) &s.data[0];
+    z.avail_in = s.used;
+    z.next_out = p + sizeof(header);
+    z.avail_out = s.packed.size() - sizeof(header) - 8;
+    deflate(&z, Z_FINISH);
+    size_t size = sizeof(header) + z.total_out + 8;
+    deflateEnd(&z);
+    p[16] = (size - 1) & 0xff;
+    p[17] = (size - 1) >> 8;
+    uLong crc = crc32(0, (const Bytef *) &s.data[0], s.used);
+    unsigned char *t = p + size - 8;
+    for (int b = 0; b < 4; b++) {
+      t[b] = (crc >> (8 * b)) & 0xff;
+      t[4 + b] = (s.used >> (8 * b)) & 0xff;
+    }
+    s.packedBytes = size;
+  }
+
+  static void *packerMain(void *arg) {
+    OligoOutputBuf *ob = (OligoOutputBuf *) arg;
+    pthread_mutex_lock(&ob->lock);
+    while (1) {
+      Slot *s = &ob->slots[ob->deflating];
+      while (s->state != FILLED && ! ob->closing) {
+        pthread_cond_wait(&ob->changed, &ob->lock);
+        s = &ob->slots[ob->deflating];
+      }
+      if (s->state != FILLED) break;  // closing, with every chunk taken
+      s->state = CLAIMED;
+      ob->deflating = (ob->deflating + 1) % ob->slots.size();
+      pthread_mutex_unlock(&ob->lock);
+      ob->pack(*s);
+      pthread_mutex_lock(&ob->lock);
+      s->state = READY;
+      pthread_cond_broadcast(&ob->changed);
+    }
+    pthread_mutex_unlock(&ob->lock);
+    return NULL;
+  }
+  static void *writerMain(void *arg) {
+    OligoOutputBuf *ob = (OligoOutputBuf *) arg;
+    pthread_mutex_lock(&ob->lock);
+    while (1) {
+      Slot *s = &ob->slots[ob->writing];
+      while (s->state != READY && ! (ob->closing && s->state == FREE)) {
+        pthread_cond_wait(&ob->changed, &ob->lock);
+      }
+      if (s->state != READY) break;  // closing, with every chunk written
+      pthread_mutex_unlock(&ob->lock);
+      const char *from = ob->compress ? &s->packed[0] : &s->data[0];
+      size_t bytes = ob->compress ? s->packedBytes : s->used;
+      bool ok = (fwrite(from, 1, bytes, ob->file) == bytes);
+      pthread_mutex_lock(&ob->lock);
+      if (! ok && ! ob->failed) {
+        ob->failed = true;
+        std::cerr << "OligoOutput: write failed; output is incomplete." << std::endl;
+      }
+      s->state = FREE;
+      ob->writing = (ob->writing + 1) % ob->slots.size();
+      pthread_cond_broadcast(&ob->changed);
+    }
+    pthread_mutex_unlock(&ob->lock);
+    return NULL;
+  }
+
+  // Hand the chunk being filled on, and wait for the next to be free.
+  // At the end, compressed output ends with an empty block, BGZF's
+  // end-of-file marker.
+  void submit(bool last) {
+    pthread_mutex_lock(&lock);
+    Slot *s = &slots[filling];
+    s->used = pptr() - pbase();
+    if (s->used) {
+      s->state = compress ? FILLED : READY;
+      filling = (filling + 1) % slots.size();
+      pthread_cond_broadcast(&changed);
+    }
+    while (slots[filling].state != FREE) {
+      pthread_cond_wait(&changed, &lock);
+    }
+    s = &slots[filling];
+    if (last && compress) {
+      s->used = 0;
+      s->state = FILLED;
+      filling = (filling + 1) % slots.size();
+      pthread_cond_broadcast(&changed);
+    }
+    setp(&s->data[0], &s->data[0] + s->data.size());
+    pthread_mutex_unlock(&lock);
+  }
+
+public:
+  OligoOutputBuf() : file(0), opened(false), compress(false) { }
+  ~OligoOutputBuf() { close(); }
+
+  bool is_open() { return opened; }
+
+  OligoOutputBuf *open(const char *name, bool compressed) {
+    if (opened) return 0;
+    file = strcmp(name, "-") ? fopen(name, "wb") : stdout;
+    if (! file) return 0;
+    compress = compressed;
+    closing = failed = false;
+    unsigned nthreads = compress ? outputThreads() : 1;
+    if (nthreads > MAXTHREADS) nthreads = MAXTHREADS;
+    if (nthreads < 1) nthreads = 1;
+    slots.resize(SLOTSPERTHREAD * nthreads);
+    for (unsigned i = 0; i < slots.size(); i++) {
+      slots[i].data.resize(compress ? BLOCKDATA : PLAINBYTES);
+      if (compress) {
+        slots[i].packed.resize(compressBound(BLOCKDATA) + 18 + 8);
+      }
+      slots[i].state = FREE;
+    }
+    filling = deflating = writing = 0;
+    setp(&slots[0].data[0], &slots[0].data[0] + slots[0].data.size());
+    pthread_mutex_init(&lock, NULL);
+    pthread_cond_init(&changed, NULL);
+    pthread_create(&writer, NULL, writerMain, this);
+    pool.resize(compress ? nthreads : 0);
+    for (unsigned t = 0; t < pool.size(); t++) {
+      pthread_create(&pool[t], NULL, packerMain, this);
+    }
+    opened = true;
+    return this;
+  }
+  OligoOutputBuf *close() {
+    if (! opened) return 0;
+    opened = false;
+    submit(true);
+    pthread_mutex_lock(&lock);
+    closing = true;
+    pthread_cond_broadcast(&changed);
+    pthread_mutex_unlock(&lock);
+    for (unsigned t = 0; t < pool.size(); t++) {
+      pthread_join(pool[t], NULL);
+    }
+    pthread_join(writer, NULL);
+    pool.clear();
+    slots.clear();
+    pthread_mutex_destroy(&lock);
+    pthread_cond_destroy(&changed);
+    setp(0, 0);
+    bool ok = ! failed && (file == stdout ? fflush(file) : fclose(file)) == 0;
+    file = 0;
+    return ok ? this : 0;
+  }
+
+  virtual int overflow(int c) {
+    if (! opened) return traits_type::eof();
+    submit(false);
+    if (! traits_type::eq_int_type(c, traits_type::eof())) {
+      *pptr() = traits_type::to_char_type(c);
+      pbump(1);
+    }
+    return traits_type::not_eof(c);
+  }
+  virtual std::streamsize xsputn(const char *s, std::streamsize n) {
+    std::streamsize done = 0;
+    while (done < n) {
+      std::streamsize room = epptr() - pptr();
+      if (! room) {
+        if (! opened) break;
+        submit(false);
+        continue;
+      }
+      if (room > n - done) room = n - done;
+      memcpy(pptr(), s + done, room);
+      pbump(room);
+      done += room;
+    }
+    return done;
+  }
+  virtual int sync() { return 0; }  // chunks go out whole; see above
+};
+
+class OligoOutput : public std::ostream {
+protected:
+  OligoOutputBuf buf;
+public:
+  OligoOutput() : std::ostream(&buf) { }
+  OligoOutput(const char *name) : std::ostream(&buf) {
+    open(name);
+  }
+  OligoOutput(const char *name, bool compressed) : std::ostream(&buf) {
+    open(name, compressed);
+  }
+  OligoOutputBuf *rdbuf() { return &buf; }
+  // Compressed if the name ends in ".gz"
+  void open(const char *name) {
+    size_t n = strlen(name);
+    open(name, n > 3 && ! strcmp(name + n - 3, ".gz"));
+  }
+  void open(const char *name, bool compressed) {
+    if (! buf.open(name, compressed)) {
+      clear(rdstate() | std::ios::badbit);
+    }
+  }
+  void close() {
+    if (buf.is_open() && ! buf.close()) {
+      clear(rdstate() | std::ios::badbit);
+    }
+  }
+};
+#endif
@@ -0,0 +1,140 @@
+///////////////////////////////////////////////////////////////////////////////
+// OligoTools
+// = OligoTools for genome analysis
+// by Paul Havlak
+// copyright 2009-2013 Rice University
+//
+// OligoTools for genome analysis by Paul Havlak is licensed under a 
+// <a rel="license" href="http://creativecommons.org/licenses/by/3.0/deed.en_US">
+// Creative Commons Attribution 3.0 Unported License.
+// </a>
+//
+// OligoTools for genome analysis incorporates unpublished modules for Kmer 
+// hash tables originally developed under the Atlas Project 
+// (Atlas Whole Genome Assembly Suite) at Baylor College of Medicine
+// Human Genome Sequencing Center during 2003-2006.
+// The BCM-HGSC copyrighted predecessor is available through the 
+// Atlas WGA Suite source distribution on the HGSC web site:
+//    http://www.hgsc.bcm.tmc.edu/content/atlas-whole-genome-assembly-suite
+// 
+// Extensive modifications and additional modules, including all features
+// for SNPmer pairing and library bitvectors, were developed in the Putnam
+// Lab at Rice University:
+//    http://nputnam.web.rice.edu
+// 
+// Open-source repository: part of the Putnam Lab JAM project
+//    https://github.com/putnamlab/jam-pipeline
+//    https://github.com/putnamlab/jam-pipeline/tree/master/source
+//     
+// Contact: Paul Havlak:
+//    havlak@rice.edu
+//    havlak@alumni.rice.edu
+//    http://www.linkedin.com/in/havlak
+///////////////////////////////////////////////////////////////////////////////
+// Exact counts for kmers whose counts don't fit in their cells.
+//
+// An OligoHash cell keeps a kmer's count in the Info1 bits left over by
+// the kmer, only 2 of them at k=31.  Rather than widen every cell, a count
+// that reaches Info1Mask leaves Info1 at Info1Mask, as a mark, and goes on
+// in an OligoOverflow: a small table of (kmer, count) pairs, keyed by kmer
+// so that it needs no fixing up when the OligoHash moves cells around
+// (growing or purging).  Only high-copy kmers ever get here.
+//
+// A mutex makes add() and get() safe for many counting threads; they
+// only contend when counting the same few high-copy kmers.
+//
+
+#ifndef DEFINED_OLIGOOVERFLOW
+#define DEFINED_OLIGOOVERFLOW 1
+#include "Oligos.hh"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <iostream>
+
+using namespace std;
+
+class OligoOverflow {
+public:
+  typedef Oligos::Oligo Oligo;
+  typedef Oligos::Index64 Index64;
+
+  class Entry {
+  public:
+    Oligo key;          // kmer (without Info bits)
+    Index64 count;      // 0 for an empty entry
+  };
+
+  Index64 size;         // entries in use
+  Index64 capacity;     // a power of two
+  Entry *entries;
+protected:
+  pthread_mutex_t lock;
+
+  inline Index64 home(Oligo kmer) {
+    Index64 key = Oligos::fold(kmer) * 0x9E3779B97F4A7C15ULL;
+    return (key ^ (key >> 29)) & (capacity - 1);
+  }
+  // Entry for key, or the empty entry where it belongs
+  Entry *find(Oligo key) {
+    Index64 i = home(key);
+    while (entries[i].count && entries[i].key != key) {
+      i = (i + 1) & (capacity - 1);
+    }
+    return entries + i;
+  }
+  void resize(Index64 newCapacity) {
+    Entry *old = entries;
+    Index64 oldCapacity = capacity;
+    capacity = newCapacity;
+    entries = (Entry *) calloc(sizeof(Entry), capacity);
+    if (! entries) {
+      cerr << "OligoOverflow failed to allocate " << capacity << " entries." << endl;
+      exit(-1);
+    }
+    for (Index64 i = 0; i < oldCapacity; i++) {
+      if (old[i].count) {
+        *find(old[i].key) = old[i];
+      }
+    }
+    free(old);
+  }
+public:
+  OligoOverflow() :
+    size(0),
+    capacity(0),
+    entries(0)
+    {
+      pthread_mutex_init(&lock, NULL);
+      resize(1024);
+    }
+
+  // Add inc (nonzero) to the count for key, starting from 0 for a new key.
+  void add(Oligo key, Index64 inc) {
+    pthread_mutex_lock(&lock);
+    Entry *e = find(key);
+    if (! e->count) {
+      if (2 * (size + 1) > capacity) {
+        resize(2 * capacity);
+        e = find(key);
+      }
+      e->key = key;
+      size++;
+    }
+    e->count += inc;
+    pthread_mutex_unlock(&lock);
+  }
+  Index64 get(Oligo key) {
+    pthread_mutex_lock(&lock);
+    Index64 count = find(key)->count;
+    pthread_mutex_unlock(&lock);
+    return count;
+  }
+  // Add all the entries of an array of n (e.g. from a table snapshot)
+  void load(const Entry *from, Index64 n) {
+    for (Index64 i = 0; i < n; i++) {
+      add(from[i].key, from[i].count);
+    }
+  }
+};
+#endif
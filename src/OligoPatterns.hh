@@ -0,0 +1,124 @@
+///////////////////////////////////////////////////////////////////////////////
+// OligoTools
+// = OligoTools for genome analysis
+// by Paul Havlak
+// copyright 2009-2013 Rice University
+//
+// OligoTools for genome analysis by Paul Havlak is licensed under a 
+// <a rel="license" href="http://creativecommons.org/licenses/by/3.0/deed.en_US">
+// Creative Commons Attribution 3.0 Unported License.
+// </a>
+//
+// OligoTools for genome analysis incorporates unpublished modules for Kmer 
+// hash tables originally developed under the Atlas Project 
+// (Atlas Whole Genome Assembly Suite) at Baylor College of Medicine
+// Human Genome Sequencing Center during 2003-2006.
+// The BCM-HGSC copyrighted predecessor is available through the 
+// Atlas WGA Suite source distribution on the HGSC web site:
+//    http://www.hgsc.bcm.tmc.edu/content/atlas-whole-genome-assembly-suite
+// 
+// Extensive modifications and additional modules, including all features
+// for SNPmer pairing and library bitvectors, were developed in the Putnam
+// Lab at Rice University:
+//    http://nputnam.web.rice.edu
+// 
+// Open-source repository: part of the Putnam Lab JAM project
+//    https://github.com/putnamlab/jam-pipeline
+//    https://github.com/putnamlab/jam-pipeline/tree/master/source
+//     
+// Contact: Paul Havlak:
+//    havlak@rice.edu
+//    havlak@alumni.rice.edu
+//    http://www.linkedin.com/in/havlak
+///////////////////////////////////////////////////////////////////////////////
+// A dictionary of the seqset bitvectors (patterns of presence in
+// sequence sets) that kmers actually have, so that a table can keep a
+// 16-bit pattern id for each kmer instead of a 64-bit bitvector.  With
+// a dozen sequence sets there are at most 4096 patterns, and in practice
+// a few hundred.
+//
+// Id 0 is the empty pattern, so a zeroed side array means no kmer is in
+// any sequence set yet.  Marking a kmer as in one more sequence set is a
+// transition, with(id, seqset), looked up in a cache of one row of ids
+// per pattern; a pattern or transition not seen before is added under a
+// lock, and from then on read without one, so that many threads can
+// mark kmers at once.
+//
+
+#ifndef DEFINED_OLIGOPATTERNS
+#define DEFINED_OLIGOPATTERNS 1
+#include "Oligos.hh"
+#include <stdlib.h>
+#include <pthread.h>
+#include <iostream>
+#include <map>
+
+class PatternDictionary {
+public:
+  typedef unsigned short Id;
+  typedef Oligos::Index64 Pattern;
+  static const unsigned MAXPATTERNS = 1 << 16;
+  static const unsigned MAXSEQSETS = 64;
+protected:
+  Pattern *patterns;         // by id
+  unsigned npatterns;
+  std::map<Pattern, Id> ids;
+  Id **transitions;          // by id, then seqset; 0 means not looked up yet
+  pthread_mutex_t lock;
+public:
+  PatternDictionary() :
+    patterns((Pattern *) calloc(MAXPATTERNS, sizeof(Pattern))),
+    npatterns(1),
+    transitions((Id **) calloc(MAXPATTERNS, sizeof(Id *)))
+  {
+    ids[0] = 0;
+    pthread_mutex_init(&lock, NULL);
+  }
+  inline Pattern pattern(Id id) const {
+    return patterns[id];
+  }
+  unsigned size() const {
+    return npatterns;
+  }
+  // The id of pattern id plus sequence set seqset (bit seqset, from 0);
+  // never 0.
+  inline Id with(Id id, unsigned seqset) {
+    Id *row = ((Id * volatile *) transitions)[id];
+    if (row) {
+      Id to = ((volatile Id *) row)[seqset];
+      if (to) return to;
+    }
+    return learn(id, seqset);
+  }
+protected:
+  Id learn(Id id, unsigned seqset) {
+    pthread_mutex_lock(&lock);
+    Pattern p = patterns[id] | (1ULL << seqset);
+    std::map<Pattern, Id>::iterator found = ids.find(p);
+    Id to;
+    if (found != ids.end()) {
+      to = found->second;
+    }
+    else {
+      if (npatterns == MAXPATTERNS) {
+        std::cerr << "More than " << MAXPATTERNS
+                  << " distinct seqset patterns; can't keep them in a dictionary." << std::endl;
+        exit(-1);
+      }
+      to = npatterns;
+      patterns[to] = p;
+      ids[p] = to;
+      npatterns++;
+    }
+    if (! transitions[id]) {
+      Id *row = (Id *) calloc(MAXSEQSETS, sizeof(Id));
+      __sync_synchronize();  // row zeroed before it's seen
+      transitions[id] = row;
+    }
+    __sync_synchronize();    // patterns[to] set before the transition is seen
+    transitions[id][seqset] = to;
+    pthread_mutex_unlock(&lock);
+    return to;
+  }
+};
+#endif
@@ -0,0 +1,309 @@
+///////////////////////////////////////////////////////////////////////////////
+// OligoTools
+// = OligoTools for genome analysis
+// by Paul Havlak
+// copyright 2009-2013 Rice University
+//
+// OligoTools for genome analysis by Paul Havlak is licensed under a 
+// <a rel="license" href="http://creativecommons.org/licenses/by/3.0/deed.en_US">
+// Creative Commons Attribution 3.0 Unported License.
+// </a>
+//
+// OligoTools for genome analysis incorporates unpublished modules for Kmer 
+// hash tables originally developed under the Atlas Project 
+// (Atlas Whole Genome Assembly Suite) at Baylor College of Medicine
+// Human Genome Sequencing Center during 2003-2006.
+// The BCM-HGSC copyrighted predecessor is available through the 
+// Atlas WGA Suite source distribution on the HGSC web site:
+//    http://www.hgsc.bcm.tmc.edu/content/atlas-whole-genome-assembly-suite
+// 
+// Extensive modifications and additional modules, including all features
+// for SNPmer pairing and library bitvectors, were developed in the Putnam
+// Lab at Rice University:
+//    http://nputnam.web.rice.edu
+// 
+// Open-source repository: part of the Putnam Lab JAM project
+//    https://github.com/putnamlab/jam-pipeline
+//    https://github.com/putnamlab/jam-pipeline/tree/master/source
+//     
+// Contact: Paul Havlak:
+//    havlak@rice.edu
+//    havlak@alumni.rice.edu
+//    http://www.linkedin.com/in/havlak
+///////////////////////////////////////////////////////////////////////////////
+// OligoPerfectHash: a read-only kmer table with no empty cells.
+//
+// Once its table is loaded, a tool like GenomeMmScan only looks kmers up.
+// An OligoHash still carries the empty cells it needed for inserting (and
+// the side array entries parallel to them), and a lookup may probe a few
+// cells.  An OligoPerfectHash is built from a loaded table and gives each
+// of its n kmers a rank in 0..n-1, by a minimal perfect hash function in
+// the style of BBHash (Limasset et al. 2017):
+//
+// Level 0 is a bit array of Gamma*n bits.  Each kmer hashes to one bit,
+// and a bit that just one kmer hashed to is set, placing that kmer.  The
+// kmers that collided go on to level 1, of Gamma times as many bits as
+// there are of them, and so on.  A kmer's rank is the number of set bits
+// before its own, over all levels, counted with one popcount per word
+// past a running count kept every RANKBITS bits.  The few kmers left
+// after MAXLEVELS levels are kept sorted, ranked after all the others.
+//
+// Any kmer, in the table or not, may land on a set bit, so the cell at
+// each rank keeps the kmer (and its count, as in the source table) to
+// tell them apart.  At Gamma=2 the levels take under 4 bits per kmer,
+// beyond the cells.  Side arrays go into rank order with arrange().
+//
+// The interface follows OligoHash for lookups: lookuploc, lookupBatch,
+// count, and hash[0..Size-1] for going through all the kmers.
+//
+
+#ifndef DEFINED_OLIGOPERFECT
+#define DEFINED_OLIGOPERFECT 1
+#include "OligoCells.hh"
+#include "OligoOverflow.hh"
+#include "OligoBucket.hh"
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <algorithm>
+#include <vector>
+
+using namespace std;
+
+class OligoPerfectHash: public OligoCells {
+public:
+  typedef enum { FOUND, MISSING, SLICED, FULL } HashFlag;
+  static const Index MAXLEVELS = 24;
+  static const Index RANKBITS = 512;      // bits per running count
+  static const Index PREFETCHAHEAD = 16;
+
+  const double Gamma;
+  Index distinct;
+  Index Size;          // == distinct: one cell per kmer
+  Oligo *hash;         // cells of the source table, in rank order
+  OligoOverflow overflow;  // counts too big for Info1
+  Index Levels;
+  Index Leftover;      // kmers in no level
+protected:
+  Index64 levelStart[MAXLEVELS];  // first bit of each level in bits
+  Index64 levelBits[MAXLEVELS];
+  Index64 *bits;       // all the levels, end to end
+  Index64 nbits;
+  Index64 *ranks;      // set bits before each RANKBITS bits
+  Index placed;        // kmers placed in some level, ranked 0..placed-1
+  Oligo *leftover;     // sorted, ranked placed..Size-1
+
+  // A different well-mixed 64-bit hash of the kmer for each level
+  static inline Index64 mix(Oligo key, Index level) {
+    Index64 z = fold(key) + (level + 1) * 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+  }
+  // The kmer's bit within a level (of levelBits[level] bits)
+  inline Index64 bitFor(Oligo key, Index level) {
+    return (Index64) (((unsigned __int128) mix(key, level) * levelBits[level]) >> 64);
+  }
+  inline bool isSet(Index64 b) {
+    return (bits[b >> 6] >> (b & 63)) & 1;
+  }
+  // Number of set bits before bit b
+  inline Index rank(Index64 b) {
+    Index64 w = (b / RANKBITS) * (RANKBITS / 64);
+    Index r = ranks[b / RANKBITS];
+    for (; w < (b >> 6); w++) {
+      r += __builtin_popcountll(bits[w]);
+    }
+    return r + __builtin_popcountll(bits[w] & ((1ULL << (b & 63)) - 1));
+  }
+public:
+  // Build from a loaded table: OligoHash, or OligoHash<T2> of OligoHashSide.hh
+  template<class OH> OligoPerfectHash(OH &oh, double gamma = 2.0) :
+    OligoCells(oh.Length, oh.Info2Len, oh.Info3Len),
+    Gamma(gamma),
+    distinct(0),
+    Size(0),
+    hash(0),
+    Levels(0),
+    Leftover(0),
+    bits(0),
+    nbits(0),
+    ranks(0),
+    placed(0),
+    leftover(0)
+    {
+      // Kmers not yet placed
+      vector<Oligo> todo;
+      todo.reserve(oh.distinct);
+      for (Index i = 0; i < oh.Size; i++) {
+        if (oh.hash[i]) {
+          todo.push_back(oh.getOligo(oh.hash[i]));
+        }
+      }
+      distinct = Size = todo.size();
+
+      vector<Index64> words;
+      while (todo.size() && Levels < MAXLEVELS) {
+        Index64 n = (Index64) (Gamma * todo.size());
+        levelStart[Levels] = 64 * words.size();
+        levelBits[Levels] = (n + 63) & ~63ULL;
+        vector<Index64> once(levelBits[Levels] / 64), twice(levelBits[Levels] / 64);
+        vector<Oligo>::iterator k;
+        for (k = todo.begin(); k != todo.end(); k++) {
+          Index64 b = bitFor(*k, Levels);
+          if (once[b >> 6] & (1ULL << (b & 63))) {
+            twice[b >> 6] |= 1ULL << (b & 63);
+          }
+          else {
+            once[b >> 6] |= 1ULL << (b & 63);
+          }
+        }
+        vector<Oligo> collided;
+        for (k = todo.begin(); k != todo.end(); k++) {
+          Index64 b = bitFor(*k, Levels);
+          if (twice[b >> 6] & (1ULL << (b & 63))) {
+            collided.push_back(*k);
+          }
+        }
+        for (Index64 w = 0; w < once.size(); w++) {
+          words.push_back(once[w] & ~twice[w]);
+        }
+        placed += todo.size() - collided.size();
+        todo.swap(collided);
+        Levels++;
+      }
+
+      // One more word, so that rank() of the last bit can read past it
+      words.push_back(0);
+      nbits = 64 * words.size();
+      bits = (Index64 *) malloc(sizeof(Index64) * words.size());
+      ranks = (Index64 *) malloc(sizeof(Index64) * (nbits / RANKBITS + 1));
+      hash = allocCells(Size);
+      Leftover = todo.size();
+      leftover = (Oligo *) malloc(sizeof(Oligo) * (Leftover + 1));
+      if (! (bits && ranks && hash && leftover)) {
+        cerr << "OligoPerfectHash failed to allocate for " << Size << " kmers." << endl;
+        exit(-1);
+      }
+      memcpy(bits, &(words[0]), sizeof(Index64) * words.size());
+      Index r = 0;
+      for (Index64 w = 0; w < words.size(); w++) {
+        if (w % (RANKBITS / 64) == 0) {
+          ranks[w / (RANKBITS / 64)] = r;
+        }
+        r += __builtin_popcountll(bits[w]);
+      }
+      sort(todo.begin(), todo.end());
+      copy(todo.begin(), todo.end(), leftover);
+
+      // Now the cells, with their counts, each at the kmer's rank
+      Index location;
+      for (Index i = 0; i < oh.Size; i++) {
+        if (oh.hash[i]) {
+          place(oh.getOligo(oh.hash[i]), location);
+          hash[location] = oh.hash[i];
+        }
+      }
+      for (Index64 e = 0; e < oh.overflow.capacity; e++) {
+        if (oh.overflow.entries[e].count) {
+          overflow.add(oh.overflow.entries[e].key, oh.overflow.entries[e].count);
+        }
+      }
+      cerr << "Perfect hash of " << Size << " kmers: " << Levels << " levels, "
+           << (double) (nbits + 64 * (nbits / RANKBITS + 1)) / (Size ? Size : 1)
+           << " bits per kmer, " << Leftover << " left over." << endl;
+    }
+
+protected:
+  // Rank of the bit or leftover that a kmer would have, if any
+  inline bool place(Oligo key, Index &location) {
+    for (Index l = 0; l < Levels; l++) {
+      Index64 b = levelStart[l] + bitFor(key, l);
+      if (isSet(b)) {
+        location = rank(b);
+        return true;
+      }
+    }
+    Oligo *p = lower_bound(leftover, leftover + Leftover, key);
+    if (p < leftover + Leftover && *p == key) {
+      location = placed + (p - leftover);
+      return true;
+    }
+    return false;
+  }
+public:
+  HashFlag lookuploc(Oligo key, Index &location) {
+    key = getOligo(key);
+    if (place(key, location) && getOligo(hash[location]) == key) {
+      return FOUND;
+    }
+    return MISSING;
+  }
+  HashFlag lookup(Oligo key, Oligo &result) {
+    Index loc;
+    HashFlag flag = lookuploc(key, loc);
+    if (flag == FOUND) {
+      result = hash[loc];
+    }
+    return flag;
+  }
+  // Start loading the level 0 bits and running count for a kmer
+  inline void prefetch(Oligo key) {
+    if (! Levels) return;
+    Index64 b = bitFor(getOligo(key), 0);
+    __builtin_prefetch(bits + (b >> 6));
+    __builtin_prefetch(ranks + b / RANKBITS);
+  }
+  // lookuploc for n kmers at once, prefetching well ahead, as in OligoHash
+  void lookupBatch(const Oligo *keys, Index n, Index *locations, HashFlag *flags) {
+    Index i;
+    for (i = 0; i < n && i < PREFETCHAHEAD; i++) {
+      prefetch(keys[i]);
+    }
+    for (i = 0; i < n; i++) {
+      if (i + PREFETCHAHEAD < n) {
+        prefetch(keys[i + PREFETCHAHEAD]);
+      }
+      flags[i] = lookuploc(keys[i], locations[i]);
+    }
+  }
+  // A kmer's count, from its cell or, once that saturates, from overflow
+  inline Index64 count(Index location) {
+    Index c = getInfo1(hash[location]);
+    return (c == Info1Mask) ? overflow.get(getOligo(hash[location])) : c;
+  }
+
+  // A copy of a side array parallel to the cells of the source table,
+  // rearranged to be parallel to these cells instead.
+  template<class OH, class T2> T2 *arrange(OH &oh, const T2 *side) {
+    T2 *ranked = (T2 *) malloc(sizeof(T2) * (Size ? Size : 1));
+    if (! ranked) {
+      cerr << "OligoPerfectHash failed to allocate a side array of " << Size << endl;
+      exit(-1);
+    }
+    Index location;
+    for (Index i = 0; i < oh.Size; i++) {
+      if (oh.hash[i]) {
+        place(oh.getOligo(oh.hash[i]), location);
+        ranked[location] = side[i];
+      }
+    }
+    return ranked;
+  }
+
+  // The ranks of the source table's kmers, in the order of its cells: for
+  // going through the kmers in the order the source table had them.
+  template<class OH> vector<Index> sourceOrder(OH &oh) {
+    vector<Index> order;
+    order.reserve(Size);
+    Index location;
+    for (Index i = 0; i < oh.Size; i++) {
+      if (oh.hash[i]) {
+        place(oh.getOligo(oh.hash[i]), location);
+        order.push_back(location);
+      }
+    }
+    return order;
+  }
+};
+#endif
@@ -0,0 +1,348 @@
+///////////////////////////////////////////////////////////////////////////////
+// OligoTools
+// = OligoTools for genome analysis
+// by Paul Havlak
+// copyright 2009-2013 Rice University
+//
+// OligoTools for genome analysis by Paul Havlak is licensed under a 
+// <a rel="license" href="http://creativecommons.org/licenses/by/3.0/deed.en_US">
+// Creative Commons Attribution 3.0 Unported License.
+// </a>
+//
+// OligoTools for genome analysis incorporates unpublished modules for Kmer 
+// hash tables originally developed under the Atlas Project 
+// (Atlas Whole Genome Assembly Suite) at Baylor College of Medicine
+// Human Genome Sequencing Center during 2003-2006.
+// The BCM-HGSC copyrighted predecessor is available through the 
+// Atlas WGA Suite source distribution on the HGSC web site:
+//    http://www.hgsc.bcm.tmc.edu/content/atlas-whole-genome-assembly-suite
+// 
+// Extensive modifications and additional modules, including all features
+// for SNPmer pairing and library bitvectors, were developed in the Putnam
+// Lab at Rice University:
+//    http://nputnam.web.rice.edu
+// 
+// Open-source repository: part of the Putnam Lab JAM project
+//    https://github.com/putnamlab/jam-pipeline
+//    https://github.com/putnamlab/jam-pipeline/tree/master/source
+//     
+// Contact: Paul Havlak:
+//    havlak@rice.edu
+//    havlak@alumni.rice.edu
+//    http://www.linkedin.com/in/havlak
+///////////////////////////////////////////////////////////////////////////////
+// OligoQuotientHash: a compact kmer table, storing only part of each kmer.
+//
+// An OligoHash cell holds the whole kmer, though its home cell already
+// says a lot about it.  Here a kmer is first mixed (a reversible
+// scrambling of its 2k bits), then split into a home cell (mixed % Size)
+// and a quotient (mixed / Size), and only the quotient is stored, with
+// how far past its home the kmer ended up (linear probing).  For k=23 in
+// a table of a billion cells that is 17 bits of quotient instead of 46
+// bits of kmer, which leaves room in the same 64-bit cell for both the
+// count (Info1) and a small bitvector (Info2), such as the seqsets that
+// GenomeBVcount would otherwise keep in a side array: half the memory.
+//
+// Cell layout within 64 bits:
+// [ info1 ][ info2 ][ displacement ][ quotient ]
+// 63                                           0
+// An empty cell is 0; a kmer's cell always has a count of at least 1.
+// Counts too big for Info1 go on in an OligoOverflow, as in OligoHash.
+//
+// The interface follows OligoHash where it can, but a cell alone doesn't
+// give back its kmer: use oligoAt(location) in place of getOligo(cell).
+// These tables don't grow or purge, nor snapshot.
+//
+
+#ifndef DEFINED_OLIGOQUOTIENT
+#define DEFINED_OLIGOQUOTIENT 1
+#include "Oligos.hh"
+#include "OligoOverflow.hh"
+#include "OligoBucket.hh"
+#include "OligoSlice.hh"
+#include "getprime.hh"
+#include <stdlib.h>
+#include <iostream>
+#include <assert.h>
+
+using namespace std;
+
+class OligoQuotientHash: public Oligos {
+public:
+  typedef enum { FOUND, MISSING, SLICED, FULL } HashFlag;
+  static const Index DISPBITS = 10;       // a kmer is at most 1023 cells past its home
+  static const Index PREFETCHAHEAD = 16;
+
+  Index64 insertions;
+  Index64 distinct;
+  const Index64 purged;  // always 0: these tables don't purge
+  Oligo *hash;
+  OligoOverflow overflow;  // counts too big for Info1
+  const Index Size;
+  const Index HashPct;
+  const Index Slicing;
+  const Index Slice;
+  const Index QuotientBits;
+  const Oligo QuotientMask;
+  const Oligo DispOne;        // displacement of 1, in place above the quotient
+  const Oligo DispMask;
+  const Index Info2Len;
+  const Index Info2Shift;
+  const Oligo Info2Mask;
+  const Index Info1Len;
+  const Index Info1Shift;
+  const Oligo Info1Mask;
+protected:
+  const Index MixShift;
+  static const Oligo MIXMUL = 0x9E3779B97F4A7C15ULL;
+  Oligo MixInverse;
+
+  static Index bitsFor(Oligo n) {
+    return n ? (64 - __builtin_clzll(n)) : 0;
+  }
+  // A bijection on 2k-bit kmers: xorshift, odd multiply, xorshift, with
+  // the shift at least k bases so that each xorshift undoes itself.
+  inline Oligo mix(Oligo x) {
+    x ^= x >> MixShift;
+    x = (x * MIXMUL) & ValMask;
+    return x ^ (x >> MixShift);
+  }
+  inline Oligo unmix(Oligo x) {
+    x ^= x >> MixShift;
+    x = (x * MixInverse) & ValMask;
+    return x ^ (x >> MixShift);
+  }
+  inline bool inslice(Oligo w) {
+    return (sliceOf(w, Slicing) == Slice);
+  }
+public:
+  OligoQuotientHash(Index HashSize, Index HashSlicing, Index HashSlice,
+                    Index OligoLen, Index tInfo2Len = 0) :
+    Oligos(OligoLen),
+    insertions(0),
+    distinct(0),
+    purged(0),
+    hash(allocCells(get_prime(HashSize))),
+    // (members are initialized in the order declared, so each of these
+    // can use those before it)
+    Size(get_prime(HashSize)),
+    HashPct(Size/100),
+    Slicing(HashSlicing),
+    Slice(HashSlice),
+    QuotientBits(bitsFor(ValMask / Size)),
+    QuotientMask((1ULL << QuotientBits) - 1),
+    DispOne(1ULL << QuotientBits),
+    DispMask(((1ULL << DISPBITS) - 1) << QuotientBits),
+    Info2Len(tInfo2Len),
+    Info2Shift(QuotientBits + DISPBITS),
+    Info2Mask((1ULL << Info2Len) - 1),
+    Info1Len(OLIGOBITS - (Info2Shift + Info2Len)),
+    Info1Shift(Info2Shift + Info2Len),
+    Info1Mask(~0ULL >> Info1Shift),
+    MixShift((BASEBITS * OligoLen + 1) / 2)
+    {
+      assert(Slicing > Slice);
+      assert(Size > 1000);
+      if (Info2Shift + Info2Len + 2 > OLIGOBITS) {
+        cerr << "OligoQuotientHash: no room for counts with " << Size << " cells, k="
+             << Length << " and " << Info2Len << " Info2 bits; use more cells." << endl;
+        exit(-1);
+      }
+      if (! hash) {
+        cerr << "OligoQuotientHash failed to allocate " << Size << " cells." << endl;
+        exit(-1);
+      }
+      // Inverse of MIXMUL mod 2^64 (Newton's method; each step doubles the
+      // correct low bits), hence mod 2^2k as well
+      MixInverse = MIXMUL;
+      for (int i = 0; i < 5; i++) {
+        MixInverse *= 2 - MIXMUL * MixInverse;
+      }
+    }
+
+  inline Index getInfo1(Oligo cell) {
+    return (cell >> Info1Shift) & Info1Mask;
+  }
+  inline Index getInfo2(Oligo cell) {
+    return (cell >> Info2Shift) & Info2Mask;
+  }
+  // The kmer in an occupied cell, from its quotient, displacement and place
+  inline Oligo oligoAt(Index location) {
+    Oligo cell = hash[location];
+    Index disp = (cell & DispMask) >> QuotientBits;
+    Index home = (location >= disp) ? (location - disp) : (location + Size - disp);
+    return unmix((cell & QuotientMask) * Size + home);
+  }
+  inline Oligo* first() {
+    return next(hash - 1);
+  }
+  inline Oligo* next(Oligo* current) {
+    for (current++; current < hash + Size; current++) {
+      if (*current) {
+        return current;
+      }
+    }
+    return 0;
+  }
+
+  inline void prefetch(Oligo key) {
+    key &= ValMask;
+    if (inslice(key)) {
+      __builtin_prefetch(hash + mix(key) % Size);
+    }
+  }
+  HashFlag lookuploc(Oligo key, Index &location) {
+    key &= ValMask;
+    if (! inslice(key)) return SLICED;
+    Oligo h = mix(key);
+    Index probe = h % Size;
+    Oligo tag = h / Size;  // quotient, then with displacement
+    for (Index d = 0; d < (1UL << DISPBITS); d++, tag += DispOne) {
+      Oligo cell = hash[probe];
+      if (! cell) {
+        location = probe;
+        return MISSING;
+      }
+      if ((cell & (DispMask | QuotientMask)) == tag) {
+        location = probe;
+        return FOUND;
+      }
+      probe = (probe + 1 == Size) ? 0 : (probe + 1);
+    }
+    location = (Index) ~0ULL;
+    return FULL;
+  }
+  void lookupBatch(const Oligo *keys, Index n, Index *locations, HashFlag *flags) {
+    Index i;
+    for (i = 0; i < n && i < PREFETCHAHEAD; i++) {
+      prefetch(keys[i]);
+    }
+    for (i = 0; i < n; i++) {
+      if (i + PREFETCHAHEAD < n) {
+        prefetch(keys[i + PREFETCHAHEAD]);
+      }
+      flags[i] = lookuploc(keys[i], locations[i]);
+    }
+  }
+  // A kmer's count, from its cell or, once that saturates, from overflow
+  inline Index64 count(Index location) {
+    Index c = getInfo1(hash[location]);
+    return (c == Info1Mask) ? overflow.get(oligoAt(location)) : c;
+  }
+  // Never: these tables don't grow (FULL when the probing runs too long)
+  inline bool overloaded() {
+    return false;
+  }
+
+  // Count a kmer, handing back its cell location for orInfo2.
+  HashFlag insertloc(Oligo key, Index &location, Index info1inc = 1) {
+    HashFlag flag = lookuploc(key, location);
+    insertions++;
+    if (flag == MISSING) {
+      key &= ValMask;
+      Oligo h = mix(key);
+      Index disp = (location >= h % Size) ? (location - h % Size) : (location + Size - h % Size);
+      hash[location] = (h / Size) + disp * DispOne;
+      distinct++;
+      if (!(distinct % HashPct)) {
+        cerr << "OligoQuotientHash is " << dec << distinct / HashPct
+             << " percent full." << endl;
+      }
+    }
+    if (flag == MISSING || flag == FOUND) {
+      Oligo temp = hash[location];
+      Index c = getInfo1(temp);
+      if (c + info1inc < Info1Mask) {
+        hash[location] = temp + ((Oligo) info1inc << Info1Shift);
+      }
+      else {
+        if (c != Info1Mask) {
+          hash[location] = temp | (Info1Mask << Info1Shift);
+        }
+        overflow.add(oligoAt(location), (c == Info1Mask) ? info1inc : (c + info1inc));
+      }
+    }
+    return flag;
+  }
+  // insertloc for n kmers at once, prefetching as lookupBatch does (the
+  // table never moves cells, so all n are always done).
+  Index insertlocBatch(const Oligo *keys, Index n, Index *locations, HashFlag *flags,
+                       Index info1inc = 1) {
+    Index i;
+    for (i = 0; i < n && i < PREFETCHAHEAD; i++) {
+      prefetch(keys[i]);
+    }
+    for (i = 0; i < n; i++) {
+      if (i + PREFETCHAHEAD < n) {
+        prefetch(keys[i + PREFETCHAHEAD]);
+      }
+      flags[i] = insertloc(keys[i], locations[i], info1inc);
+    }
+    return n;
+  }
+  // Thread-safe insertloc, as in OligoHash: an empty cell is claimed with
+  // its first count by compare-and-swap, and counts are bumped likewise.
+  HashFlag insertlocAtomic(Oligo key, Index &location, Index info1inc = 1) {
+    key &= ValMask;
+    if (! inslice(key)) return SLICED;
+    Oligo h = mix(key);
+    Index probe = h % Size;
+    Oligo tag = h / Size;
+    Index d = 0;
+    while (d < (1UL << DISPBITS)) {
+      Oligo temp = readCell(&hash[probe]);
+      if (! temp) {
+        Oligo newval = tag | ((Oligo) min(info1inc, Info1Mask) << Info1Shift);
+        temp = __sync_val_compare_and_swap(&hash[probe], (Oligo) 0, newval);
+        if (! temp) {
+          location = probe;
+          if (info1inc >= Info1Mask) {
+            overflow.add(key, info1inc);
+          }
+          Index64 nowdistinct = __sync_add_and_fetch(&distinct, 1);
+          if (!(nowdistinct % HashPct)) {
+            cerr << "OligoQuotientHash is " << dec << nowdistinct / HashPct
+                 << " percent full." << endl;
+          }
+          return MISSING;
+        }
+        // else lost the race; temp now holds the winner's cell
+      }
+      if ((temp & (DispMask | QuotientMask)) == tag) {
+        while (1) {
+          Index c = getInfo1(temp);
+          if (c == Info1Mask) {
+            overflow.add(key, info1inc);
+            break;
+          }
+          Oligo newval = (temp & ~(Info1Mask << Info1Shift))
+            | ((Oligo) min(c + info1inc, Info1Mask) << Info1Shift);
+          Oligo prev = __sync_val_compare_and_swap(&hash[probe], temp, newval);
+          if (prev == temp) {
+            if (c + info1inc >= Info1Mask) {
+              overflow.add(key, c + info1inc);
+            }
+            break;
+          }
+          temp = prev;
+        }
+        location = probe;
+        return FOUND;
+      }
+      probe = (probe + 1 == Size) ? 0 : (probe + 1);
+      tag += DispOne;
+      d++;
+    }
+    location = (Index) ~0ULL;
+    return FULL;
+  }
+
+  // Set bits of the Info2 bitvector of the kmer in a cell
+  inline void orInfo2(Index location, Index64 bits) {
+    hash[location] |= (bits & Info2Mask) << Info2Shift;
+  }
+  inline void orInfo2Atomic(Index location, Index64 bits) {
+    __sync_fetch_and_or(&hash[location], (bits & Info2Mask) << Info2Shift);
+  }
+};
+#endif
@@ -60,22 +60,104 @@
 //      oligo, is the current oligo location.)
 // -- The number of sequences seen in the entire file so far
 //      (including the current sequence).
+//
+// Input is read a block at a time and parsed a run at a time: baseRun()
+// finds how many of the next characters are bases (ACGT, and acgt unless
+// soft-masked) and encodes them 2 bits each, 32 or 16 characters per step
+// with AVX2 or SSE2; only the characters that end runs (newlines, Ns,
+// description lines) are looked at one by one.
+//
+// FASTQ input (anything starting with '@') is read through a FastqFilter,
+// quality-masked as scripts/fastq2fam.pl would mask it; see OligoFastq.hh.
 
 #ifndef DEFINED_OLIGOSEQ
 #define DEFINED_OLIGOSEQ 1
 #include "OligoGen.hh"
+#include "OligoFastq.hh"
 #include <string.h>
 #include <iostream>
 #include <fstream>
+#include <vector>
+#if defined(__AVX2__) || defined(__SSE2__)
+#define OLIGOSEQ_SIMD 1
+#include <immintrin.h>
+#endif
 
 using namespace std;
 
+// Consecutive kmers of one sequence, gathered by OligoSeq::nextBatch so
+// that a whole batch can be looked up at once (see OligoHash lookupBatch).
+class OligoBatch {
+ public:
+  static const int MAXKMERS = 256;
+  OligoGen::Oligo norm[MAXKMERS];  // normalized kmers, as from current()
+  unsigned char strand[MAXKMERS];  // 1 if norm is the reverse complement
+  int pos[MAXKMERS];               // positions, as from nextPos()
+};
+
+// Length of the run of bases at p (A, C, G or T; or a, c, g or t too
+// unless soft), at most n; their 2-bit codes go in codes, which must have
+// room for 32 more.  For A, C, G and T (either case), the code is
+// ((c >> 1) ^ (c >> 2)) & 3, the same as Oligos::char2base.
+inline int baseRun(const unsigned char *p, int n, bool soft, unsigned char *codes) {
+  int i = 0;
+#if defined(OLIGOSEQ_SIMD) && defined(__AVX2__)
+  const __m256i fold = _mm256_set1_epi8(soft ? 0 : 0x20);
+  const __m256i a = _mm256_set1_epi8(soft ? 'A' : 'a'), c = _mm256_set1_epi8(soft ? 'C' : 'c');
+  const __m256i g = _mm256_set1_epi8(soft ? 'G' : 'g'), t = _mm256_set1_epi8(soft ? 'T' : 't');
+  const __m256i three = _mm256_set1_epi8(3);
+  for (; i + 32 <= n; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *) (p + i));
+    __m256i f = _mm256_or_si256(v, fold);
+    __m256i ok = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(f, a), _mm256_cmpeq_epi8(f, c)),
+                                 _mm256_or_si256(_mm256_cmpeq_epi8(f, g), _mm256_cmpeq_epi8(f, t)));
+    __m256i code = _mm256_and_si256(_mm256_xor_si256(_mm256_srli_epi16(v, 1), _mm256_srli_epi16(v, 2)), three);
+    _mm256_storeu_si256((__m256i *) (codes + i), code);
+    unsigned bases = _mm256_movemask_epi8(ok);
+    if (~bases) {
+      return i + __builtin_ctz(~bases);
+    }
+  }
+#elif defined(OLIGOSEQ_SIMD)
+  const __m128i fold = _mm_set1_epi8(soft ? 0 : 0x20);
+  const __m128i a = _mm_set1_epi8(soft ? 'A' : 'a'), c = _mm_set1_epi8(soft ? 'C' : 'c');
+  const __m128i g = _mm_set1_epi8(soft ? 'G' : 'g'), t = _mm_set1_epi8(soft ? 'T' : 't');
+  const __m128i three = _mm_set1_epi8(3);
+  for (; i + 16 <= n; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) (p + i));
+    __m128i f = _mm_or_si128(v, fold);
+    __m128i ok = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(f, a), _mm_cmpeq_epi8(f, c)),
+                              _mm_or_si128(_mm_cmpeq_epi8(f, g), _mm_cmpeq_epi8(f, t)));
+    __m128i code = _mm_and_si128(_mm_xor_si128(_mm_srli_epi16(v, 1), _mm_srli_epi16(v, 2)), three);
+    _mm_storeu_si128((__m128i *) (codes + i), code);
+    unsigned bases = _mm_movemask_epi8(ok);
+    if (bases != 0xffff) {
+      return i + __builtin_ctz(~bases);
+    }
+  }
+#endif
+  for (; i < n; i++) {
+    unsigned ch = p[i], f = soft ? ch : (ch | 0x20);
+    if (f != (soft ? 'A' : 'a') && f != (soft ? 'C' : 'c')
+        && f != (soft ? 'G' : 'g') && f != (soft ? 'T' : 't')) {
+      return i;
+    }
+    codes[i] = ((ch >> 1) ^ (ch >> 2)) & 3;
+  }
+  return n;
+}
+
 class OligoSeq: public OligoGen {
  protected:
-  static const int BUFSIZE = 2048;
-  char buf[BUFSIZE];
+  static const int BUFSIZE = 2048;      // description lines are cut to BUFSIZE-1
+  static const int BLOCKSIZE = 1 << 16; // input read at once
+  static const int RUNMAX = 1024;       // bases encoded at once
   char descrip[BUFSIZE+1];
-  Index bufindex;       // location in buffer
+  std::vector<unsigned char> block;     // input, as read from in
+  const unsigned char *next, *end;      // its unparsed part
+  const unsigned char *line;  // start of the current line, or 0 if it was long and is gone
+  unsigned char codes[RUNMAX + 32];     // the current run of bases
+  int runAt, runLen;
   Index sequences;      // number of descriptions seen so far
   Index64 allbases;     // number of bases in all sequences so far
   Index64 unambiguous;  // number of ACGTacgt in all sequences so far
@@ -83,68 +165,101 @@ class OligoSeq: public OligoGen {
   Index64 seqindex;     // number of bases in current sequence so far
   istream *in;
   bool softmasked;      // if true, treat lower case as masked
+  int pending;          // nextPos() result held back by nextBatch(), or 1 if none
+  FastqFilter *fastq;   // between in and the stream given, for FASTQ
 
-  unsigned char nextBase() {
-    // Read character by character if FASTA format, but read in a whole sequence
-    // (and it's matching-length quality string) if FASTQ or SCARF.
-    unsigned char c;
-    while (1) {
-      if ((c = buf[bufindex]) < 'A') { // not a base
-        if (! c) {
-          // end of current buffer contents
-          if (in->getline(buf, BUFSIZE)) {
-            // successfully got more sequence; keep going
-            bufindex = 0;
-            continue;
-            // if ( (in.rdstate() & ifstream::failbit ) != 0 ) then either EOF or buf filled up
-          }
-          else {
-            // end of file
-            buf[0] = '\0';
-            // Leave these members unchanged to allow query
-            // of last sequence name and length.
-            // descrip[0] = 0;
-            // seqindex = 0;
-            return '\0';
-          }
-        }
-        else if ('>' == c) {
-          sequences++;
-          bufindex = 0;
-          (void) strncpy(descrip, buf, BUFSIZE);
-          seqindex = 0;
-          buf[0] = '\0';
-          return '>';
-        }
-        else if ('#' == c) {
-          // Ignore comment, discarding remaining line contents
-          buf[0] = '\0';
-          bufindex = 0;
-          continue;
-        }
-        else { // treat as a blank
-          bufindex++;
-          continue;
+  // Read more input, keeping the current line for a description if it's
+  // short; false at the end of the input.
+  bool refill() {
+    unsigned char *b = &block[0];
+    size_t keep = line ? end - line : 0;
+    if (keep >= (size_t) BUFSIZE) {
+      keep = 0;
+      line = 0;
+    }
+    memmove(b, end - keep, keep);
+    if (line) {
+      line = b;
+    }
+    in->read((char *) b + keep, BLOCKSIZE);
+    next = b + keep;
+    end = next + in->gcount();
+    return next < end;
+  }
+  // Skip past the end of the line; if copy, appending what's skipped to
+  // the first len characters of descrip.
+  void skipLine(bool copy, size_t len = 0) {
+    while (next < end || refill()) {
+      const unsigned char *nl = (const unsigned char *) memchr(next, '\n', end - next);
+      const unsigned char *stop = nl ? nl : end;
+      if (copy) {
+        size_t n = stop - next;
+        if (n > BUFSIZE - 1 - len) n = BUFSIZE - 1 - len;
+        memcpy(descrip + len, next, n);
+        len += n;
+      }
+      next = stop;
+      if (nl) {
+        line = ++next;
+        break;
+      }
+    }
+    if (copy) {
+      descrip[len] = '\0';
+    }
+  }
+  // Parse up to the next run of bases and load it into codes, returning
+  // 'A'; or return '>' for a description line, or 0 at the end of the
+  // input.  Other letters (ambiguous bases such as N, or soft-masked ones)
+  // clear the oligo being built; other characters before 'A', newlines
+  // included, are skipped; a '#' comment line is skipped.  Anything
+  // holding '>' is a description line, all of it.
+  int scan() {
+    while (next < end || refill()) {
+      unsigned char c = *next;
+      if (c >= 'A') {
+        int n = (end - next < RUNMAX) ? end - next : RUNMAX;
+        if ((runLen = baseRun(next, n, softmasked, codes))) {
+          runAt = 0;
+          next += runLen;
+          allbases += runLen;
+          unambiguous += runLen;
+          return 'A';
         }
+        // Not bases, up to the next base or character before 'A'
+        const unsigned char *p = next;
+        unsigned char skip[32];
+        do {
+          p++;
+        } while (p < end && *p >= 'A' && ! baseRun(p, 1, softmasked, skip));
+        allbases += p - next;
+        seqindex += p - next;
+        next = p;
+        clear();
       }
-      else { // treat as a letter
-        allbases++;
-        seqindex++;
-        bufindex++;
-        switch (c) {
-        case 'a': case 'c': case 'g': case 't':
-          if (softmasked) {
-            return '?';
-          }
-          // else fall through
-        case 'A': case 'C': case 'G': case 'T':
-          unambiguous++;
-          return c;
-        default:
-          return '?'; // ambiguous base or invalid character
+      else if ('\n' == c) {
+        line = ++next;
+      }
+      else if ('>' == c) {
+        sequences++;
+        size_t len = 0;
+        if (line) {
+          len = next - line;
+          if (len > BUFSIZE - 1) len = BUFSIZE - 1;
+          memcpy(descrip, line, len);
         }
+        skipLine(true, len);
+        seqindex = 0;
+        return '>';
+      }
+      else if ('#' == c || ! c) {
+        skipLine(false);  // comment
+      }
+      else { // treat as a blank
+        next++;
       }
     }
+    return 0;
   }
 
  public:
@@ -158,48 +273,96 @@ class OligoSeq: public OligoGen {
 
   OligoSeq(Index tLength, istream &t_in, bool soft = false):
     OligoGen(tLength),
-    bufindex(0),
+    block(BLOCKSIZE + BUFSIZE),
+    runAt(0),
+    runLen(0),
     sequences(0),
     allbases(0),
     alloligos(0),
     unambiguous(0),
     seqindex(0),
     in(&t_in),
-    softmasked(soft)
+    softmasked(soft),
+    pending(1),
+    fastq(0)
   {
-    buf[0] = '\0';
+    if ('@' == t_in.peek()) {
+      fastq = new FastqFilter(t_in);
+      in = new istream(fastq);
+    }
+    next = end = line = &block[0];
     (void) strncpy(descrip, "NO DESCRIPTION YET", BUFSIZE);
   }
+  ~OligoSeq() {
+    if (fastq) {
+      delete in;
+      delete fastq;
+    }
+  }
   // Get the next k-mer and return its position in the sequence
   // (1-based sequence index of the last base in the k-mer)
   // (return 0 if we're starting a new sequence)
   int nextPos() {
-    unsigned char c;
-    while (c = nextBase()) {
-      if (c >= 'A') {
-        if (advancech(c)) {
+    while (1) {
+      while (runAt < runLen) {
+        seqindex++;
+        if (advance(codes[runAt++])) {
           // Successful construction of kmer,
           // return location of *last* base.
           alloligos++;
           return seqindex;
         }
       }
-      else if ('?' == c) {
-        clear(); // ambiguous character such as X or N, keep going
+      int what = scan();
+      if ('A' != what) {
+        // beginning of a sequence (inform user), or EOF
+        clear();
+        return what ? 0 : -1;
       }
-      else if ('>' == c) {
-        clear(); // beginning of a sequence, inform user
-        return 0;
+    }
+  }
+  // Get up to MAXKMERS further k-mers of the current sequence into batch,
+  // returning how many.  Like nextPos(), return 0 when starting a new
+  // sequence and -1 at EOF; a batch ends early at either, and that result
+  // comes back from the following call.  Note that the description line
+  // (get_descrip()) has already moved on to the next sequence when a batch
+  // is ended by it.
+  int nextBatch(OligoBatch &batch) {
+    int n = 0, np;
+    if (pending <= 0) {
+      np = pending;
+      pending = 1;
+      return np;
+    }
+    while (n < OligoBatch::MAXKMERS) {
+      if (runAt < runLen) {
+        // At most one kmer per base, so this many fit
+        int take = runLen - runAt;
+        if (take > OligoBatch::MAXKMERS - n) take = OligoBatch::MAXKMERS - n;
+        int made = kmersForRun(codes + runAt, take, batch.norm + n, batch.strand + n);
+        int first = seqindex + take - made + 1;
+        for (int b = 0; b < made; b++) {
+          batch.pos[n + b] = first + b;
+        }
+        runAt += take;
+        seqindex += take;
+        alloligos += made;
+        n += made;
+        continue;
       }
-      else {
+      int what = scan();
+      if ('A' != what) {
+        // beginning of a sequence, or EOF
         clear();
-        // EOF or ERROR
+        np = what ? 0 : -1;
+        if (! n) {
+          return np;
+        }
+        pending = np;
         break;
       }
     }
-    // EOF or ERROR
-    clear();
-    return -1;
+    return n;
   }
 };
 #endif
@@ -0,0 +1,198 @@
+///////////////////////////////////////////////////////////////////////////////
+// OligoTools
+// = OligoTools for genome analysis
+// by Paul Havlak
+// copyright 2009-2013 Rice University
+//
+// OligoTools for genome analysis by Paul Havlak is licensed under a 
+// <a rel="license" href="http://creativecommons.org/licenses/by/3.0/deed.en_US">
+// Creative Commons Attribution 3.0 Unported License.
+// </a>
+//
+// OligoTools for genome analysis incorporates unpublished modules for Kmer 
+// hash tables originally developed under the Atlas Project 
+// (Atlas Whole Genome Assembly Suite) at Baylor College of Medicine
+// Human Genome Sequencing Center during 2003-2006.
+// The BCM-HGSC copyrighted predecessor is available through the 
+// Atlas WGA Suite source distribution on the HGSC web site:
+//    http://www.hgsc.bcm.tmc.edu/content/atlas-whole-genome-assembly-suite
+// 
+// Extensive modifications and additional modules, including all features
+// for SNPmer pairing and library bitvectors, were developed in the Putnam
+// Lab at Rice University:
+//    http://nputnam.web.rice.edu
+// 
+// Open-source repository: part of the Putnam Lab JAM project
+//    https://github.com/putnamlab/jam-pipeline
+//    https://github.com/putnamlab/jam-pipeline/tree/master/source
+//     
+// Contact: Paul Havlak:
+//    havlak@rice.edu
+//    havlak@alumni.rice.edu
+//    http://www.linkedin.com/in/havlak
+///////////////////////////////////////////////////////////////////////////////
+// HyperLogLog (Flajolet et al. 2007, with Heule et al.'s small-range
+// linear counting): the number of distinct kmers in a stream, to within
+// about 1.04/sqrt(2^Precision) (0.8% at the default 14), in 2^Precision
+// bytes however many kmers there are.  Sketches of parts of a stream
+// (e.g. one per thread or per file) merge into the sketch of the whole.
+//
+
+#ifndef DEFINED_OLIGOSKETCH
+#define DEFINED_OLIGOSKETCH 1
+#include "OligoSlice.hh"
+#include "getprime.hh"
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+
+class HyperLogLog {
+public:
+  const unsigned Precision;
+protected:
+  std::vector<unsigned char> registers;
+public:
+  HyperLogLog(unsigned precision = 14) :
+    Precision(precision), registers(1 << precision, 0) { }
+
+  // A kmer, or anything already reduced to 64 bits
+  inline void add(Oligos::Oligo w) {
+    Oligos::Index64 h = mixKmer(Oligos::fold(w));
+    Oligos::Index64 r = h << Precision;
+    unsigned char rank = r ? __builtin_clzll(r) + 1 : 64 - Precision + 1;
+    unsigned char &reg = registers[h >> (64 - Precision)];
+    if (rank > reg) {
+      reg = rank;
+    }
+  }
+  void merge(const HyperLogLog &other) {
+    for (size_t i = 0; i < registers.size(); i++) {
+      if (other.registers[i] > registers[i]) {
+        registers[i] = other.registers[i];
+      }
+    }
+  }
+  double estimate() const {
+    double m = registers.size();
+    double sum = 0;
+    unsigned zeros = 0;
+    for (size_t i = 0; i < registers.size(); i++) {
+      sum += ldexp(1.0, -registers[i]);
+      zeros += (registers[i] == 0);
+    }
+    double e = (0.7213 / (1 + 1.079 / m)) * m * m / sum;
+    if (e <= 2.5 * m && zeros) {
+      e = m * log(m / zeros);  // linear counting
+    }
+    return e;
+  }
+};
+
+class SlicePlanner {
+public:
+  typedef Oligos::Oligo Oligo;
+  typedef Oligos::Index Index;
+  typedef std::pair<Oligo, Index> Sampled;  // kmer, times seen
+
+  const Index Slicing;
+  const Index Sampling;  // 1 in Sampling distinct kmers is kept
+protected:
+  HyperLogLog all;
+  std::vector<Sampled> sample;
+  size_t unique;         // sample[0..unique) is sorted and distinct
+public:
+  SlicePlanner(Index slicing, Index sampling) :
+    Slicing(slicing), Sampling(sampling ? sampling : 1), unique(0) { }
+
+  // Sample by a mix independent of the one for slices, so that the sample
+  // is a fair one of every slice, mixed or plain.
+  inline void add(Oligo w) {
+    all.add(w);
+    if (mixKmer(Oligos::fold(w) + 0x9E3779B97F4A7C15ULL) % Sampling == 0) {
+      sample.push_back(Sampled(w, 1));
+      if (sample.size() >= 2 * unique + (1 << 16)) {
+        dedupe();
+      }
+    }
+  }
+  void dedupe() {
+    std::sort(sample.begin(), sample.end());
+    size_t to = 0;
+    for (size_t from = 0; from < sample.size(); from++) {
+      if (to > 0 && sample[to - 1].first == sample[from].first) {
+        sample[to - 1].second += sample[from].second;
+      }
+      else {
+        sample[to++] = sample[from];
+      }
+    }
+    sample.resize(to);
+    unique = to;
+  }
+  // Distinct kmers, from the sketch
+  double distinct() {
+    return all.estimate();
+  }
+  // Distinct kmers seen more than once
+  double repeated() {
+    dedupe();
+    Index n = 0;
+    for (size_t i = 0; i < sample.size(); i++) {
+      n += (sample[i].second > 1);
+    }
+    return sample.size() ? distinct() * n / sample.size() : 0;
+  }
+  // Estimated distinct kmers (or, with repeats, just those seen more than
+  // once) of each of slicing slices, mixed or plain: the sample's share of
+  // each slice, scaled to the sketch's total.
+  void slices(Index slicing, bool mixed, bool repeats, std::vector<double> &est) {
+    dedupe();
+    est.assign(slicing, 0);
+    double scale = sample.size() ? distinct() / sample.size() : 0;
+    for (size_t i = 0; i < sample.size(); i++) {
+      if (! repeats || sample[i].second > 1) {
+        Oligo w = sample[i].first;
+        est[mixed ? mixKmer(Oligos::fold(w)) % slicing : w % slicing] += scale;
+      }
+    }
+  }
+  static double largest(const std::vector<double> &est) {
+    return est.size() ? *std::max_element(est.begin(), est.end()) : 0;
+  }
+  // A table of each slice's estimates, and for each slicing its largest
+  // slice, its imbalance (largest over mean), and the -H that would hold
+  // the largest slice at maxLoad.
+  void report(std::ostream &out, double maxLoad = 0.8) {
+    std::vector<double> plain, mixed, plainRep, mixedRep;
+    slices(Slicing, false, false, plain);
+    slices(Slicing, true, false, mixed);
+    slices(Slicing, false, true, plainRep);
+    slices(Slicing, true, true, mixedRep);
+    out << std::fixed << std::setprecision(0);
+    out << "# slicing:\t" << Slicing << "\tsampling:\t1/" << Sampling
+        << "\tsampled_distinct:\t" << sample.size() << std::endl;
+    out << "# distinct:\t" << distinct() << "\trepeated:\t" << repeated() << std::endl;
+    out << "# slice\tplain_distinct\tmixed_distinct\tplain_repeated\tmixed_repeated" << std::endl;
+    for (Index s = 0; s < Slicing; s++) {
+      out << s << "\t" << plain[s] << "\t" << mixed[s]
+          << "\t" << plainRep[s] << "\t" << mixedRep[s] << std::endl;
+    }
+    summary(out, "plain", plain, maxLoad);
+    summary(out, "mixed", mixed, maxLoad);
+  }
+protected:
+  void summary(std::ostream &out, const char *name, std::vector<double> &est, double maxLoad) {
+    double total = 0;
+    for (Index s = 0; s < est.size(); s++) {
+      total += est[s];
+    }
+    double mean = total / est.size();
+    out << "# " << name << ":\ttotal\t" << total << "\tlargest\t" << largest(est)
+        << std::setprecision(3) << "\timbalance\t" << (mean > 0 ? largest(est) / mean : 0)
+        << "\tHashSize\t" << get_prime((Index) (largest(est) / maxLoad) + 1000)
+        << std::setprecision(0) << std::endl;
+  }
+};
+#endif
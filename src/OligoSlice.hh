@@ -0,0 +1,72 @@
+///////////////////////////////////////////////////////////////////////////////
+// OligoTools
+// = OligoTools for genome analysis
+// by Paul Havlak
+// copyright 2009-2013 Rice University
+//
+// OligoTools for genome analysis by Paul Havlak is licensed under a 
+// <a rel="license" href="http://creativecommons.org/licenses/by/3.0/deed.en_US">
+// Creative Commons Attribution 3.0 Unported License.
+// </a>
+//
+// OligoTools for genome analysis incorporates unpublished modules for Kmer 
+// hash tables originally developed under the Atlas Project 
+// (Atlas Whole Genome Assembly Suite) at Baylor College of Medicine
+// Human Genome Sequencing Center during 2003-2006.
+// The BCM-HGSC copyrighted predecessor is available through the 
+// Atlas WGA Suite source distribution on the HGSC web site:
+//    http://www.hgsc.bcm.tmc.edu/content/atlas-whole-genome-assembly-suite
+// 
+// Extensive modifications and additional modules, including all features
+// for SNPmer pairing and library bitvectors, were developed in the Putnam
+// Lab at Rice University:
+//    http://nputnam.web.rice.edu
+// 
+// Open-source repository: part of the Putnam Lab JAM project
+//    https://github.com/putnamlab/jam-pipeline
+//    https://github.com/putnamlab/jam-pipeline/tree/master/source
+//     
+// Contact: Paul Havlak:
+//    havlak@rice.edu
+//    havlak@alumni.rice.edu
+//    http://www.linkedin.com/in/havlak
+///////////////////////////////////////////////////////////////////////////////
+// Which of Slicing slices a kmer belongs to, the same way in every tool.
+//
+// Plain slicing, the default, takes the kmer's 2-bit value modulo
+// Slicing (a small prime), so slice s of an MmTable can be picked out
+// with hex($F[1]) % Slicing == s.  But that value is mostly its first
+// bases: low-complexity and repeat-rich genomes pile kmers into some
+// slices, and every slice's -H must be sized for the worst one.  Mixed
+// slicing (-R) takes a strong 64-bit mix of the kmer (the splitmix64
+// finalizer) modulo Slicing instead, which spreads any genome evenly.
+// Tables made with one slicing can only be read with the same one.
+//
+// SlicePlanner (OligoSketch.hh) estimates each slice's distinct kmers
+// both ways.
+//
+
+#ifndef DEFINED_OLIGOSLICE
+#define DEFINED_OLIGOSLICE 1
+#include "Oligos.hh"
+
+// Set (by -R) before making any table, and the same for every tool run on
+// the tables' kmers.
+inline bool &mixedSlicing() {
+  static bool mixed = false;
+  return mixed;
+}
+
+inline Oligos::Index64 mixKmer(Oligos::Index64 w) {
+  w ^= w >> 30;
+  w *= 0xBF58476D1CE4E5B9ULL;
+  w ^= w >> 27;
+  w *= 0x94D049BB133111EBULL;
+  return w ^ (w >> 31);
+}
+
+inline Oligos::Index sliceOf(Oligos::Oligo w, Oligos::Index slicing) {
+  return mixedSlicing() ? mixKmer(Oligos::fold(w)) % slicing : w % slicing;
+}
+
+#endif
@@ -0,0 +1,209 @@
+///////////////////////////////////////////////////////////////////////////////
+// OligoTools
+// = OligoTools for genome analysis
+// by Paul Havlak
+// copyright 2009-2013 Rice University
+//
+// OligoTools for genome analysis by Paul Havlak is licensed under a 
+// <a rel="license" href="http://creativecommons.org/licenses/by/3.0/deed.en_US">
+// Creative Commons Attribution 3.0 Unported License.
+// </a>
+//
+// OligoTools for genome analysis incorporates unpublished modules for Kmer 
+// hash tables originally developed under the Atlas Project 
+// (Atlas Whole Genome Assembly Suite) at Baylor College of Medicine
+// Human Genome Sequencing Center during 2003-2006.
+// The BCM-HGSC copyrighted predecessor is available through the 
+// Atlas WGA Suite source distribution on the HGSC web site:
+//    http://www.hgsc.bcm.tmc.edu/content/atlas-whole-genome-assembly-suite
+// 
+// Extensive modifications and additional modules, including all features
+// for SNPmer pairing and library bitvectors, were developed in the Putnam
+// Lab at Rice University:
+//    http://nputnam.web.rice.edu
+// 
+// Open-source repository: part of the Putnam Lab JAM project
+//    https://github.com/putnamlab/jam-pipeline
+//    https://github.com/putnamlab/jam-pipeline/tree/master/source
+//     
+// Contact: Paul Havlak:
+//    havlak@rice.edu
+//    havlak@alumni.rice.edu
+//    http://www.linkedin.com/in/havlak
+///////////////////////////////////////////////////////////////////////////////
+// Binary snapshots of OligoHash tables.
+//
+// A snapshot file holds a header (layout of the kmer cells, size of the
+// table, and a tag describing the side array and how the table was built),
+// then the hash array, then the side array, each starting on a page
+// boundary, then any overflow counts (see OligoOverflow.hh).  Loading a snapshot just maps the file (private, copy-on-write),
+// so a table takes no time to load, and jobs on one node that map the same
+// snapshot share its pages in the page cache until they write to them.
+//
+// OligoHash knows how to construct itself around a mapped snapshot and how
+// to save itself to one; this class just handles the file.
+//
+
+#ifndef DEFINED_OLIGOSNAPSHOT
+#define DEFINED_OLIGOSNAPSHOT 1
+#include "Oligos.hh"
+#include "OligoBucket.hh"
+#include "OligoOverflow.hh"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+#include <iostream>
+#include <fstream>
+#include <string>
+
+using namespace std;
+
+class OligoSnapshot {
+public:
+  static const Oligos::Index64 VERSION = 3;
+  static const unsigned TAGLEN = 256;
+
+  // Written at the start of the file, exactly as laid out here
+  class Header {
+  public:
+    char magic[8];                // "OligoSnp"
+    Oligos::Index64 version;
+    Oligos::Index64 length;       // Oligos::Length (k)
+    Oligos::Index64 info1Len;     // OligoCells layout
+    Oligos::Index64 info2Len;
+    Oligos::Index64 info3Len;
+    Oligos::Index64 slicing;
+    Oligos::Index64 slice;
+    Oligos::Index64 size;         // cells in the hash (and side) array
+    Oligos::Index64 bucketCells;  // OLIGOBUCKET of the hash engine that filled it
+    Oligos::Index64 distinct;
+    Oligos::Index64 insertions;
+    Oligos::Index64 sideSize;     // bytes per side array entry, 0 for none
+    Oligos::Index64 hashOffset;   // file offsets of the arrays
+    Oligos::Index64 sideOffset;
+    Oligos::Index64 overflowCount;  // OligoOverflow entries
+    Oligos::Index64 overflowOffset;
+    char tag[TAGLEN];             // side array type, options used to fill the table, ...
+  };
+
+  Header *header;                 // all of these point into the mapped file
+  Oligos::Oligo *hash;
+  void *side;
+  OligoOverflow::Entry *overflow;
+  size_t mapLength;
+
+  OligoSnapshot() : header(0), hash(0), side(0), overflow(0), mapLength(0) { }
+
+  // Map a snapshot file, checking that it has the expected tag and side
+  // entry size.  Returns false (with a complaint unless the file simply
+  // doesn't exist) if the snapshot can't be used.
+  bool map(const char *name, const string &tag, size_t sideSize) {
+    int fd = open(name, O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) || st.st_size < (off_t) sizeof(Header)) {
+      cerr << "OligoSnapshot " << name << " is too short to be a snapshot." << endl;
+      close(fd);
+      return false;
+    }
+    void *p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+      cerr << "OligoSnapshot " << name << " could not be mapped." << endl;
+      return false;
+    }
+    Header *h = (Header *) p;
+    const char *problem = 0;
+    if (memcmp(h->magic, "OligoSnp", 8)) {
+      problem = "is not a snapshot";
+    }
+    else if (h->version != VERSION) {
+      problem = "has the wrong version";
+    }
+    else if (h->bucketCells != OLIGOBUCKET) {
+      problem = "was built by a different hash engine (OLIGOHASH_BUCKETS)";
+    }
+    else if (h->sideSize != sideSize || strncmp(h->tag, tag.c_str(), TAGLEN - 1)) {
+      problem = "was built differently (side array, options or input)";
+    }
+    else if (h->hashOffset + h->size * sizeof(Oligos::Oligo) > (Oligos::Index64) st.st_size
+             || h->sideOffset + h->size * h->sideSize > (Oligos::Index64) st.st_size
+             || (h->overflowOffset + h->overflowCount * sizeof(OligoOverflow::Entry)
+                 > (Oligos::Index64) st.st_size)) {
+      problem = "is truncated";
+    }
+    if (problem) {
+      cerr << "OligoSnapshot " << name << " " << problem << "." << endl;
+      if (h->magic[0] == 'O') {
+        cerr << "  has tag:  " << string(h->tag, strnlen(h->tag, TAGLEN)) << endl
+             << "  expected: " << tag << endl;
+      }
+      munmap(p, st.st_size);
+      return false;
+    }
+    header = h;
+    hash = (Oligos::Oligo *) ((char *) p + h->hashOffset);
+    side = (sideSize ? (void *) ((char *) p + h->sideOffset) : 0);
+    overflow = (OligoOverflow::Entry *) ((char *) p + h->overflowOffset);
+    mapLength = st.st_size;
+    return true;
+  }
+
+  // Write a snapshot, through a temporary file renamed into place at the
+  // end, so that jobs starting at the same time never map a partial one.
+  static bool write(const char *name, Header &h, const string &tag,
+                    const Oligos::Oligo *hash, const void *side,
+                    const OligoOverflow &overflow) {
+    const Oligos::Index64 PAGE = 4096;
+    memcpy(h.magic, "OligoSnp", 8);
+    h.version = VERSION;
+    h.bucketCells = OLIGOBUCKET;
+    memset(h.tag, 0, TAGLEN);
+    strncpy(h.tag, tag.c_str(), TAGLEN - 1);
+    h.hashOffset = PAGE * ((sizeof(Header) + PAGE - 1) / PAGE);
+    h.sideOffset = PAGE * ((h.hashOffset + h.size * sizeof(Oligos::Oligo) + PAGE - 1) / PAGE);
+    if (! side) {
+      h.sideSize = 0;
+    }
+    h.overflowCount = overflow.size;
+    h.overflowOffset = 16 * ((h.sideOffset + h.size * h.sideSize + 15) / 16);
+
+    char pid[32];
+    sprintf(pid, ".%d", (int) getpid());
+    string tmpname = string(name) + pid;
+    ofstream out(tmpname.c_str(), ios::out | ios::binary | ios::trunc);
+    out.write((const char *) &h, sizeof(Header));
+    out.seekp(h.hashOffset);
+    out.write((const char *) hash, h.size * sizeof(Oligos::Oligo));
+    if (h.sideSize) {
+      out.seekp(h.sideOffset);
+      out.write((const char *) side, h.size * h.sideSize);
+    }
+    // Pad out to the overflow entries, so that the file reaches
+    // overflowOffset even when there are none
+    out.seekp(0, ios::end);
+    for (Oligos::Index64 at = out.tellp(); at < h.overflowOffset; at++) {
+      out.put(0);
+    }
+    for (Oligos::Index64 i = 0; i < overflow.capacity; i++) {
+      if (overflow.entries[i].count) {
+        out.write((const char *) &(overflow.entries[i]), sizeof(OligoOverflow::Entry));
+      }
+    }
+    out.close();
+    if (! out || rename(tmpname.c_str(), name)) {
+      cerr << "OligoSnapshot " << name << " could not be written." << endl;
+      unlink(tmpname.c_str());
+      return false;
+    }
+    cerr << "OligoSnapshot " << name << " written: " << h.size << " cells, "
+         << h.distinct << " distinct kmers." << endl;
+    return true;
+  }
+};
+#endif
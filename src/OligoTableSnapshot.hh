@@ -0,0 +1,115 @@
+///////////////////////////////////////////////////////////////////////////////
+// OligoTools
+// = OligoTools for genome analysis
+// by Paul Havlak
+// copyright 2009-2013 Rice University
+//
+// OligoTools for genome analysis by Paul Havlak is licensed under a 
+// <a rel="license" href="http://creativecommons.org/licenses/by/3.0/deed.en_US">
+// Creative Commons Attribution 3.0 Unported License.
+// </a>
+//
+// OligoTools for genome analysis incorporates unpublished modules for Kmer 
+// hash tables originally developed under the Atlas Project 
+// (Atlas Whole Genome Assembly Suite) at Baylor College of Medicine
+// Human Genome Sequencing Center during 2003-2006.
+// The BCM-HGSC copyrighted predecessor is available through the 
+// Atlas WGA Suite source distribution on the HGSC web site:
+//    http://www.hgsc.bcm.tmc.edu/content/atlas-whole-genome-assembly-suite
+// 
+// Extensive modifications and additional modules, including all features
+// for SNPmer pairing and library bitvectors, were developed in the Putnam
+// Lab at Rice University:
+//    http://nputnam.web.rice.edu
+// 
+// Open-source repository: part of the Putnam Lab JAM project
+//    https://github.com/putnamlab/jam-pipeline
+//    https://github.com/putnamlab/jam-pipeline/tree/master/source
+//     
+// Contact: Paul Havlak:
+//    havlak@rice.edu
+//    havlak@alumni.rice.edu
+//    http://www.linkedin.com/in/havlak
+///////////////////////////////////////////////////////////////////////////////
+// OligoTableSnapshot: the -T {Snapshot} option of the tools that load a
+// table of SNPmers from an InputTable (GenomeMmScan, GenomeMmEdges and
+// GenomeMmContigs).
+//
+// With -T, the table and side array are saved as a snapshot (see
+// OligoSnapshot.hh) right after they are loaded from the InputTable, and
+// later runs map that snapshot instead of reading the InputTable again.
+// The snapshot's tag records what decided its contents: the tool, its
+// cells (64 or 128 bits, see OLIGO_WIDE) and side array entry, the
+// options that choose which kmers are loaded (-R among them, since it
+// moves kmers between slices), and the InputTable, by its size and
+// modification time as well as its name.  A run for which any of these
+// differ won't use the snapshot.  A pipe (or a process substitution, such
+// as -i <(cat ...)) can't be told apart from the next one by name or by
+// stat, so -T needs the InputTable to be a regular file.
+//
+
+#ifndef DEFINED_OLIGOTABLESNAPSHOT
+#define DEFINED_OLIGOTABLESNAPSHOT 1
+#include "Oligos.hh"
+#include "OligoSnapshot.hh"
+#include "OligoSlice.hh"
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+using namespace std;
+
+class OligoTableSnapshot {
+public:
+  string name;                  // of the snapshot file; empty without -T
+  string tag;
+  size_t sideSize;              // bytes per side array entry
+  OligoSnapshot snap;
+
+  // options are the tool's own ones that decide which records it loads
+  OligoTableSnapshot(const string &Name, const char *tool, size_t SideSize,
+                     const string &inTable, Oligos::Index oligoLen,
+                     Oligos::Index slicing, Oligos::Index slice,
+                     const string &options) :
+    name(Name), sideSize(SideSize)
+  {
+    if (! name.length()) return;
+    struct stat st;
+    if (stat(inTable.c_str(), &st) || ! S_ISREG(st.st_mode)) {
+      cerr << "-T " << name << " needs the InputTable to be a regular file, and "
+           << inTable << " isn't one." << endl;
+      exit(-1);
+    }
+    ostringstream t;
+    t << tool << " cell(" << sizeof(Oligos::Oligo) << ") side(" << sideSize << ")"
+      << " -o " << oligoLen << " -S " << slicing << ":" << slice
+      << (mixedSlicing() ? " -R" : "")  // sliceOf() decides which kmers load
+      << options
+      << " -i " << (Oligos::Index64) st.st_size << "@"
+      << (Oligos::Index64) st.st_mtim.tv_sec << "." << st.st_mtim.tv_nsec
+      << " " << inTable;  // last, so a long name is what the tag cuts short
+    tag = t.str();
+  }
+
+  // Map the snapshot, if there is one made by the same tool from the same
+  // InputTable with the same options, setting hashSize to its size.
+  bool map(Oligos::Index &hashSize) {
+    if (! name.length() || ! snap.map(name.c_str(), tag, sideSize)) {
+      return false;
+    }
+    cerr << "Mapped table snapshot " << name << ": " << snap.header->distinct
+         << " kmers in " << snap.header->size << " cells." << endl;
+    hashSize = snap.header->size; // for arrays parallel to the table
+    return true;
+  }
+
+  // Save the table just loaded from the InputTable, with -T
+  template<class OH, class T2> void save(OH &oh, const T2 *side) {
+    if (name.length()) {
+      oh.save(name.c_str(), side, tag);
+    }
+  }
+};
+#endif
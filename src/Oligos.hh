@@ -45,29 +45,66 @@
 // Oligos is needed only to carry context and fire off 
 // operations that need to know the length of the k-mer.
 //
+// Compiled with -DOLIGO_WIDE (and -mcx16, for atomic updates of cells),
+// an Oligo is a 128-bit integer instead, for k-mers of up to 63 bases.
+// The Makefile builds each tool that supports that as Tool and ToolWide,
+// and Tool runs ToolWide (see runWide) when asked for k-mers over 31.
+// Hashing goes through fold(), the identity for 64-bit Oligos, so that
+// the 64-bit tools are exactly as they were.
+//
 #ifndef DEFINED_OLIGOS
 #define DEFINED_OLIGOS 1
 #include <cctype>
 #include <cstdlib>
+#include <cstdio>
+#include <stdarg.h>
 #include <iostream>
+#include <string>
+#include <unistd.h>
 #include "OligoTools.hh"
 
+#ifdef OLIGO_WIDE
+// iostreams know no 128-bit integers: print one in the stream's base (hex
+// or decimal), padded to the stream's width like any other number.
+inline std::ostream &operator<<(std::ostream &os, unsigned __int128 w) {
+  char digits[48], *p = digits + sizeof(digits);
+  const unsigned base = (os.flags() & std::ios::hex) ? 16 : 10;
+  *--p = '\0';
+  do {
+    *--p = "0123456789abcdef"[(unsigned) (w % base)];
+    w /= base;
+  } while (w);
+  return os << p;
+}
+#endif
+
 class Oligos {
 public:
 #if (ULONG_MAX <= 0xFFFFFFFFUL)
   typedef unsigned long long Index64; // 64 bits used as an index
+#ifndef OLIGO_WIDE
   typedef unsigned long long Oligo; // 64 bits
+#endif
 #else
   typedef unsigned long Index64;
+#ifndef OLIGO_WIDE
   typedef unsigned long Oligo; // 64 bits
 #endif
+#endif
+#ifdef OLIGO_WIDE
+  typedef unsigned __int128 Oligo; // 128 bits
+#endif
 #if (UINT_MAX < 0xFFFFFFFFUL)
   typedef unsigned long Index32;
 #else
   typedef unsigned Index32;
 #endif
   typedef unsigned long Index;     // 32 or 64 bits, whichever is the native long type
+#ifdef OLIGO_WIDE
+  typedef char OligoString[65];    // big enough for 64 bases + \0
+#else
   typedef char OligoString[33];    // big enough for 32 bases + \0
+#endif
 
   // Choice of ACGT encoding is so that integer sort on k-mers is
   // the same as alphabetic (lexicographic) sort on k-mers represented 
@@ -115,9 +152,33 @@ public:
   Oligos(Index tLength):
     Length(tLength),
     BitsUnused(OLIGOBITS - (BASEBITS * Length)),
-    ValMask(~0ULL >> BitsUnused)
+    ValMask(~((Oligo) 0) >> BitsUnused)
   { }
 
+  // Longest kmer an Oligo holds, leaving room for a count in the unused
+  // bits; and the longest a wide (OLIGO_WIDE) Oligo holds
+  static const Index MAXLENGTH = OLIGOBASES - 1;
+  static const Index WIDEMAXLENGTH = 63;
+
+  // A kmer reduced to 64 bits, for hashing: for 64-bit Oligos, the kmer
+  // itself.
+  static inline Index64 fold(Oligo w) {
+#ifdef OLIGO_WIDE
+    return ((Index64) w) ^ ((Index64) (w >> 64) * 0x9E3779B97F4A7C15ULL);
+#else
+    return w;
+#endif
+  }
+  // A cell that other threads may be writing, read all at once (a plain
+  // read of a 128-bit Oligo is two reads, which a write can come between)
+  static inline Oligo readCell(const Oligo *cell) {
+#ifdef OLIGO_WIDE
+    return __sync_val_compare_and_swap((Oligo *) cell, (Oligo) 0, (Oligo) 0);
+#else
+    return *((volatile const Oligo *) cell);
+#endif
+  }
+
   inline Oligo min(Oligo a, Oligo b) { return (a < b)? a : b; }
   inline Oligo max(Oligo a, Oligo b) { return (a > b)? a : b; }
 
@@ -180,14 +241,21 @@ public:
                 << w << std::endl;
       exit(-1);
     }
-    Oligo r = 0;
-
-    for (int i = 0; i < Length; i++) {
-      r <<= BASEBITS;
-      r |= (~w) & BASEMASK;
-      w >>= BASEBITS;
-    }
-    return r;
+    // Complement every base, then reverse the order of all the bases in
+    // the word at once (swap the bases within each nibble, the nibbles
+    // within each byte, then the bytes), leaving the kmer in the top bits:
+    // a few operations whatever Length is, instead of a loop over bases.
+    const Oligo BASEPAIRS = ~((Oligo) 0) / 5;   // 0x3333...
+    const Oligo NIBBLES = ~((Oligo) 0) / 17;    // 0x0F0F...
+    w = ~w;
+    w = ((w >> 2) & BASEPAIRS) | ((w & BASEPAIRS) << 2);
+    w = ((w >> 4) & NIBBLES) | ((w & NIBBLES) << 4);
+#ifdef OLIGO_WIDE
+    w = (((Oligo) __builtin_bswap64((Index64) w)) << 64) | __builtin_bswap64((Index64) (w >> 64));
+#else
+    w = __builtin_bswap64(w);
+#endif
+    return w >> BitsUnused;
   }
   inline Oligo Normalize(Oligo w) {
     Oligo r = Oligo2RC(w);
@@ -202,4 +270,75 @@ public:
     return w ^ (mask << (2*shift));
   }
 };
+
+// A hex kmer, as printed by the tools, from the start of s; the rest of s
+// from end.  (sscanf's %lx stops at 64 bits.)
+inline Oligos::Oligo parseOligo(const char *s, char **end) {
+  Oligos::Oligo w = 0;
+  while (isspace(*s)) s++;
+  for (; isxdigit(*s); s++) {
+    w = (w << 4) | (isdigit(*s) ? *s - '0' : (tolower(*s) - 'a' + 10));
+  }
+  if (end) *end = (char *) s;
+  return w;
+}
+
+// sscanf for lines with kmers on them: %K reads a hex kmer, as parseOligo
+// does, into an Oligos::Oligo (too big for %lx with OLIGO_WIDE).  Every
+// other conversion is sscanf's own and takes a pointer.  Returns the
+// number of conversions made, stopping at the first that fails.
+inline int scanOligos(const char *s, const char *format, ...) {
+  va_list ap;
+  va_start(ap, format);
+  int made = 0;
+  std::string piece;
+  for (const char *f = format; *f; made++) {
+    // The text up to the next conversion, and the conversion
+    const char *c = f;
+    while (*c && ! (c[0] == '%' && c[1] != '%')) {
+      c += (c[0] == '%') ? 2 : 1;
+    }
+    if (! *c) break;
+    const char *e = c + 1;
+    while (*e && ! isalpha(*e)) e++;
+    while (*e == 'l' || *e == 'h') e++;
+    int n = -1;
+    if (*e == 'K') {
+      piece.assign(f, c - f);
+      piece += "%n";
+      sscanf(s, piece.c_str(), &n);
+      if (n < 0) break;
+      for (s += n; isspace(*s); s++) ;
+      if (! isxdigit(*s)) break;
+      *va_arg(ap, Oligos::Oligo *) = parseOligo(s, (char **) &s);
+    }
+    else {
+      piece.assign(f, e + 1 - f);
+      piece += "%n";
+      if (sscanf(s, piece.c_str(), va_arg(ap, void *), &n) != 1 || n < 0) break;
+      s += n;
+    }
+    f = e + 1;
+  }
+  va_end(ap);
+  return made;
+}
+
+// Tools built both ways call runWide with their kmer length: for kmers
+// too long for this build but not for a wide one, it runs the wide build
+// (the program's own path plus "Wide") in its place.  Otherwise it just
+// returns.
+inline void runWide(char *argv[], Oligos::Index length) {
+#ifndef OLIGO_WIDE
+  if (length <= Oligos::MAXLENGTH || length > Oligos::WIDEMAXLENGTH) return;
+  char self[4096];
+  ssize_t n = readlink("/proc/self/exe", self, sizeof(self) - 8);
+  std::string wide = (n > 0) ? std::string(self, n) : std::string(argv[0]);
+  wide += "Wide";
+  execv(wide.c_str(), argv);
+  std::cerr << "Can't run " << wide << " for kmers over " << Oligos::MAXLENGTH
+            << " bases (build it with make wide)." << std::endl;
+  exit(-1);
+#endif
+}
 #endif
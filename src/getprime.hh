@@ -14,6 +14,8 @@
 //
 // Paul Havlak, 17 May 2004
 
+#ifndef DEFINED_GETPRIME
+#define DEFINED_GETPRIME 1
 #include <cmath>
 #include <cstdlib>
 #include <climits>
@@ -100,3 +102,4 @@ unsigned long get_prime(unsigned long target) {
   // conclusive theory guaranteeing a prime in that particular range.
   return 0;
 }
+#endif
@@ -0,0 +1,263 @@
+# (c) 2012-2013 Rice University & Nicholas H. Putnam
+#
+# This file is part of jam-pipeline
+#
+# This work is licensed under the Creative Commons Attribution 3.0 Unported License. To view a copy of this license, visit http://creativecommons.org/licenses/by/3.0/.
+
+# Checks that the GenomeBVcount, GenomeMmScan and GenomeMmEdges options
+# added for speed (threads, one-pass slicing, compact tables, snapshots,
+# perfect hashing, FASTQ, BGZF and pipe input, compressed output) give the
+# same answers as the single-threaded default path, on a small simulated
+# project made here rather than the Limulus test project.
+
+import unittest
+import os
+import random
+import subprocess
+import hashlib
+import shutil
+import struct
+import tempfile
+import zlib
+
+import gzip
+
+def revcomp(s):
+    comp = {'A':'T','C':'G','G':'C','T':'A','N':'N'}
+    return "".join([comp[c] for c in reversed(s)])
+
+# Write data as BGZF: gzip members of at most 64 KB, each with a BC extra
+# field giving its size, and an empty member at the end.
+def bgzf(fn, data, blocksize=65280):
+    def block(d):
+        c = zlib.compressobj(6, zlib.DEFLATED, -15)
+        z = c.compress(d) + c.flush()
+        extra = "BC" + struct.pack("<HH", 2, len(z) + 25)
+        h = "\x1f\x8b\x08\x04" + "\0"*4 + "\0\xff" + struct.pack("<H", 6) + extra
+        return h + z + struct.pack("<II", zlib.crc32(d) & 0xffffffff, len(d))
+    f = open(fn, "wb")
+    for i in range(0, len(data), blocksize):
+        f.write(block(data[i:i+blocksize]))
+    f.write(block(""))
+    f.close()
+
+class TestJamOptions(unittest.TestCase):
+
+    @classmethod
+    def setUpClass(cls):
+        cls.dir = tempfile.mkdtemp(prefix="jam_options.")
+        r = random.Random(7)
+        glen = 20000
+        genome = "".join([r.choice("ACGT") for i in range(glen)])
+        # a second haplotype, with a SNP every 150 bases
+        h2 = list(genome)
+        for i in range(0, glen, 150):
+            h2[i] = r.choice([c for c in "ACGT" if c != h2[i]])
+        h2 = "".join(h2)
+        for lib, haps in (("lib1", [genome]), ("lib2", [h2]), ("lib3", [genome, h2])):
+            fq = []
+            for n in range(3000):
+                h = r.choice(haps)
+                p = r.randrange(0, glen - 100)
+                s = list(h[p:p+100])
+                if r.random() < 0.5:
+                    s = list(revcomp(h[p:p+100]))
+                q = []
+                for j in range(100):
+                    if r.random() < 0.003:
+                        s[j] = r.choice("ACGT")
+                    x = r.random()
+                    q.append(chr(33 + (2 if x < 0.01 else 25 if x < 0.05 else 38)))
+                fq.append("@HWI-%s:%d\n%s\n+\n%s\n" % (lib, n, "".join(s), "".join(q)))
+            fq = "".join(fq)
+            f = open(os.path.join(cls.dir, lib + ".fq"), "w")
+            f.write(fq)
+            f.close()
+            cls.sh("fastq2fam.pl < %s.fq | gzip > %s.fam.gz" % (lib, lib))
+            fam = gzip.open(os.path.join(cls.dir, lib + ".fam.gz"), "rb")
+            bgzf(os.path.join(cls.dir, lib + ".bgz.gz"), fam.read())
+            fam.close()
+
+        # SNPmer table for the read-scanning tools, as test_jam_mmscan.py
+        # uses: slice 11:5 of the plain kmers, plus the SNPmers.
+        cls.sh("GenomeBVcount -o 23 -H 300000 -S 1:0 lib1.fam.gz / lib2.fam.gz / lib3.fam.gz > bv.out")
+        cls.sh("GenomeMmTable -o 23 bv.out > MmTable.txt")
+        f = open(os.path.join(cls.dir, "MmTable.txt"))
+        o = open(os.path.join(cls.dir, "intable.txt"), "w")
+        for l in f:
+            c = l.split()
+            if (c[0] == "0" and int(c[1], 16) % 11 == 5) or (len(c) > 4 and c[4] in ("3", "12", "21")):
+                o.write(l)
+        o.close()
+        f.close()
+
+    @classmethod
+    def tearDownClass(cls):
+        shutil.rmtree(cls.dir)
+
+    @classmethod
+    def sh(cls, cmd):
+        print cmd
+        return subprocess.call(["bash", "-c", "cd %s && ( %s ) 2>> stderr.txt" % (cls.dir, cmd)])
+
+    def path(self, fn):
+        return os.path.join(self.dir, fn)
+
+    def lines(self, fn):
+        if fn.endswith(".gz"):
+            f = gzip.open(self.path(fn), "rb")
+        else:
+            f = open(self.path(fn))
+        d = f.readlines()
+        f.close()
+        return d
+
+    # Sorted checksum of a file's lines: tables come out in hash order,
+    # which may differ between options that give the same kmers.
+    def cksum(self, fn):
+        d = self.lines(fn)
+        d.sort()
+        self.assertTrue(len(d) > 0)
+        return hashlib.sha1("".join(d)).hexdigest()
+
+    def assertSame(self, a, b):
+        print a, self.cksum(a), b, self.cksum(b)
+        self.assertEqual(self.cksum(a), self.cksum(b))
+
+    def test_bvcount_options(self):
+        libs = "lib1.fam.gz / lib2.fam.gz / lib3.fam.gz"
+        for i in range(5):
+            self.sh("GenomeBVcount -o 23 -H 100000 -S 5:%d %s > bv5.%d.out" % (i, libs, i))
+            self.sh("GenomeBVcount -o 23 -H 100000 -S 5:%d -t 4 %s > bv5t.%d.out" % (i, libs, i))
+            self.assertSame("bv5.%d.out" % i, "bv5t.%d.out" % i)
+            self.sh("GenomeBVcount -o 23 -H 100000 -S 5:%d -Q %s > bv5Q.%d.out" % (i, libs, i))
+            self.assertSame("bv5.%d.out" % i, "bv5Q.%d.out" % i)
+            self.sh("GenomeBVcount -o 23 -H 100000 -S 5:%d -D -t 2 %s > bv5D.%d.out" % (i, libs, i))
+            self.assertSame("bv5.%d.out" % i, "bv5D.%d.out" % i)
+        self.sh("GenomeBVcount -o 23 -H 100000 -S 5 -A bv5A -t 4 %s > /dev/null" % libs)
+        for i in range(5):
+            self.assertSame("bv5.%d.out" % i, "bv5A.5-%d.out" % i)
+
+        # short kmers, hashed (-K 0) against the default direct-addressed table
+        self.sh("GenomeBVcount -o 13 -K 0 -H 3000000 -S 1:0 %s > bv13.out" % libs)
+        self.sh("GenomeBVcount -o 13 -S 1:0 %s > bv13K.out" % libs)
+        self.assertSame("bv13.out", "bv13K.out")
+        self.sh("GenomeBVcount -o 13 -S 1:0 -t 4 %s > bv13Kt.out" % libs)
+        self.assertSame("bv13.out", "bv13Kt.out")
+
+    def test_input_formats(self):
+        self.sh("GenomeBVcount -o 23 -H 300000 -S 1:0 lib1.fam.gz / lib3.fam.gz > in.out")
+        # FASTQ, masked as fastq2fam.pl masks it
+        self.sh("GenomeBVcount -o 23 -H 300000 -S 1:0 lib1.fq / lib3.fq > in_fq.out")
+        self.assertSame("in.out", "in_fq.out")
+        self.sh("gzip -c lib3.fq > lib3.fq.gz; GenomeBVcount -o 23 -H 300000 -S 1:0 -t 3 lib1.fq / lib3.fq.gz > in_fqgz.out")
+        self.assertSame("in.out", "in_fqgz.out")
+        self.sh("GenomeBVcount -o 23 -H 300000 -S 1:0 -x lib1.fam.gz / lib3.fam.gz > inx.out")
+        self.sh("GenomeBVcount -o 23 -H 300000 -S 1:0 -x -q m=20,soft=30 lib1.fq / lib3.fq > inx_fq.out")
+        self.assertSame("inx.out", "inx_fq.out")
+        # BGZF, decompressed in parallel
+        self.sh("GenomeBVcount -o 23 -H 300000 -S 1:0 lib1.bgz.gz / lib3.bgz.gz > in_bgz.out")
+        self.assertSame("in.out", "in_bgz.out")
+        self.sh("GenomeBVcount -o 23 -H 300000 -S 1:0 -t 4 lib1.bgz.gz / lib3.bgz.gz > in_bgzt.out")
+        self.assertSame("in.out", "in_bgzt.out")
+        # BGZF blocks followed by ordinary gzip members, as cat makes
+        self.sh("cat lib1.bgz.gz lib1.fam.gz > lib11.gz; GenomeBVcount -o 23 -H 300000 -S 1:0 lib1.fam.gz lib1.fam.gz / lib3.fam.gz > in2.out")
+        self.sh("GenomeBVcount -o 23 -H 300000 -S 1:0 lib11.gz / lib3.bgz.gz > in_mixed.out")
+        self.assertSame("in2.out", "in_mixed.out")
+        self.sh("GenomeBVcount -o 23 -H 300000 -S 1:0 -t 4 <(cat lib11.gz) / lib3.fam.gz > in_mixedt.out")
+        self.assertSame("in2.out", "in_mixedt.out")
+        # pipes, gzipped and not
+        self.sh("GenomeBVcount -o 23 -H 300000 -S 1:0 <(cat lib1.fam.gz) / <(gunzip -c lib3.fam.gz) > in_pipe.out")
+        self.assertSame("in.out", "in_pipe.out")
+        self.sh("GenomeBVcount -o 23 -H 300000 -S 1:0 <(cat lib1.fq) / <(gzip -c lib3.fq) > in_pipefq.out")
+        self.assertSame("in.out", "in_pipefq.out")
+
+        self.sh("GenomeMmScan -o 23 -i intable.txt -a -H 100003 -s -S 11:5 lib1.fam.gz lib3.fam.gz > scan_in.txt")
+        self.sh("GenomeMmScan -o 23 -i intable.txt -a -H 100003 -s -S 11:5 lib1.fq <(cat lib3.bgz.gz) > scan_in2.txt")
+        self.assertEqual(self.lines("scan_in.txt"), self.lines("scan_in2.txt"))
+
+    def test_mmscan(self):
+        scan = "GenomeMmScan -o 23 -i intable.txt -a -H 100003 -s -S 11:5"
+        libs = "lib1.fam.gz lib3.fam.gz"
+        self.sh("%s %s > scan.txt" % (scan, libs))
+        self.assertTrue(len(self.lines("scan.txt")) > 0)
+        # compressed output
+        self.sh("%s -O scan.txt.gz %s" % (scan, libs))
+        self.assertEqual(self.lines("scan.txt"), self.lines("scan.txt.gz"))
+        # as test_jam_mmscan.py makes it, piped through gzip
+        self.sh("%s %s | gzip > scan_pipe.txt.gz" % (scan, libs))
+        self.sh("zcat scan.txt.gz > scan_O.zcat; zcat scan_pipe.txt.gz > scan_pipe.zcat")
+        self.assertEqual(self.lines("scan_pipe.zcat"), self.lines("scan_O.zcat"))
+        self.sh("%s -O scan_O.txt %s" % (scan, libs))
+        self.assertEqual(self.lines("scan.txt"), self.lines("scan_O.txt"))
+        # perfect hash
+        self.sh("%s -F %s > scan_F.txt" % (scan, libs))
+        self.assertEqual(self.lines("scan.txt"), self.lines("scan_F.txt"))
+
+        # snapshot: written on the first run, mapped on the second
+        self.sh("rm -f scan.snp; %s -T scan.snp %s > scan_T1.txt" % (scan, libs))
+        self.assertTrue(os.path.isfile(self.path("scan.snp")))
+        self.assertEqual(self.lines("scan.txt"), self.lines("scan_T1.txt"))
+        self.sh("%s -T scan.snp %s > scan_T2.txt 2> scan_T2.err" % (scan, libs))
+        self.assertEqual(self.lines("scan.txt"), self.lines("scan_T2.txt"))
+        self.assertTrue("Mapped table snapshot" in "".join(self.lines("scan_T2.err")))
+        self.sh("%s -T scan.snp -F %s > scan_TF.txt" % (scan, libs))
+        self.assertEqual(self.lines("scan.txt"), self.lines("scan_TF.txt"))
+
+        # a snapshot of a changed InputTable must not be mapped
+        intable = self.lines("intable.txt")
+        f = open(self.path("intable2.txt"), "w")
+        f.write("".join(intable[: len(intable) / 2]))
+        f.close()
+        self.sh("cp intable2.txt intable_T.txt")
+        self.sh("%s -T scan2.snp %s > /dev/null" % (scan.replace("intable.txt", "intable_T.txt"), libs))
+        self.sh("cp intable.txt intable_T.txt")
+        self.sh("%s -T scan2.snp %s > scan_T3.txt 2> scan_T3.err" % (scan.replace("intable.txt", "intable_T.txt"), libs))
+        err = "".join(self.lines("scan_T3.err"))
+        self.assertTrue("was built differently" in err)
+        self.assertFalse("Mapped table snapshot" in err)
+        self.assertEqual(self.lines("scan.txt"), self.lines("scan_T3.txt"))
+        # nor made from a pipe
+        r = self.sh("%s -T scan3.snp -i <(cat intable.txt) %s > /dev/null" % (scan.replace(" -i intable.txt", ""), libs))
+        self.assertNotEqual(r, 0)
+        self.assertFalse(os.path.exists(self.path("scan3.snp")))
+        # nor by a run with different options
+        self.sh("%s -R -T scan.snp %s > /dev/null 2> scan_R.err" % (scan, libs))
+        self.assertFalse("Mapped table snapshot" in "".join(self.lines("scan_R.err")))
+
+    def test_mmedges(self):
+        edges = "GenomeMmEdges -o 23 -i intable.txt -S 11:5 -H 170000"
+        libs = "lib1.fam.gz lib2.fam.gz lib3.fam.gz"
+        self.sh("%s -e edges.txt.gz %s > edges.out" % (edges, libs))
+        self.assertTrue(len(self.lines("edges.txt.gz")) > 0)
+        self.sh("%s -F -e edges_F.txt.gz %s > edges_F.out" % (edges, libs))
+        self.assertEqual(self.lines("edges.txt.gz"), self.lines("edges_F.txt.gz"))
+        self.assertEqual(self.lines("edges.out"), self.lines("edges_F.out"))
+        self.sh("rm -f edges.snp; %s -T edges.snp -e edges_T1.txt.gz %s > /dev/null" % (edges, libs))
+        self.sh("%s -T edges.snp -e edges_T2.txt.gz %s > /dev/null 2> edges_T2.err" % (edges, libs))
+        self.assertTrue("Mapped table snapshot" in "".join(self.lines("edges_T2.err")))
+        self.assertEqual(self.lines("edges.txt.gz"), self.lines("edges_T1.txt.gz"))
+        self.assertEqual(self.lines("edges.txt.gz"), self.lines("edges_T2.txt.gz"))
+        self.sh("%s -e edges_fq.txt.gz lib1.fq lib2.bgz.gz <(cat lib3.fq) > /dev/null" % edges)
+        self.assertEqual(self.lines("edges.txt.gz"), self.lines("edges_fq.txt.gz"))
+
+        # contigs walked from the edges, and from the reads, start from the
+        # same kmers with -F, so they are numbered the same
+        contigs = "GenomeMmContigs -o 23 -i intable.txt -S 11:5 -H 170000"
+        self.sh("%s -E edges.txt.gz -w contigs.txt > /dev/null" % contigs)
+        self.assertTrue(len(self.lines("contigs.txt")) > 1)
+        self.sh("%s -F -E edges.txt.gz -w contigs_F.txt > /dev/null" % contigs)
+        self.assertEqual(self.lines("contigs.txt"), self.lines("contigs_F.txt"))
+        self.sh("%s -w contigs_r.txt %s > /dev/null" % (contigs, libs))
+        self.sh("%s -F -w contigs_rF.txt %s > /dev/null" % (contigs, libs))
+        self.assertEqual(self.lines("contigs_r.txt"), self.lines("contigs_rF.txt"))
+
+
+if __name__ == '__main__':
+    #unittest.main()
+    suite = unittest.TestLoader().loadTestsFromTestCase(TestJamOptions)
+    r=unittest.TextTestRunner(verbosity=2).run(suite)
+    if not r.wasSuccessful():
+        exit(1)
+    else:
+        exit(0)